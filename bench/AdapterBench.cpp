@@ -0,0 +1,348 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <lstring.h>
+#include <adaptertypes.h>
+#include <padapter.h>
+#include <Timer.h>
+#include <CanDriver.h>
+#include <EcuUart.h>
+#include <PwmDriver.h>
+#include <AdcDriver.h>
+#include <led.h>
+#include <j1979.h>
+#include "EcuSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+using namespace util;
+
+//
+// The end-to-end benchmark: the command mixes are driven through AdptOnCmd against
+// the simulated ECUs, the latency is measured from the command to the prompt.
+// The host link and the heap are instrumented here, the benchmark replaces adapter.cpp.
+//
+
+const uint32_t MONITOR_TIME    = 1000000; // usec
+const uint32_t TRAFFIC_PERIOD  = 50000;   // usec, the other tester requests in monitor
+const uint32_t KEEPALIVE_STEP  = 10000;   // usec, the command offset into the keepalive
+const int      KEEPALIVE_STEPS = 10;
+const int      BENCH_ECUS      = 2;
+
+struct Scenario {
+    const char* name;
+    const char* command;
+    int         count;
+    bool        monitor;
+    bool        keepAlive;
+};
+
+static const Scenario Scenarios[] = {
+    { "pid",       "010C", 100, false, false }, // Single PID polls
+    { "vin",       "0902",  10, false, false },
+    { "dtc",       "03",    20, false, false },
+    { "monitor",   "ATMA",   1, true,  false }, // Bus capture, J1850 only
+    { "keepalive", "010C",  20, false, true  }  // PID poll preempting the keepalive, K-line only
+};
+
+static const char* const ProtocolNames[] = {
+    "", "J1850_PWM", "J1850_VPW", "ISO9141", "ISO14230_5BPS", "ISO14230",
+    "ISO15765_11_500", "ISO15765_29_500"
+};
+
+// The host link counters
+static uint32_t hostBytes;
+static uint32_t hostLines;
+static uint64_t monitorStop;
+
+// The heap counters, only the adapter calls are counted
+static bool     heapCount;
+static uint32_t heapOps;
+
+void* operator new(size_t size)
+{
+    if (heapCount)
+        heapOps++;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (heapCount && p)
+        heapOps++;
+    free(p);
+}
+
+/**
+ * Count the bytes sent to the host
+ * @param[in] str String to send
+ */
+void AdptSendString(string_view str)
+{
+    hostBytes += str.length();
+    for (size_t i = 0; i < str.length(); i++) {
+        if (str[i] == '\r')
+            hostLines++;
+    }
+}
+
+/**
+ * The monitor is stopped by the simulated host input
+ * @return true if the monitor time is over
+ */
+bool AdptCheckHostInput()
+{
+    return monitorStop && VirtualClock::instance()->now() >= monitorStop;
+}
+
+/**
+ * The other tester polling the ECUs, the bus traffic for the monitor
+ * @param[in] arg Not used
+ */
+static void TrafficEvent(void* arg)
+{
+    const uint8_t request[] = { 0x01, 0x0C };
+    VirtualClock* clock = VirtualClock::instance();
+    if (!monitorStop || clock->now() >= monitorStop)
+        return;
+    EcuSim::instance()->request(request, sizeof(request));
+    clock->schedule(TrafficEvent, 0, clock->now() + TRAFFIC_PERIOD);
+}
+
+/**
+ * Stay idle running the keepalive task, as the adapter main loop does
+ * @param[in] interval The idle time, usec
+ */
+static void RunIdle(uint64_t interval)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    uint64_t until = clock->now() + interval;
+    while (clock->now() < until) {
+        AdptCheckHeartBeat();
+        clock->poll();
+    }
+}
+
+/**
+ * Run the adapter command
+ * @param[in] cmd The command
+ */
+static void RunCommand(const char* cmd)
+{
+    CmdString cmdString(cmd);
+    AdptOnCmd(cmdString);
+}
+
+struct Result {
+    const char* name;
+    int      commands;
+    uint64_t p50;        // usec, simulated
+    uint64_t p99;
+    uint64_t total;
+    uint64_t wallP50;    // nsec
+    uint64_t wallP99;
+    uint64_t wallTotal;
+    uint32_t bytes;
+    uint32_t lines;
+    uint32_t heapOps;
+};
+
+/**
+ * Get the percentile of the sorted values
+ * @param[in] values The sorted values
+ * @param[in] pct The percentile
+ * @return The value
+ */
+static uint64_t Percentile(const vector<uint64_t>& values, int pct)
+{
+    size_t idx = (values.size() * pct) / 100;
+    return values[idx < values.size() ? idx : values.size() - 1];
+}
+
+/**
+ * Run the scenario, the command-to-prompt times are collected
+ * @param[in] scenario The scenario
+ * @param[out] result The measurements
+ */
+static void RunScenario(const Scenario& scenario, Result& result)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    vector<uint64_t> simTimes;
+    vector<uint64_t> wallTimes;
+    simTimes.reserve(scenario.count);
+    wallTimes.reserve(scenario.count);
+
+    hostBytes = hostLines = heapOps = 0;
+    for (int i = 0; i < scenario.count; i++) {
+        if (scenario.monitor) {
+            monitorStop = clock->now() + MONITOR_TIME;
+            clock->schedule(TrafficEvent, 0, clock->now() + TRAFFIC_PERIOD);
+        }
+        if (scenario.keepAlive) {
+            // The keepalive starts after the wakeup interval, the command lands
+            // on the different phases of it
+            RunIdle(DEFAULT_WAKEUP_TIME * 1000ULL + (i % KEEPALIVE_STEPS) * KEEPALIVE_STEP);
+        }
+        uint64_t start = clock->now();
+        auto wallStart = chrono::steady_clock::now();
+        heapCount = true;
+        RunCommand(scenario.command);
+        heapCount = false;
+        auto wallEnd = chrono::steady_clock::now();
+        simTimes.push_back(clock->now() - start);
+        wallTimes.push_back(chrono::duration_cast<chrono::nanoseconds>(wallEnd - wallStart).count());
+        monitorStop = 0;
+    }
+
+    result.name = scenario.name;
+    result.commands = scenario.count;
+    result.bytes = hostBytes;
+    result.lines = hostLines;
+    result.heapOps = heapOps;
+    result.total = result.wallTotal = 0;
+    for (int i = 0; i < scenario.count; i++) {
+        result.total += simTimes[i];
+        result.wallTotal += wallTimes[i];
+    }
+    sort(simTimes.begin(), simTimes.end());
+    sort(wallTimes.begin(), wallTimes.end());
+    result.p50 = Percentile(simTimes, 50);
+    result.p99 = Percentile(simTimes, 99);
+    result.wallP50 = Percentile(wallTimes, 50);
+    result.wallP99 = Percentile(wallTimes, 99);
+}
+
+/**
+ * Print the scenario result as JSON object
+ * @param[in] out The output file
+ * @param[in] result The measurements
+ * @param[in] wall Include the host wall time
+ * @param[in] last The last object in array
+ */
+static void PrintResult(FILE* out, const Result& result, bool wall, bool last)
+{
+    double seconds = result.total / 1e6;
+    fprintf(out, "        { \"scenario\": \"%s\", \"commands\": %d, ", result.name, result.commands);
+    fprintf(out, "\"p50_us\": %llu, \"p99_us\": %llu, \"req_per_s\": %.2f, ",
+        (unsigned long long)result.p50, (unsigned long long)result.p99,
+        seconds > 0 ? result.commands / seconds : 0.0);
+    fprintf(out, "\"host_bytes\": %u, \"host_lines\": %u, \"lines_per_s\": %.2f, \"heap_ops\": %u",
+        result.bytes, result.lines, seconds > 0 ? result.lines / seconds : 0.0, result.heapOps);
+    if (wall) {
+        double wallSeconds = result.wallTotal / 1e9;
+        fprintf(out, ", \"wall_p50_ns\": %llu, \"wall_p99_ns\": %llu, \"wall_req_per_s\": %.0f",
+            (unsigned long long)result.wallP50, (unsigned long long)result.wallP99,
+            wallSeconds > 0 ? result.commands / wallSeconds : 0.0);
+    }
+    fprintf(out, " }%s\n", last ? "" : ",");
+}
+
+/**
+ * Run all the scenarios for the protocol, the previous protocol is closed
+ * and the first request connects
+ * @param[in] out The output file
+ * @param[in] protocol The protocol number
+ * @param[in] wall Include the host wall time
+ * @param[in] last The last protocol
+ */
+static void RunProtocol(FILE* out, int protocol, bool wall, bool last)
+{
+    char spec[32];
+    sprintf(spec, "%d,ecus=%d", protocol, BENCH_ECUS);
+    EcuSim::instance()->configure(spec);
+
+    char cmd[8];
+    sprintf(cmd, "ATSP%d", protocol);
+    RunCommand("ATPC");
+    RunCommand("ATZ");
+    RunCommand(cmd);
+    RunCommand("0100");
+
+    const bool j1850 = (protocol == PROT_J1850_PWM || protocol == PROT_J1850_VPW);
+    const bool kline = (protocol >= PROT_ISO9141 && protocol <= PROT_ISO14230);
+    vector<Result> results;
+    for (const Scenario& scenario : Scenarios) {
+        if ((scenario.monitor && !j1850) || (scenario.keepAlive && !kline))
+            continue;
+        Result result;
+        RunScenario(scenario, result);
+        results.push_back(result);
+    }
+
+    const EcuSimStats& stats = EcuSim::instance()->stats();
+    fprintf(out, "    { \"protocol\": %d, \"name\": \"%s\", \"ecus\": %d, \"ecu_requests\": %u, \"ecu_replies\": %u,\n",
+        protocol, ProtocolNames[protocol], BENCH_ECUS, stats.requests, stats.replies);
+    fprintf(out, "      \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        PrintResult(out, results[i], wall, i == results.size() - 1);
+    }
+    fprintf(out, "    ] }%s\n", last ? "" : ",");
+    EcuSim::instance()->resetStats();
+}
+
+/**
+ * Usage: allpro-bench [-s] [-p protocol] [output.json]
+ *   -s  simulated time only, the output is reproducible for the baseline
+ *   -p  run the single protocol
+ */
+int main(int argc, char** argv)
+{
+    bool wall = true;
+    int protocol = 0;
+    const char* path = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0)
+            wall = false;
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            protocol = atoi(argv[++i]);
+        else if (argv[i][0] != '-')
+            path = argv[i];
+        else {
+            fprintf(stderr, "Usage: %s [-s] [-p protocol] [output.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (protocol < 0 || protocol > PROT_ISO15765_2950) {
+        fprintf(stderr, "Invalid protocol %d\n", protocol);
+        return 1;
+    }
+    FILE* out = path ? fopen(path, "w") : stdout;
+    if (!out) {
+        perror(path);
+        return 1;
+    }
+
+    TimeStamp::configure();
+    EcuUart::configure();
+    CanDriver::configure();
+    AdptLED::configure();
+    PwmDriver::configure();
+    AdcDriver::configure();
+    AdptDispatcherInit();
+
+    const int first = protocol ? protocol : PROT_J1850_PWM;
+    const int last = protocol ? protocol : PROT_ISO15765_2950;
+    fprintf(out, "{\n  \"benchmark\": \"allpro-host\",\n  \"protocols\": [\n");
+    for (int p = first; p <= last; p++) {
+        RunProtocol(out, p, wall, p == last);
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (path)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <checksum.h>
+
+using namespace std;
+using namespace util;
+
+//
+// The known-answer vectors for J1850 CRC and ISO checksum, the table CRC is checked
+// against the previous bit-wise implementation and both are timed on OBD frame sizes
+//
+
+const int FRAME_LEN   = 12;      // The longest J1850 frame
+const int BENCH_LOOPS = 2000000;
+
+struct Vector {
+    const char* name;
+    uint8_t     data[FRAME_LEN];
+    int         len;
+    uint8_t     crc;
+    uint8_t     sum;
+};
+
+static const Vector Vectors[] = {
+    { "empty",       { },                                                     0, 0x00, 0x00 },
+    { "check",       { '1', '2', '3', '4', '5', '6', '7', '8', '9' },         9, 0x4B, 0xDD },
+    { "ff",          { 0xFF },                                                1, 0xFF, 0xFF },
+    { "vpw_request", { 0x68, 0x6A, 0xF1, 0x01, 0x00 },                        5, 0x17, 0xC4 },
+    { "pwm_request", { 0x61, 0x6A, 0xF1, 0x01, 0x0C },                        5, 0x96, 0xC9 },
+    { "reply",       { 0x48, 0x6B, 0x10, 0x41, 0x00, 0xBE, 0x3F, 0xA0, 0x13 }, 9, 0xA1, 0xB4 }
+};
+
+/**
+ * The bit-wise J1850 CRC, the implementation replaced by the table
+ * @param[in] data Data bytes
+ * @param[in] len Data length
+ * @return The CRC byte
+ */
+static uint8_t Crc8Bitwise(const uint8_t* data, int len)
+{
+    uint8_t chksum = 0xFF;
+    while (len--) {
+        int i = 8;
+        uint8_t val = *(data++);
+        while (i--) {
+            if (((val ^ chksum) & 0x80) != 0) {
+                chksum ^= 0x0E;
+                chksum = (chksum << 1) | 1;
+            }
+            else {
+                chksum = chksum << 1;
+            }
+            val = val << 1;
+        }
+    }
+    return ~chksum;
+}
+
+/**
+ * Check the vectors and compare the table CRC with the bit-wise one
+ * @return The number of failures
+ */
+static int CheckVectors()
+{
+    int failed = 0;
+    for (const Vector& v : Vectors) {
+        uint8_t crc = crc8_j1850(v.data, v.len);
+        uint8_t sum = iso_checksum(v.data, v.len);
+        if (crc != v.crc || sum != v.sum) {
+            printf("FAIL %s: crc %02X/%02X sum %02X/%02X\n", v.name, crc, v.crc, sum, v.sum);
+            failed++;
+        }
+    }
+
+    // All single bytes and the pseudo-random frames up to the longest frame
+    uint8_t data[FRAME_LEN];
+    for (int i = 0; i < 256; i++) {
+        data[0] = i;
+        if (crc8_j1850(data, 1) != Crc8Bitwise(data, 1)) {
+            printf("FAIL byte %02X\n", i);
+            failed++;
+        }
+    }
+    srand(1);
+    for (int n = 0; n < 10000; n++) {
+        int len = 1 + n % FRAME_LEN;
+        for (int i = 0; i < len; i++) {
+            data[i] = rand();
+        }
+        if (crc8_j1850(data, len) != Crc8Bitwise(data, len)) {
+            printf("FAIL frame %d\n", n);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/**
+ * Time the CRC function on the full size frame
+ * @param[in] name The function name
+ * @param[in] crc The function
+ */
+template <typename T>
+static void TimeCrc(const char* name, T crc)
+{
+    uint8_t data[FRAME_LEN];
+    for (int i = 0; i < FRAME_LEN; i++) {
+        data[i] = i * 37;
+    }
+
+    volatile uint8_t result = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_LOOPS; i++) {
+        data[0] = i;
+        result = result + crc(data, FRAME_LEN);
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    printf("%-14s %6.1f ns/frame\n", name, ns / BENCH_LOOPS);
+}
+
+/**
+ * Usage: allpro-checksum-bench [-c]
+ *   -c  check the vectors only, no timing
+ */
+int main(int argc, char** argv)
+{
+    bool timing = !(argc > 1 && strcmp(argv[1], "-c") == 0);
+
+    int failed = CheckVectors();
+    printf("checksum vectors: %s\n", failed ? "FAILED" : "OK");
+    if (failed || !timing)
+        return failed ? 1 : 0;
+
+    TimeCrc("crc8_bitwise", Crc8Bitwise);
+    TimeCrc("crc8_j1850", crc8_j1850);
+    TimeCrc("iso_checksum", iso_checksum);
+    return 0;
+}
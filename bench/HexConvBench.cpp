@@ -0,0 +1,246 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <lstring.h>
+#include <algorithms.h>
+#include <hexconv.h>
+#include <adaptertypes.h>
+
+using namespace std;
+using namespace util;
+
+//
+// The known-answer and round-trip checks for hex_encode/hex_decode, the adapter
+// to_bytes/to_ascii are timed against the previous character loops
+//
+
+const int MAX_BYTES   = 40;
+const int BENCH_LOOPS = 1000000;
+const uint8_t CANARY  = 0xEE;
+
+/**
+ * The previous to_bytes, two characters at the time with stoul
+ * @param[in] str The characters to convert
+ * @param[out] bytes The output bytes
+ * @return The number of bytes, 0 if invalid
+ */
+static uint32_t OldToBytes(string_view str, uint8_t* bytes)
+{
+    int len = str.length();
+    if ((len % 2) != 0)
+        return 0;
+
+    int j = 0;
+    for (int i = 0; i < len / 2; i++) {
+        uint32_t pos;
+        uint32_t hexValue = stoul(str.substr(j, 2), &pos, 16);
+        if (pos != 2)
+            return 0;
+        bytes[i] = hexValue;
+        j += 2;
+    }
+    return len / 2;
+}
+
+/**
+ * The previous to_ascii, one character at the time
+ * @param[in] bytes The byte array to convert
+ * @param[in] length The buffer length
+ * @param[out] str The output string
+ * @param[in] useSpaces Separate the bytes by space
+ */
+static void OldToAscii(const uint8_t* bytes, uint32_t length, string& str, bool useSpaces)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        str += to_ascii(bytes[i] >> 4);
+        str += to_ascii(bytes[i] & 0x0F);
+        if (useSpaces) {
+            str += ' ';
+        }
+    }
+    if (useSpaces && str.length() > 0) {
+        str.resize(str.length() - 1); // Truncate the last space
+    }
+}
+
+static int failed;
+
+/**
+ * Report the failed check
+ * @param[in] ok The check result
+ * @param[in] what The check description
+ * @param[in] num The case number
+ */
+static void Check(bool ok, const char* what, int num)
+{
+    if (!ok) {
+        printf("FAIL %s %d\n", what, num);
+        failed++;
+    }
+}
+
+/**
+ * The known answers, both cases of hex digits and the separator
+ */
+static void CheckKnownAnswers()
+{
+    const uint8_t bytes[] = { 0x00, 0x7F, 0xA5, 0xFF, 0x0C };
+    char out[sizeof(bytes) * 3 + 1];
+
+    uint32_t n = hex_encode(bytes, sizeof(bytes), out);
+    Check(n == 10 && memcmp(out, "007FA5FF0C", n) == 0, "encode", 0);
+    n = hex_encode(bytes, sizeof(bytes), out, ' ');
+    Check(n == 14 && memcmp(out, "00 7F A5 FF 0C", n) == 0, "encode separator", 0);
+    Check(hex_encode(bytes, 0, out, ' ') == 0, "encode empty", 0);
+
+    const char digits[] = "0123456789abcdefABCDEF";
+    const uint8_t expected[] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0xAB, 0xCD, 0xEF };
+    uint8_t decoded[sizeof(expected)];
+    n = hex_decode(digits, sizeof(digits) - 1, decoded);
+    Check(n == sizeof(expected) && memcmp(decoded, expected, n) == 0, "decode", 0);
+    Check(hex_decode(digits, 0, decoded) == 0, "decode empty", 0);
+}
+
+/**
+ * The invalid input, odd length and every non-hex character at every position
+ */
+static void CheckInvalid()
+{
+    const char bad[] = { 'G', 'g', ' ', '/', ':', '@', '`', 'x', '\x80', '\xFF', '\0' };
+    char str[] = "0123456789ABCDEF01";
+    const uint32_t len = sizeof(str) - 1;
+    uint8_t bytes[MAX_BYTES];
+
+    Check(hex_decode(str, len - 1, bytes) == 0, "decode odd length", len - 1);
+    Check(hex_decode(str, 1, bytes) == 0, "decode odd length", 1);
+    Check(OldToBytes(string_view(str, 3), bytes) == 0, "old odd length", 3);
+    for (uint32_t pos = 0; pos < len; pos++) {
+        for (char ch : bad) {
+            char saved = str[pos];
+            str[pos] = ch;
+            Check(hex_decode(str, len, bytes) == 0, "decode invalid", pos);
+            Check(to_bytes(string_view(str, len), bytes) == 0, "to_bytes invalid", pos);
+            str[pos] = saved;
+        }
+    }
+}
+
+/**
+ * Encode and decode back every length, compare with the previous routines and
+ * check nothing is written past the documented output size
+ */
+static void CheckRoundTrip()
+{
+    srand(1);
+    for (int len = 0; len <= MAX_BYTES; len++) {
+        uint8_t bytes[MAX_BYTES];
+        for (int i = 0; i < len; i++) {
+            bytes[i] = rand();
+        }
+        for (int sep = 0; sep < 2; sep++) {
+            const char separator = sep ? ' ' : 0;
+            char out[MAX_BYTES * 3 + 2];
+            memset(out, CANARY, sizeof(out));
+            uint32_t n = hex_encode(bytes, len, out, separator);
+            Check(static_cast<uint8_t>(out[len * 3 + 1]) == CANARY, "encode overrun", len);
+
+            fstring<MAX_BYTES * 3> oldStr;
+            OldToAscii(bytes, len, oldStr, separator != 0);
+            Check(n == oldStr.length() && memcmp(out, oldStr.c_str(), n) == 0, "encode old", len);
+
+            fstring<MAX_BYTES * 3> newStr;
+            to_ascii(bytes, len, newStr, separator);
+            Check(newStr == oldStr, "to_ascii old", len);
+
+            if (separator)
+                continue;
+            uint8_t decoded[MAX_BYTES + 1];
+            memset(decoded, CANARY, sizeof(decoded));
+            uint32_t m = hex_decode(out, n, decoded);
+            Check(m == static_cast<uint32_t>(len) && memcmp(decoded, bytes, len) == 0, "round trip", len);
+            Check(decoded[len] == CANARY, "decode overrun", len);
+        }
+    }
+}
+
+/**
+ * The output string is full, to_ascii is truncated at the capacity
+ */
+static void CheckFullString()
+{
+    const uint8_t bytes[] = { 0x41, 0x0C, 0x0B, 0xB8, 0x12, 0x34, 0x56, 0x78 };
+    for (uint32_t used = REPLY_LEN - 10; used <= REPLY_LEN; used++) {
+        ReplyString str(used, 'x');
+        to_ascii(bytes, sizeof(bytes), str, ' ');
+        Check(str.length() == REPLY_LEN, "full length", used);
+        Check(memcmp(str.c_str() + used, "41 0C 0B B8 12 34", REPLY_LEN - used) == 0, "full data", used);
+        Check(str.c_str()[REPLY_LEN] == 0, "full terminator", used);
+    }
+}
+
+/**
+ * Time the function on OBD reply size data
+ * @param[in] name The function name
+ * @param[in] func The function, takes the loop number
+ */
+template <typename T>
+static void Time(const char* name, T func)
+{
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_LOOPS; i++) {
+        func(i);
+    }
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    printf("%-16s %6.1f ns/call\n", name, ns / BENCH_LOOPS);
+}
+
+/**
+ * Usage: allpro-hexconv-bench [-c]
+ *   -c  run the checks only, no timing
+ */
+int main(int argc, char** argv)
+{
+    bool timing = !(argc > 1 && strcmp(argv[1], "-c") == 0);
+
+    CheckKnownAnswers();
+    CheckInvalid();
+    CheckRoundTrip();
+    CheckFullString();
+    printf("hexconv checks: %s\n", failed ? "FAILED" : "OK");
+    if (failed || !timing)
+        return failed ? 1 : 0;
+
+    // The request and the single frame reply as seen on the command port
+    const char request[] = "7E00064100BE3FA0";
+    const uint8_t reply[] = { 0x07, 0xE8, 0x06, 0x41, 0x00, 0xBE, 0x3F, 0xA0, 0x13 };
+    static volatile uint32_t sink;
+    uint8_t bytes[MAX_BYTES];
+
+    char out[sizeof(reply) * 3 + 1];
+
+    // The adapter functions include the profiling zone, the kernels are timed alone too
+    Time("old to_bytes", [&](int i) { sink = OldToBytes(string_view(request, sizeof(request) - 1), bytes); });
+    Time("to_bytes", [&](int i) { sink = to_bytes(string_view(request, sizeof(request) - 1), bytes); });
+    Time("hex_decode", [&](int i) { sink = hex_decode(request, sizeof(request) - 1, bytes); });
+    Time("old to_ascii", [&](int i) {
+        ReplyString str;
+        OldToAscii(reply, sizeof(reply), str, true);
+        sink = str.length();
+    });
+    Time("to_ascii", [&](int i) {
+        ReplyString str;
+        to_ascii(reply, sizeof(reply), str, ' ');
+        sink = str.length();
+    });
+    Time("hex_encode", [&](int i) { sink = hex_encode(reply, sizeof(reply), out, ' '); });
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <lstring.h>
+
+using namespace std;
+using namespace util;
+
+//
+// The fixed-capacity string checks: the assignment from a view into the same
+// storage, append and the truncation at the capacity
+//
+
+static int failed;
+
+/**
+ * Compare the string with the expected characters and check the terminator
+ * @param[in] str The string
+ * @param[in] expected The expected characters
+ * @param[in] what The check description
+ */
+static void Check(const string& str, const char* expected, const char* what)
+{
+    uint32_t len = strlen(expected);
+    if (str.length() != len || memcmp(str.c_str(), expected, len) != 0 || str.c_str()[len] != 0) {
+        printf("FAIL %s: \"%s\" length %u\n", what, str.c_str(), (unsigned)str.length());
+        failed++;
+    }
+}
+
+/**
+ * Assign a part of the string to itself
+ */
+static void CheckSelfAssign()
+{
+    fstring<16> s;
+    s = "HELLO";
+    s = s.substr(0, 2);
+    Check(s, "HE", "self prefix");
+
+    s = "HELLO";
+    s = s.substr(2);
+    Check(s, "LLO", "self suffix");
+
+    s = "HELLO";
+    s = s.substr(1, 3);
+    Check(s, "ELL", "self middle");
+
+    s = "HELLO";
+    s = s;
+    Check(s, "HELLO", "self whole");
+
+    s = "HELLO";
+    s = s.substr(0, 0);
+    Check(s, "", "self empty");
+}
+
+/**
+ * Assign and append from the other strings and views
+ */
+static void CheckAssignAppend()
+{
+    fstring<16> s;
+    fstring<16> t("ATSP6");
+    s = t;
+    Check(s, "ATSP6", "assign string");
+    s = string_view("0100 1", 4);
+    Check(s, "0100", "assign view");
+    s += ' ';
+    s += s.substr(0, 2);
+    Check(s, "0100 01", "append self");
+    s.clear();
+    Check(s, "", "clear");
+}
+
+/**
+ * The assignment and append longer than the capacity are truncated
+ */
+static void CheckCapacity()
+{
+    fstring<4> s;
+    s = "ABCDEF";
+    Check(s, "ABCD", "assign truncated");
+    s = "AB";
+    s += "CDEF";
+    Check(s, "ABCD", "append truncated");
+    s += 'E';
+    Check(s, "ABCD", "append char truncated");
+    s.resize(8, 'x');
+    Check(s, "ABCD", "resize truncated");
+}
+
+int main()
+{
+    CheckSelfAssign();
+    CheckAssignAppend();
+    CheckCapacity();
+    printf("string checks: %s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
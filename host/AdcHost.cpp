@@ -0,0 +1,26 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include "AdcDriver.h"
+
+const uint32_t AdcValue = 2738; // Reads as 12.6V
+
+/**
+ * Nothing to configure
+ */
+void AdcDriver::configure()
+{
+}
+
+/**
+ * Read the simulated battery voltage
+ * @return The fixed ADC value
+ */
+uint32_t AdcDriver::read()
+{
+    return AdcValue;
+}
@@ -0,0 +1,186 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <canmsgbuffer.h>
+#include <led.h>
+#include "CanDriver.h"
+#include "HostSim.h"
+#include "Profiler.h"
+
+const int RX_QUEUE_LEN = 16; // Should be power of 2
+CAN_HANDLE_T CanDriver::handle_;
+
+// The simulated C-CAN receive FIFO
+static CanMsgBuffer rxQueue[RX_QUEUE_LEN];
+static uint32_t rxHead;
+static uint32_t rxTail;
+static uint32_t rxFilter;
+static uint32_t rxMask;
+static bool     rxExtended;
+static uint32_t lineLevel = 1;
+static CanListenerT canListener;
+
+/**
+ * Nothing to configure
+ */
+void CanDriver::configure()
+{
+}
+
+/**
+ * CanDriver singleton
+ * @return The pointer to CanDriver instance
+ */
+CanDriver* CanDriver::instance()
+{
+    static CanDriver instance;
+    return &instance;
+}
+
+/**
+ * Constructor
+ */
+CanDriver::CanDriver()
+{
+}
+
+/**
+ * Transmits the frame, the listener sees it right away
+ * @parameter   buff   CanMsgBuffer instance
+ * @return the send operation completion status
+ */
+bool CanDriver::send(const CanMsgBuffer* buff)
+{
+    AdptLED::instance()->blinkTx();
+    if (canListener) {
+        (*canListener)(buff);
+    }
+    return true;
+}
+
+/**
+ * Set the receive filter, all the FIFO buffers are using the same one
+ * @parameter   filter    CAN filter value
+ * @parameter   mask      CAN mask value
+ * @parameter   msgobj    C-CAN message object number, ignored
+ * @parameter   extended  CAN extended message flag
+ * @parameter   fifoLast  last FIFO message buffer flag, ignored
+ */
+void CanDriver::configRxMsgobj(uint32_t filter, uint32_t mask, uint8_t msgobj, bool extended, bool fifoLast)
+{
+    rxFilter = filter;
+    rxMask = mask;
+    rxExtended = extended;
+}
+
+/**
+ * Set the CAN filter for FIFO buffer
+ * @parameter   filter    CAN filter value
+ * @parameter   mask      CAN mask value
+ * @parameter   extended  CAN extended message flag
+ * @return  the operation completion status
+ */
+bool CanDriver::setFilterAndMask(uint32_t filter, uint32_t mask, bool extended)
+{
+    configRxMsgobj(filter, mask, 1, extended, true);
+    rxTail = rxHead;
+    return true;
+}
+
+/**
+ * Read the CAN frame from FIFO buffer
+ * @return  true if read the frame / false if no frame
+ */
+bool CanDriver::read(CanMsgBuffer* buff)
+{
+    ProfileScope profile(PROF_CAN_READ);
+    if (rxTail == rxHead)
+        return false;
+    *buff = rxQueue[rxTail];
+    rxTail = (rxTail + 1) & (RX_QUEUE_LEN - 1);
+    return true;
+}
+
+/**
+ * Read CAN frame received status
+ * @return  true/false
+ */
+bool CanDriver::isReady() const
+{
+    return rxTail != rxHead;
+}
+
+/**
+ * Wakes up the CAN peripheral from sleep mode
+ * @return  true/false
+ */
+bool CanDriver::wakeUp()
+{
+    return true;
+}
+
+/**
+ * Enters the sleep (low power) mode
+ * @return  true/false
+ */
+bool CanDriver::sleep()
+{
+    return false;
+}
+
+/**
+ * Switch on/off the testing mode, nothing to do
+ * @parameter  val  CAN testing mode flag
+ */
+void CanDriver::setBitBang(bool val)
+{
+}
+
+/**
+ * Set the CAN transmitter pin status
+ * @parameter  bit  CAN TX pin value
+ */
+void CanDriver::setBit(uint32_t bit)
+{
+    lineLevel = bit;
+}
+
+/**
+ * Read CAN RX pin status, the transceiver feedback
+ * @return pin status, 1 if set, 0 otherwise
+ */
+uint32_t CanDriver::getBit()
+{
+    return lineLevel;
+}
+
+/**
+ * Set the CAN listener
+ * @param[in] listener The transmitted frame listener
+ */
+void HostCanListener(CanListenerT listener)
+{
+    canListener = listener;
+}
+
+/**
+ * The ECU frame is on the bus, store it if passed the filter, drop it if the FIFO is full
+ * @param[in] msg The frame
+ */
+void HostCanInject(const CanMsgBuffer* msg)
+{
+    if (msg->extended != rxExtended || (msg->id & rxMask) != (rxFilter & rxMask))
+        return;
+
+    uint32_t next = (rxHead + 1) & (RX_QUEUE_LEN - 1);
+    if (next == rxTail)
+        return;
+    rxQueue[rxHead] = *msg;
+    rxQueue[rxHead].msgnum = 1;
+    rxHead = next;
+    AdptLED::instance()->blinkRx();
+}
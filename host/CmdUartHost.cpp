@@ -0,0 +1,229 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "CmdUart.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+
+const uint32_t PollInterval = 1000; // The host input is checked every 1ms of simulated time
+const int RX_RING_LEN = 256;        // Should be power of 2
+
+static int  rxFd = -1;
+static int  txFd = -1;
+static bool stdioMode;
+static bool rxEof;
+static bool rxLineEnd;
+static uint8_t  rxRing[RX_RING_LEN];
+static uint32_t rxHead;
+static uint32_t rxTail;
+
+/**
+ * Constructor
+ */
+CmdUart::CmdUart()
+  : txLen_(0),
+    txPos_(0),
+    ready_(false),
+    handler_(0)
+{
+}
+
+/**
+ * CmdUart singleton
+ */
+CmdUart* CmdUart::instance()
+{
+    static CmdUart instance;
+    return &instance;
+}
+
+/**
+ * Open the command port, the pseudo-terminal or stdin/stdout if ALLPRO_PORT is "-".
+ * If ALLPRO_PORT is a path, it is created as the link to the pseudo-terminal.
+ */
+void CmdUart::configure()
+{
+    const char* port = getenv("ALLPRO_PORT");
+    if (port && strcmp(port, "-") == 0) {
+        stdioMode = true;
+        rxFd = STDIN_FILENO;
+        txFd = STDOUT_FILENO;
+        return;
+    }
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    const char* name = ptsname(fd);
+
+    // Keep the slave side open, the master is not hung up between the client sessions
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave >= 0) {
+        termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    // Drop the output rather than block if nobody is reading it
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (port && *port) {
+        unlink(port);
+        if (symlink(name, port) == 0)
+            name = port;
+    }
+    fprintf(stderr, "allpro: %s\n", name);
+    rxFd = txFd = fd;
+}
+
+/**
+ * Read all the host input available into receive ring, the input is dropped if the ring is full
+ */
+static void ReadInput()
+{
+    pollfd pfd = { rxFd, POLLIN, 0 };
+    while (!rxEof && poll(&pfd, 1, 0) > 0) {
+        uint8_t buff[64];
+        ssize_t len = read(rxFd, buff, sizeof(buff));
+        if (len == 0 && stdioMode) {
+            rxEof = true;
+        }
+        if (len <= 0)
+            break;
+        for (ssize_t i = 0; i < len; i++) {
+            uint8_t ch = (stdioMode && buff[i] == '\n') ? '\r' : buff[i];
+            uint32_t next = (rxHead + 1) & (RX_RING_LEN - 1);
+            if (next != rxTail) {
+                rxRing[rxHead] = ch;
+                rxHead = next;
+            }
+        }
+    }
+}
+
+/**
+ * Periodic input check, the analog of UART RX interrupt
+ * @param[in] arg Not used
+ */
+static void PollEvent(void* arg)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    CmdUart::instance()->irqHandler();
+    clock->schedule(PollEvent, 0, clock->now() + PollInterval);
+}
+
+/**
+ * Start the periodic command port input check, the speed is ignored
+ * @parameter[in] speed Speed to configure
+ */
+void CmdUart::init(uint32_t speed)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    clock->schedule(PollEvent, 0, clock->now() + PollInterval);
+}
+
+/**
+ * CmdUart TX handler, the output is written synchronously
+ */
+void CmdUart::txIrqHandler()
+{
+}
+
+/**
+ * CmdUart RX handler, pass the received characters to the handler. The line terminator is
+ * held back till the adapter is idle, so the command in progress is never overwritten.
+ */
+void CmdUart::rxIrqHandler()
+{
+    while (rxTail != rxHead && !ready_) {
+        uint8_t ch = rxRing[rxTail];
+        if (ch == '\r' && !rxLineEnd)
+            break;
+        rxTail = (rxTail + 1) & (RX_RING_LEN - 1);
+        if (handler_)
+            ready_ = (*handler_)(ch);
+    }
+}
+
+/**
+ * CmdUart IRQ handler
+ */
+void CmdUart::irqHandler()
+{
+    ReadInput();
+    rxIrqHandler();
+}
+
+/**
+ * Write the bytes to command port
+ * @parameter[in] data The bytes to write
+ * @parameter[in] len The number of bytes
+ */
+static void WriteOutput(const void* data, uint32_t len)
+{
+    if (txFd < 0 || write(txFd, data, len) < 0) {
+        return; // Nobody is listening
+    }
+}
+
+/**
+ * Send one character
+ * @parameter[in] ch Character to send
+ */
+void CmdUart::send(uint8_t ch)
+{
+    WriteOutput(&ch, 1);
+}
+
+/**
+ * Send the string
+ * @parameter[in] str String to send
+ */
+void CmdUart::send(util::string_view str)
+{
+    WriteOutput(str.data(), str.length());
+}
+
+/**
+ * Wait for the host input, the simulated time is moved forward by the time elapsed
+ * @param[in] timeout The maximum wait time in milliseconds
+ * @return false if the input is closed, true otherwise
+ */
+bool HostCmdPortIdle(uint32_t timeout)
+{
+    if (rxTail == rxHead) {
+        if (rxEof)
+            return false;
+
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pollfd pfd = { rxFd, POLLIN, 0 };
+        poll(&pfd, 1, timeout);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        int64_t elapsed = (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
+        VirtualClock::instance()->advance(elapsed > 0 ? elapsed : 0);
+    }
+
+    rxLineEnd = true;
+    CmdUart::instance()->irqHandler();
+    rxLineEnd = false;
+    return true;
+}
@@ -0,0 +1,533 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <padapter.h>
+#include "EcuSim.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+
+// The default timing, usec
+const uint32_t CAN_LATENCY    = 10000;
+const uint32_t KLINE_LATENCY  = 30000; // P2 min is 25ms
+const uint32_t J1850_LATENCY  = 10000;
+const uint32_t LATENCY_STEP   = 1000;
+const uint32_t KLINE_BYTE_GAP = 1000;
+
+// The vehicle data
+static const char Vin[] = "WALLPRO00SIM12345";
+static const uint8_t Dtcs[] = { 0x01, 0x33, 0x03, 0x00, 0x43, 0x00 }; // P0133, P0300, C0300
+
+const uint8_t ALL_ECUS = 0xFF;
+const uint8_t ECU0     = 0x01;
+
+struct PidData {
+    uint8_t pid;
+    uint8_t ecus;   // The ECU index bitmask
+    uint8_t len;
+    uint8_t data[4];
+};
+
+// Mode 01 PIDs, the bitmaps for 0x00/0x20/0x40 are built from this table
+static const PidData Pids[] = {
+    { 0x01, ALL_ECUS, 4, { 0x00, 0x07, 0x65, 0x00 } },
+    { 0x03, ECU0,     2, { 0x02, 0x00 } },
+    { 0x04, ECU0,     1, { 0x3F } },
+    { 0x05, ALL_ECUS, 1, { 0x7B } },
+    { 0x06, ECU0,     1, { 0x80 } },
+    { 0x07, ECU0,     1, { 0x82 } },
+    { 0x0B, ECU0,     1, { 0x21 } },
+    { 0x0C, ECU0,     2, { 0x0B, 0xB8 } },
+    { 0x0D, ALL_ECUS, 1, { 0x00 } },
+    { 0x0E, ECU0,     1, { 0x8A } },
+    { 0x0F, ECU0,     1, { 0x44 } },
+    { 0x10, ECU0,     2, { 0x01, 0x8F } },
+    { 0x11, ECU0,     1, { 0x25 } },
+    { 0x13, ECU0,     1, { 0x03 } },
+    { 0x1C, ALL_ECUS, 1, { 0x06 } },
+    { 0x1F, ECU0,     2, { 0x00, 0x3C } },
+    { 0x21, ECU0,     2, { 0x00, 0x00 } },
+    { 0x2F, ECU0,     1, { 0x80 } },
+    { 0x33, ECU0,     1, { 0x63 } },
+    { 0x42, ALL_ECUS, 2, { 0x31, 0x38 } },
+    { 0x46, ECU0,     1, { 0x3A } },
+    { 0x51, ECU0,     1, { 0x01 } }
+};
+const int PIDS_LEN = sizeof(Pids) / sizeof(Pids[0]);
+
+/**
+ * EcuSim singleton
+ * @return The pointer to EcuSim instance
+ */
+EcuSim* EcuSim::instance()
+{
+    static EcuSim instance;
+    return &instance;
+}
+
+/**
+ * Constructor, no ECU connected
+ */
+EcuSim::EcuSim()
+{
+    memset(&config_, 0, sizeof(config_));
+    resetStats();
+    reset();
+}
+
+/**
+ * Connect the ECUs to the bus given by the protocol, disconnect from the others
+ * @param[in] config The simulation parameters
+ */
+void EcuSim::configure(const EcuSimConfig& config)
+{
+    config_ = config;
+    if (config_.ecuCount < 1)
+        config_.ecuCount = 1;
+    if (config_.ecuCount > ECUS_MAX)
+        config_.ecuCount = ECUS_MAX;
+    if (config_.faultPeriod == 0)
+        config_.faultPeriod = 1;
+    reset();
+
+    const int protocol = config_.protocol;
+    HostCanListener(isCan() ? OnCanFrame : 0);
+    bool kline = (protocol >= PROT_ISO9141 && protocol <= PROT_ISO14230);
+    HostKLineListeners(kline ? OnKLineByte : 0, kline ? OnKLineLevel : 0);
+    bool j1850 = (protocol == PROT_J1850_PWM || protocol == PROT_J1850_VPW);
+    HostJ1850Listener(j1850 ? OnJ1850Frame : 0);
+}
+
+/**
+ * Compare the key of "key=value" pair
+ * @param[in] p The key start
+ * @param[in] len The key length
+ * @param[in] key The name to compare with
+ * @return true if matched
+ */
+static bool KeyIs(const char* p, size_t len, const char* key)
+{
+    return strlen(key) == len && strncmp(p, key, len) == 0;
+}
+
+/**
+ * Parse the fault names separated by '+'
+ * @param[in] p The list start
+ * @param[out] faults The fault flags
+ * @return The pointer after the list, 0 if unknown name
+ */
+static const char* ParseFaults(const char* p, uint32_t& faults)
+{
+    static const struct {
+        const char* name;
+        uint32_t    flag;
+    } Names[] = {
+        { "noreply",  ECUSIM_FAULT_NO_REPLY },
+        { "checksum", ECUSIM_FAULT_CHECKSUM },
+        { "truncate", ECUSIM_FAULT_TRUNCATE },
+        { "sequence", ECUSIM_FAULT_SEQUENCE },
+        { "pending",  ECUSIM_FAULT_PENDING  },
+        { "nofc",     ECUSIM_FAULT_NO_FC    },
+        { "noinit",   ECUSIM_FAULT_NO_INIT  }
+    };
+
+    for (;;) {
+        size_t len = strcspn(p, "+,");
+        size_t i = 0;
+        for (; i < sizeof(Names) / sizeof(Names[0]); i++) {
+            if (KeyIs(p, len, Names[i].name))
+                break;
+        }
+        if (i == sizeof(Names) / sizeof(Names[0]))
+            return 0;
+        faults |= Names[i].flag;
+        p += len;
+        if (*p != '+')
+            return p;
+        p++;
+    }
+}
+
+/**
+ * Configure from the string "protocol[,key=value]...", the keys are
+ * ecus, latency, step, p1 (usec), bs, stmin (ms), fault (name+name..), period.
+ * Example: "6,ecus=2,latency=20000,fault=pending,period=4"
+ * @param[in] spec The configuration string
+ * @return true if OK, false if the string is malformed
+ */
+bool EcuSim::configure(const char* spec)
+{
+    EcuSimConfig config;
+    memset(&config, 0, sizeof(config));
+
+    char* end;
+    config.protocol = strtoul(spec, &end, 10);
+    if (end == spec || config.protocol > PROT_ISO15765_2925)
+        return false;
+
+    config.ecuCount = 1;
+    config.latencyStep = LATENCY_STEP;
+    config.byteGap = KLINE_BYTE_GAP;
+    config.faultPeriod = 1;
+    if (config.protocol >= PROT_ISO15765_1150)
+        config.latency = CAN_LATENCY;
+    else if (config.protocol >= PROT_ISO9141)
+        config.latency = KLINE_LATENCY;
+    else
+        config.latency = J1850_LATENCY;
+
+    const char* p = end;
+    while (*p == ',') {
+        p++;
+        const char* eq = strchr(p, '=');
+        if (!eq)
+            return false;
+        size_t len = eq - p;
+        const char* val = eq + 1;
+        if (KeyIs(p, len, "fault")) {
+            p = ParseFaults(val, config.faults);
+            if (!p)
+                return false;
+            continue;
+        }
+        uint32_t num = strtoul(val, &end, 10);
+        if (end == val)
+            return false;
+        if (KeyIs(p, len, "ecus"))
+            config.ecuCount = num;
+        else if (KeyIs(p, len, "latency"))
+            config.latency = num;
+        else if (KeyIs(p, len, "step"))
+            config.latencyStep = num;
+        else if (KeyIs(p, len, "p1"))
+            config.byteGap = num;
+        else if (KeyIs(p, len, "bs"))
+            config.blockSize = num;
+        else if (KeyIs(p, len, "stmin"))
+            config.stMin = num;
+        else if (KeyIs(p, len, "period"))
+            config.faultPeriod = num;
+        else
+            return false;
+        p = end;
+    }
+    if (*p != '\0' || config.ecuCount < 1 || config.ecuCount > ECUS_MAX)
+        return false;
+
+    configure(config);
+    return true;
+}
+
+/**
+ * Clear the statistics counters
+ */
+void EcuSim::resetStats()
+{
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+/**
+ * The functional request from the other tester on the bus, only the replies are seen
+ * by the adapter. Used to generate the bus traffic for the monitor.
+ * @param[in] data The request data without header/checksum
+ * @param[in] len The request length
+ */
+void EcuSim::request(const uint8_t* data, int len)
+{
+    if (config_.protocol) {
+        onRequest(data, len, (1 << config_.ecuCount) - 1);
+    }
+}
+
+/**
+ * Drop all the pending replies and bus states
+ */
+void EcuSim::reset()
+{
+    VirtualClock* clock = VirtualClock::instance();
+    for (int i = 0; i < ECUS_MAX; i++) {
+        Ecu* ecu = &ecus_[i];
+        clock->cancel(CanEvent, ecu);
+        clock->cancel(KLineEcuEvent, ecu);
+        clock->cancel(J1850EcuEvent, ecu);
+        memset(ecu, 0, sizeof(*ecu));
+        ecu->index = i;
+    }
+    clock->cancel(KLineSampleEvent, this);
+    clock->cancel(KLineByteEvent, this);
+    clock->cancel(J1850IfrEvent, this);
+    faultCount_ = 0;
+    klState_ = KL_IDLE;
+    klLevel_ = 1;
+    klFallTime_ = klLastRx_ = klBusFree_ = 0;
+    klSample_ = 0;
+    klBits_ = 0;
+    klRxLen_ = klTxLen_ = klTxPos_ = 0;
+    klTxEcu_ = 0;
+    jScale_ = 1;
+    jBusFree_ = 0;
+    jIfr_ = 0;
+}
+
+/**
+ * Check for the CAN protocol
+ * @return true if ISO 15765
+ */
+bool EcuSim::isCan() const
+{
+    return config_.protocol >= PROT_ISO15765_1150;
+}
+
+/**
+ * Check for the K-line protocol with ISO 14230 frame format
+ * @return true if KWP
+ */
+bool EcuSim::isKwp() const
+{
+    return config_.protocol == PROT_ISO14230_5BPS || config_.protocol == PROT_ISO14230;
+}
+
+/**
+ * Count the request and get the faults to apply
+ * @return ECUSIM_FAULT_* flags
+ */
+uint32_t EcuSim::requestFaults()
+{
+    if (!config_.faults || ++faultCount_ < config_.faultPeriod)
+        return 0;
+    faultCount_ = 0;
+    stats_.faults++;
+    return config_.faults;
+}
+
+/**
+ * The first reply time for the ECU
+ * @param[in] ecu The ECU
+ * @return The absolute time, usec
+ */
+uint64_t EcuSim::replyTime(const Ecu* ecu) const
+{
+    return VirtualClock::instance()->now() + config_.latency + config_.latencyStep * ecu->index;
+}
+
+/**
+ * Start sending the reply frames
+ * @param[in] ecu The ECU
+ * @param[in] time The absolute time to start, usec
+ */
+void EcuSim::startReply(Ecu* ecu, uint64_t time)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    if (isCan())
+        clock->schedule(CanEvent, ecu, time);
+    else if (config_.protocol >= PROT_ISO9141)
+        clock->schedule(KLineEcuEvent, ecu, time);
+    else
+        clock->schedule(J1850EcuEvent, ecu, time);
+}
+
+/**
+ * The complete request received by the bus, let the addressed ECUs respond
+ * @param[in] req The request data without header/checksum
+ * @param[in] len The request length
+ * @param[in] ecuMask The addressed ECUs bitmask
+ */
+void EcuSim::onRequest(const uint8_t* req, int len, uint32_t ecuMask)
+{
+    stats_.requests++;
+    stats_.requestTime = VirtualClock::instance()->now();
+    uint32_t faults = requestFaults();
+
+    for (int i = 0; i < config_.ecuCount; i++) {
+        Ecu* ecu = &ecus_[i];
+        if (!(ecuMask & (1 << i)))
+            continue;
+
+        // The new request cancels the previous reply
+        ecu->numFrames = ecu->frameIdx = 0;
+        ecu->pos = 0;
+        ecu->waitFc = false;
+        ecu->faults = faults;
+        if ((faults & ECUSIM_FAULT_NO_REPLY) || len == 0)
+            continue;
+        if (respond(ecu, req, len) == 0)
+            continue;
+
+        // "Response pending" goes first
+        if ((faults & ECUSIM_FAULT_PENDING) && ecu->numFrames < FRAMES_MAX) {
+            memmove(&ecu->frames[1], &ecu->frames[0], ecu->numFrames * sizeof(Frame));
+            ecu->numFrames++;
+            ecu->frames[0].length = 3;
+            ecu->frames[0].data[0] = 0x7F;
+            ecu->frames[0].data[1] = req[0];
+            ecu->frames[0].data[2] = 0x78;
+        }
+        startReply(ecu, replyTime(ecu));
+    }
+}
+
+/**
+ * Queue the reply frame
+ * @param[in] ecu The ECU
+ * @param[in] data The frame data without header/checksum
+ * @param[in] len The data length
+ */
+void EcuSim::addFrame(Ecu* ecu, const uint8_t* data, int len)
+{
+    if (ecu->numFrames >= FRAMES_MAX || len > FRAME_LEN)
+        return;
+    Frame* frame = &ecu->frames[ecu->numFrames++];
+    memcpy(frame->data, data, len);
+    frame->length = len;
+}
+
+/**
+ * Check if the mode 01 PID is supported, including the bitmap PIDs
+ * @param[in] ecu The ECU index
+ * @param[in] pid The PID
+ * @return true if supported
+ */
+static bool PidSupported(int ecu, uint8_t pid)
+{
+    for (int i = 0; i < PIDS_LEN; i++) {
+        if (!(Pids[i].ecus & (1 << ecu)))
+            continue;
+        if ((pid & 0x1F) == 0 ? Pids[i].pid > pid : Pids[i].pid == pid)
+            return true;
+    }
+    return pid == 0;
+}
+
+/**
+ * Get the mode 01 PID data
+ * @param[in] ecu The ECU index
+ * @param[in] pid The PID
+ * @param[out] data The data bytes
+ * @return The data length
+ */
+static int PidValue(int ecu, uint8_t pid, uint8_t* data)
+{
+    if ((pid & 0x1F) == 0) { // The supported PIDs bitmap
+        memset(data, 0, 4);
+        for (int p = pid + 1; p <= pid + 0x20; p++) {
+            if (PidSupported(ecu, p)) {
+                int bit = p - pid - 1;
+                data[bit / 8] |= 0x80 >> (bit % 8);
+            }
+        }
+        return 4;
+    }
+    for (int i = 0; i < PIDS_LEN; i++) {
+        if (Pids[i].pid == pid) {
+            memcpy(data, Pids[i].data, Pids[i].len);
+            if (pid == 0x01 && ecu == 0) {
+                data[0] = 0x80 | (sizeof(Dtcs) / 2); // MIL on
+            }
+            return Pids[i].len;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Generate the reply to OBD request, the replies are deterministic
+ * @param[in] ecu The ECU
+ * @param[in] req The request data
+ * @param[in] len The request length
+ * @return The number of reply frames
+ */
+int EcuSim::respond(Ecu* ecu, const uint8_t* req, int len)
+{
+    uint8_t reply[FRAME_LEN];
+    const uint8_t mode = req[0];
+    const bool can = isCan();
+    const bool first = (ecu->index == 0);
+    int n = 0;
+
+    reply[n++] = mode + 0x40;
+    switch (mode) {
+        case 0x01: // Current data, CAN allows up to 6 PIDs
+            for (int i = 1; i < len && i <= 6; i++) {
+                if (!PidSupported(ecu->index, req[i]))
+                    continue;
+                reply[n++] = req[i];
+                n += PidValue(ecu->index, req[i], reply + n);
+            }
+            if (n > 1) {
+                addFrame(ecu, reply, n);
+            }
+            break;
+
+        case 0x03: // DTCs
+        case 0x07:
+            if (can) {
+                reply[n++] = (first && mode == 0x03) ? sizeof(Dtcs) / 2 : 0;
+            }
+            if (first && mode == 0x03) {
+                memcpy(reply + n, Dtcs, sizeof(Dtcs));
+                n += sizeof(Dtcs);
+            }
+            else if (!can) {
+                memset(reply + n, 0, 6);
+                n += 6;
+            }
+            addFrame(ecu, reply, n);
+            break;
+
+        case 0x04: // Clear DTCs
+            addFrame(ecu, reply, n);
+            break;
+
+        case 0x09: // Vehicle information
+            if (!first || len < 2)
+                break;
+            reply[n++] = req[1];
+            if (req[1] == 0x00) {
+                const uint8_t bitmap[] = { 0x40, 0x00, 0x00, 0x00 };
+                memcpy(reply + n, bitmap, sizeof(bitmap));
+                addFrame(ecu, reply, n + sizeof(bitmap));
+            }
+            else if (req[1] == 0x02 && can) {
+                reply[n++] = 1;
+                memcpy(reply + n, Vin, sizeof(Vin) - 1);
+                addFrame(ecu, reply, n + sizeof(Vin) - 1);
+            }
+            else if (req[1] == 0x02) { // 5 frames, the VIN is padded to 20 bytes
+                uint8_t padded[20] = { 0 };
+                memcpy(padded + 3, Vin, sizeof(Vin) - 1);
+                for (int i = 0; i < 5; i++) {
+                    reply[n] = i + 1;
+                    memcpy(reply + n + 1, padded + i * 4, 4);
+                    addFrame(ecu, reply, n + 5);
+                }
+            }
+            break;
+
+        case 0x3E: // Tester present
+            addFrame(ecu, reply, n);
+            break;
+
+        case 0x81: // KWP StartCommunication, the keywords
+            reply[n++] = 0xEF;
+            reply[n++] = 0x8F;
+            addFrame(ecu, reply, n);
+            break;
+
+        default:  // Service not supported
+            if (first) {
+                reply[0] = 0x7F;
+                reply[n++] = mode;
+                reply[n++] = 0x11;
+                addFrame(ecu, reply, n);
+            }
+            break;
+    }
+    return ecu->numFrames;
+}
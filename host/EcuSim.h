@@ -0,0 +1,154 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __ECU_SIM_H__
+#define __ECU_SIM_H__
+
+#include <cstdint>
+
+using namespace std;
+
+struct CanMsgBuffer;
+
+// Fault injection, applied to every Nth request
+enum EcuSimFaults {
+    ECUSIM_FAULT_NO_REPLY = 0x01, // The request is ignored
+    ECUSIM_FAULT_CHECKSUM = 0x02, // K-line/J1850 reply with bad checksum
+    ECUSIM_FAULT_TRUNCATE = 0x04, // The last byte or consecutive frame is missing
+    ECUSIM_FAULT_SEQUENCE = 0x08, // ISO-TP consecutive frame sequence number skipped
+    ECUSIM_FAULT_PENDING  = 0x10, // "Response pending" negative reply first
+    ECUSIM_FAULT_NO_FC    = 0x20, // ISO-TP flow control is ignored, the reply is stalled
+    ECUSIM_FAULT_NO_INIT  = 0x40  // K-line init is ignored
+};
+
+struct EcuSimConfig {
+    int      protocol;    // The protocol number as in ATSP, 0 for no ECU connected
+    int      ecuCount;    // The number of ECUs, 1..EcuSim::ECUS_MAX
+    uint32_t latency;     // usec, the end of request to the start of reply (P2)
+    uint32_t latencyStep; // usec, added for every next ECU
+    uint32_t byteGap;     // usec, K-line interbyte interval (P1)
+    uint8_t  blockSize;   // ISO-TP block size, the adapter flow control is used if 0
+    uint8_t  stMin;       // ms, ISO-TP separation time, the adapter flow control is used if greater
+    uint32_t faults;      // ECUSIM_FAULT_* flags
+    uint32_t faultPeriod; // The faults are applied to every Nth request
+};
+
+struct EcuSimStats {
+    uint32_t requests;    // The requests received
+    uint32_t replies;     // The reply frames sent
+    uint32_t faults;      // The requests and inits with the faults applied
+    uint32_t inits;       // K-line init sequences detected
+    uint64_t requestTime; // The last request completion time, usec
+    uint64_t replyTime;   // The last reply frame completion time, usec
+};
+
+//
+// Virtual ECUs connected to the simulated bus of the host build, driven by the virtual clock.
+// The replies are generated for the standard OBD modes 01, 03, 04 and 09.
+//
+class EcuSim {
+public:
+    const static int ECUS_MAX   = 4;
+    const static int FRAME_LEN  = 32;
+    const static int FRAMES_MAX = 6;
+    static EcuSim* instance();
+    void configure(const EcuSimConfig& config);
+    bool configure(const char* spec);
+    const EcuSimConfig& config() const { return config_; }
+    const EcuSimStats& stats() const { return stats_; }
+    void resetStats();
+    void request(const uint8_t* data, int len);
+private:
+    struct Frame {
+        uint8_t length;
+        uint8_t data[FRAME_LEN];
+    };
+    struct Ecu {
+        uint8_t  index;
+        uint8_t  numFrames;    // The pending reply frames
+        uint8_t  frameIdx;
+        uint32_t faults;       // The faults for the current request
+        Frame    frames[FRAMES_MAX];
+        uint8_t  pos;          // ISO-TP segmentation
+        uint8_t  seq;
+        uint8_t  blockLeft;
+        bool     waitFc;
+        uint32_t separation;
+    };
+    enum KLineState { KL_IDLE, KL_SLOW_ADDR, KL_SLOW_SYNC, KL_SLOW_INV, KL_FAST_WAKE, KL_READY };
+
+    EcuSim();
+    void reset();
+    uint32_t requestFaults();
+    void onRequest(const uint8_t* req, int len, uint32_t ecuMask);
+    int  respond(Ecu* ecu, const uint8_t* req, int len);
+    void addFrame(Ecu* ecu, const uint8_t* data, int len);
+    bool isCan() const;
+    bool isKwp() const;
+    uint8_t ecuAddress(const Ecu* ecu) const { return 0x10 + ecu->index; }
+    uint64_t replyTime(const Ecu* ecu) const;
+    void startReply(Ecu* ecu, uint64_t time);
+
+    // CAN
+    static void OnCanFrame(const CanMsgBuffer* msg);
+    static void CanEvent(void* arg);
+    void onCanFrame(const CanMsgBuffer* msg);
+    void sendCanFrame(Ecu* ecu);
+    uint32_t canReplyId(const Ecu* ecu) const;
+    uint32_t canFrameTime() const;
+
+    // K-line
+    static void OnKLineByte(uint8_t byte);
+    static void OnKLineLevel(uint32_t level);
+    static void KLineSampleEvent(void* arg);
+    static void KLineEcuEvent(void* arg);
+    static void KLineByteEvent(void* arg);
+    void onKLineByte(uint8_t byte);
+    void onKLineLevel(uint32_t level);
+    void onKLineSample();
+    bool kLineRequestDone(int& pos, int& len) const;
+    void kLineSend(const uint8_t* data, int len, uint64_t time);
+    void kLineSendFrame(Ecu* ecu);
+    void kLineNextByte();
+
+    // J1850
+    static void OnJ1850Frame(const uint16_t* pulses, int count, bool vpwMode);
+    static void J1850EcuEvent(void* arg);
+    static void J1850IfrEvent(void* arg);
+    void onJ1850Frame(const uint16_t* pulses, int count, bool vpwMode);
+    void j1850SendFrame(Ecu* ecu);
+    void j1850SendIfr();
+
+    EcuSimConfig config_;
+    EcuSimStats  stats_;
+    Ecu          ecus_[ECUS_MAX];
+
+    uint32_t     faultCount_; // The fault period counter
+
+    // K-line bus state
+    KLineState klState_;
+    uint32_t   klLevel_;
+    uint64_t   klFallTime_;
+    uint64_t   klLastRx_;
+    uint8_t    klSample_;
+    uint16_t   klBits_;
+    uint8_t    klRx_[FRAME_LEN];
+    uint8_t    klRxLen_;
+    uint8_t    klTx_[FRAME_LEN + 4];
+    uint8_t    klTxLen_;
+    uint8_t    klTxPos_;
+    uint32_t   klGap_;
+    uint64_t   klBusFree_;
+    Ecu*       klTxEcu_;
+
+    // J1850 bus state
+    uint32_t   jScale_;     // 4 for VPW 4x mode
+    uint64_t   jBusFree_;
+    uint8_t    jIfr_;
+};
+
+#endif //__ECU_SIM_H__
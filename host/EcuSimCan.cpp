@@ -0,0 +1,214 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <padapter.h>
+#include <canmsgbuffer.h>
+#include "EcuSim.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+
+// ISO 15765-4 addressing
+const uint32_t CAN11_FUNCTIONAL = 0x7DF;
+const uint32_t CAN11_PHYSICAL   = 0x7E0;
+const uint32_t CAN11_REPLY      = 0x7E8;
+const uint32_t CAN29_FUNCTIONAL = 0x18DB33F1;
+const uint32_t CAN29_PHYSICAL   = 0x18DA00F1; // Target address in bits 8-15
+const uint32_t CAN29_REPLY      = 0x18DAF100; // Source address in bits 0-7
+
+// 8 bytes frame with stuffing, usec
+const uint32_t CAN_FRAME_500K = 250;
+const uint32_t CAN_FRAME_250K = 500;
+
+/**
+ * The frame sent by adapter
+ * @param[in] msg The frame
+ */
+void EcuSim::OnCanFrame(const CanMsgBuffer* msg)
+{
+    instance()->onCanFrame(msg);
+}
+
+/**
+ * The ECU time to send the next frame
+ * @param[in] arg The ECU
+ */
+void EcuSim::CanEvent(void* arg)
+{
+    instance()->sendCanFrame(static_cast<Ecu*>(arg));
+}
+
+/**
+ * Check for 29 bit CAN protocol
+ * @param[in] protocol The protocol number
+ * @return true if extended
+ */
+static bool IsExtended(int protocol)
+{
+    return protocol == PROT_ISO15765_2950 || protocol == PROT_ISO15765_2925;
+}
+
+/**
+ * The ECU response CAN ID
+ * @param[in] ecu The ECU
+ * @return The CAN ID
+ */
+uint32_t EcuSim::canReplyId(const Ecu* ecu) const
+{
+    return IsExtended(config_.protocol) ? (CAN29_REPLY | ecuAddress(ecu)) : (CAN11_REPLY + ecu->index);
+}
+
+/**
+ * The full frame duration on the bus
+ * @return The time, usec
+ */
+uint32_t EcuSim::canFrameTime() const
+{
+    bool slow = config_.protocol == PROT_ISO15765_1125 || config_.protocol == PROT_ISO15765_2925;
+    return slow ? CAN_FRAME_250K : CAN_FRAME_500K;
+}
+
+/**
+ * Decode the flow control separation time
+ * @param[in] stMin The STmin byte
+ * @return The time, usec
+ */
+static uint32_t SeparationTime(uint8_t stMin)
+{
+    if (stMin <= 0x7F)
+        return stMin * 1000;
+    if (stMin >= 0xF1 && stMin <= 0xF9)
+        return (stMin - 0xF0) * 100;
+    return 0x7F * 1000; // Reserved, use the longest one
+}
+
+/**
+ * Dispatch the adapter frame, either single frame request or flow control
+ * @param[in] msg The frame
+ */
+void EcuSim::onCanFrame(const CanMsgBuffer* msg)
+{
+    const bool extended = IsExtended(config_.protocol);
+    const uint32_t allEcus = (1 << config_.ecuCount) - 1;
+    uint32_t ecuMask = 0;
+
+    if (msg->extended != extended)
+        return;
+    if (extended) {
+        if (msg->id == CAN29_FUNCTIONAL) {
+            ecuMask = allEcus;
+        }
+        else if ((msg->id & 0xFFFF00FF) == CAN29_PHYSICAL) {
+            int index = ((msg->id >> 8) & 0xFF) - 0x10;
+            ecuMask = (index >= 0 && index < config_.ecuCount) ? (1 << index) : 0;
+        }
+    }
+    else {
+        if (msg->id == CAN11_FUNCTIONAL) {
+            ecuMask = allEcus;
+        }
+        else if (msg->id >= CAN11_PHYSICAL && msg->id < CAN11_PHYSICAL + config_.ecuCount) {
+            ecuMask = 1 << (msg->id - CAN11_PHYSICAL);
+        }
+    }
+    if (!ecuMask)
+        return;
+
+    switch (msg->data[0] >> 4) {
+        case 0: { // Single frame
+            int len = msg->data[0] & 0x0F;
+            if (len > 0 && len <= 7) {
+                onRequest(msg->data + 1, len, ecuMask);
+            }
+            break;
+        }
+        case 3: { // Flow control, the adapter is using the functional ID for it
+            if ((msg->data[0] & 0x0F) != 0)
+                break; // Wait or overflow, keep waiting
+            VirtualClock* clock = VirtualClock::instance();
+            uint32_t separation = SeparationTime(msg->data[2]);
+            if (separation < config_.stMin * 1000U)
+                separation = config_.stMin * 1000U;
+            if (separation < canFrameTime())
+                separation = canFrameTime();
+            for (int i = 0; i < config_.ecuCount; i++) {
+                Ecu* ecu = &ecus_[i];
+                if (!(ecuMask & (1 << i)) || !ecu->waitFc || (ecu->faults & ECUSIM_FAULT_NO_FC))
+                    continue;
+                ecu->waitFc = false;
+                ecu->blockLeft = config_.blockSize ? config_.blockSize : msg->data[1];
+                ecu->separation = separation;
+                clock->schedule(CanEvent, ecu, clock->now() + separation);
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Send the next ISO-TP frame of the reply, the first frame waits for flow control
+ * @param[in] ecu The ECU
+ */
+void EcuSim::sendCanFrame(Ecu* ecu)
+{
+    if (ecu->frameIdx >= ecu->numFrames || ecu->waitFc)
+        return;
+
+    const Frame* frame = &ecu->frames[ecu->frameIdx];
+    CanMsgBuffer msg(canReplyId(ecu), IsExtended(config_.protocol), 8, 0);
+    VirtualClock* clock = VirtualClock::instance();
+    bool last = true;
+
+    if (ecu->pos == 0 && frame->length <= 7) { // Single frame
+        msg.data[0] = frame->length;
+        memcpy(msg.data + 1, frame->data, frame->length);
+    }
+    else if (ecu->pos == 0) { // First frame
+        msg.data[0] = 0x10 | (frame->length >> 8);
+        msg.data[1] = frame->length;
+        memcpy(msg.data + 2, frame->data, 6);
+        ecu->pos = 6;
+        ecu->seq = (ecu->faults & ECUSIM_FAULT_SEQUENCE) ? 2 : 1;
+        ecu->waitFc = true;
+        last = false;
+    }
+    else { // Consecutive frame
+        int len = frame->length - ecu->pos;
+        if (len > 7)
+            len = 7;
+        msg.data[0] = 0x20 | (ecu->seq & 0x0F);
+        memcpy(msg.data + 1, frame->data + ecu->pos, len);
+        ecu->pos += len;
+        ecu->seq++;
+        last = (ecu->pos >= frame->length);
+        if (!last && (ecu->faults & ECUSIM_FAULT_TRUNCATE) && frame->length - ecu->pos <= 7) {
+            last = true; // Drop the last consecutive frame
+        }
+        if (!last && ecu->blockLeft && --ecu->blockLeft == 0) {
+            ecu->waitFc = true;
+        }
+    }
+    HostCanInject(&msg);
+
+    if (!last) {
+        if (!ecu->waitFc) {
+            clock->schedule(CanEvent, ecu, clock->now() + ecu->separation);
+        }
+        return;
+    }
+
+    stats_.replies++;
+    stats_.replyTime = clock->now();
+    ecu->pos = 0;
+    if (++ecu->frameIdx < ecu->numFrames) {
+        // Response pending takes the full latency again
+        bool pending = (frame->data[0] == 0x7F && frame->data[2] == 0x78);
+        clock->schedule(CanEvent, ecu, pending ? replyTime(ecu) : clock->now() + canFrameTime());
+    }
+}
@@ -0,0 +1,254 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <padapter.h>
+#include <checksum.h>
+#include <j1850.h>
+#include "EcuSim.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+using namespace util;
+
+// The ECU side timing, usec
+const uint32_t PWM_IFR_DELAY = TP4_TX_NOM - TP3_TX_NOM; // EOD after the last bit
+const uint32_t PWM_IFS       = 400; // Leave the room for adapter IFR
+const uint32_t VPW_IFS       = TV6_TX_NOM;
+const uint32_t BUS_RETRY     = 100;
+
+const uint8_t J1850_FUNCTIONAL = 0x6A;
+
+// The symbol widths [active][bit value], the first symbol after SOF is passive
+static const uint16_t VpwSymbols[2][2] = {
+    { TV1_TX_NOM, TV2_TX_NOM },
+    { TV2_TX_NOM, TV1_TX_NOM }
+};
+
+// The active/passive pairs [bit value]
+static const uint16_t PwmSymbols[2][2] = {
+    { TP2_TX_NOM, TP3_TX_NOM - TP2_TX_NOM },
+    { TP1_TX_NOM, TP3_TX_NOM - TP1_TX_NOM }
+};
+
+static uint16_t pulses[2 * (1 + 8 * J1850_BYTES_MAX)];
+
+/**
+ * The frame sent by adapter
+ * @param[in] pulses The pulse widths, usec
+ * @param[in] count The number of pulses for VPW, the number of bits for PWM
+ * @param[in] vpwMode VPW/PWM flag
+ */
+void EcuSim::OnJ1850Frame(const uint16_t* pulses, int count, bool vpwMode)
+{
+    instance()->onJ1850Frame(pulses, count, vpwMode);
+}
+
+/**
+ * The ECU time to send the next frame
+ * @param[in] arg The ECU
+ */
+void EcuSim::J1850EcuEvent(void* arg)
+{
+    instance()->j1850SendFrame(static_cast<Ecu*>(arg));
+}
+
+/**
+ * The time to send PWM in-frame response
+ * @param[in] arg Not used
+ */
+void EcuSim::J1850IfrEvent(void* arg)
+{
+    instance()->j1850SendIfr();
+}
+
+/**
+ * Decode the adapter frame and check CRC, the PWM frame without SOF is the adapter IFR
+ * @param[in] pulses The pulse widths, usec
+ * @param[in] count The number of pulses for VPW, the number of bits for PWM
+ * @param[in] vpwMode VPW/PWM flag
+ */
+void EcuSim::onJ1850Frame(const uint16_t* pulses, int count, bool vpwMode)
+{
+    const bool vpw = (config_.protocol == PROT_J1850_VPW);
+    uint8_t data[J1850_BYTES_MAX];
+    uint8_t byte = 0;
+    int len = 0;
+    int bits = 0;
+
+    if (vpwMode != vpw || count < 1)
+        return;
+    if (vpw) {
+        jScale_ = (pulses[0] < TV3_RX_MIN / 2) ? 4 : 1; // 4x mode SOF is 50us
+        uint32_t sof = pulses[0] * jScale_;
+        if (sof < TV3_RX_MIN || sof > TV3_RX_MAX)
+            return;
+        for (int i = 1; i < count; i++) {
+            bool active = (i & 0x01) == 0;
+            bool isLong = pulses[i] * jScale_ > VPW_RX_MID;
+            byte = (byte << 1) | (isLong != active ? 1 : 0);
+            if (++bits == 8 && len < J1850_BYTES_MAX) {
+                data[len++] = byte;
+                bits = 0;
+            }
+        }
+    }
+    else {
+        if (pulses[0] < TP7_RX_MIN || pulses[0] > TP7_RX_MAX)
+            return;
+        for (int i = 1; i < count; i++) {
+            byte = (byte << 1) | (pulses[i * 2] < TP2_RX_MIN ? 1 : 0);
+            if (++bits == 8 && len < J1850_BYTES_MAX) {
+                data[len++] = byte;
+                bits = 0;
+            }
+        }
+    }
+    if (len < OBD2_BYTES_MIN || crc8_j1850(data, len - 1) != data[len - 1])
+        return;
+
+    uint8_t target = data[1];
+    uint32_t ecuMask = (1 << config_.ecuCount) - 1;
+    if (target != J1850_FUNCTIONAL) {
+        int index = target - 0x10;
+        ecuMask = (index >= 0 && index < config_.ecuCount) ? (1 << index) : 0;
+    }
+    if (!ecuMask)
+        return;
+    onRequest(data + 3, len - 4, ecuMask);
+
+    // PWM frame is acknowledged by the first ECU addressed
+    if (!vpw) {
+        int first = 0;
+        while (!(ecuMask & (1 << first)))
+            first++;
+        if (!(ecus_[first].faults & ECUSIM_FAULT_NO_REPLY)) {
+            VirtualClock* clock = VirtualClock::instance();
+            jIfr_ = ecuAddress(&ecus_[first]);
+            clock->schedule(J1850IfrEvent, this, clock->now() + PWM_IFR_DELAY);
+        }
+    }
+}
+
+/**
+ * Convert the bytes into pulses, the last passive pulse is not needed
+ * @param[in] data The bytes
+ * @param[in] len The number of bytes
+ * @param[in] sof Start with SOF
+ * @param[out] duration The total time, usec
+ * @return The number of pulses
+ */
+static int EncodePwm(const uint8_t* data, int len, bool sof, uint32_t& duration)
+{
+    int count = 0;
+    if (sof) {
+        pulses[count++] = TP7_TX_NOM;
+        pulses[count++] = TP4_TX_NOM - TP7_TX_NOM;
+    }
+    for (int i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            const uint16_t* symbol = PwmSymbols[(data[i] >> bit) & 0x01];
+            pulses[count++] = symbol[0];
+            pulses[count++] = symbol[1];
+        }
+    }
+    duration = 0;
+    for (int i = 0; i < count - 1; i++) {
+        duration += pulses[i];
+    }
+    return count - 1;
+}
+
+/**
+ * Convert the bytes into VPW pulses, starting with SOF
+ * @param[in] data The bytes
+ * @param[in] len The number of bytes
+ * @param[in] scale 4 for 4x mode
+ * @param[out] duration The total time, usec
+ * @return The number of pulses
+ */
+static int EncodeVpw(const uint8_t* data, int len, uint32_t scale, uint32_t& duration)
+{
+    int count = 0;
+    pulses[count++] = TV3_TX_NOM / scale;
+    for (int i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            pulses[count] = VpwSymbols[(count & 0x01) == 0][(data[i] >> bit) & 0x01] / scale;
+            count++;
+        }
+    }
+    duration = 0;
+    for (int i = 0; i < count; i++) {
+        duration += pulses[i];
+    }
+    return count;
+}
+
+/**
+ * Send PWM in-frame response, the ECU address
+ */
+void EcuSim::j1850SendIfr()
+{
+    VirtualClock* clock = VirtualClock::instance();
+    uint32_t duration;
+    int count = EncodePwm(&jIfr_, 1, false, duration);
+    if (HostJ1850Inject(pulses, count)) {
+        jBusFree_ = clock->now() + duration + PWM_IFS;
+    }
+}
+
+/**
+ * Send the next reply frame with the header and CRC, wait if the bus is busy
+ * @param[in] ecu The ECU
+ */
+void EcuSim::j1850SendFrame(Ecu* ecu)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    const bool vpw = (config_.protocol == PROT_J1850_VPW);
+    if (ecu->frameIdx >= ecu->numFrames)
+        return;
+    if (HostJ1850Busy() || clock->now() < jBusFree_) {
+        uint64_t time = jBusFree_ > clock->now() ? jBusFree_ : clock->now() + BUS_RETRY;
+        clock->schedule(J1850EcuEvent, ecu, time);
+        return;
+    }
+
+    const Frame* frame = &ecu->frames[ecu->frameIdx];
+    uint8_t buff[J1850_BYTES_MAX];
+    int len = 0;
+    buff[len++] = vpw ? 0x48 : 0x41;
+    buff[len++] = 0x6B;
+    buff[len++] = ecuAddress(ecu);
+    int dataLen = (frame->length < J1850_BYTES_MAX - 4) ? frame->length : J1850_BYTES_MAX - 4;
+    memcpy(buff + len, frame->data, dataLen);
+    len += dataLen;
+    buff[len] = crc8_j1850(buff, len);
+    if (ecu->faults & ECUSIM_FAULT_CHECKSUM) {
+        buff[len] ^= 0xFF;
+    }
+    len++;
+    if (ecu->faults & ECUSIM_FAULT_TRUNCATE) {
+        len--;
+    }
+
+    uint32_t duration;
+    int count = vpw ? EncodeVpw(buff, len, jScale_, duration) : EncodePwm(buff, len, true, duration);
+    if (!HostJ1850Inject(pulses, count)) {
+        clock->schedule(J1850EcuEvent, ecu, clock->now() + BUS_RETRY);
+        return;
+    }
+    jBusFree_ = clock->now() + duration + (vpw ? VPW_IFS : PWM_IFS);
+    stats_.replies++;
+    stats_.replyTime = clock->now() + duration;
+
+    if (++ecu->frameIdx < ecu->numFrames) {
+        // Response pending takes the full latency again
+        bool pending = (frame->data[0] == 0x7F && frame->data[2] == 0x78);
+        clock->schedule(J1850EcuEvent, ecu, pending ? replyTime(ecu) : jBusFree_);
+    }
+}
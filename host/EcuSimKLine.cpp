@@ -0,0 +1,350 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <padapter.h>
+#include <checksum.h>
+#include "EcuSim.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+using namespace util;
+
+// ISO 9141-2/14230-2 ECU side timing, usec
+const uint32_t BIT_5BAUD     = 200000;
+const uint32_t W1_TIME       = 100000; // The end of address byte to 0x55, 60-300ms
+const uint32_t W2_TIME       = 10000;  // The keyword interbyte time, 5-20ms
+const uint32_t W4_TIME       = 30000;  // Inverted KW2 to inverted address, 25-50ms
+const uint32_t TINIL_MIN     = 20000;  // The fast init low pulse, 25ms nominal
+const uint32_t TINIL_MAX     = 30000;
+const uint32_t REQ_GAP       = 25000;  // The longest request interbyte time
+const uint32_t FRAME_GAP     = 25000;  // Between the replies, P2 min
+const uint32_t P3_MAX        = 5000000;
+
+const uint8_t INIT_ADDRESS   = 0x33;
+const uint8_t ISO_FUNCTIONAL = 0x6A;
+
+/**
+ * The adapter byte completed on K-line
+ * @param[in] byte The byte
+ */
+void EcuSim::OnKLineByte(uint8_t byte)
+{
+    instance()->onKLineByte(byte);
+}
+
+/**
+ * The adapter changed K-line level in bit-bang mode
+ * @param[in] level The level
+ */
+void EcuSim::OnKLineLevel(uint32_t level)
+{
+    instance()->onKLineLevel(level);
+}
+
+/**
+ * The 5 baud address bit sampling time
+ * @param[in] arg Not used
+ */
+void EcuSim::KLineSampleEvent(void* arg)
+{
+    instance()->onKLineSample();
+}
+
+/**
+ * The ECU time to send the next frame
+ * @param[in] arg The ECU
+ */
+void EcuSim::KLineEcuEvent(void* arg)
+{
+    instance()->kLineSendFrame(static_cast<Ecu*>(arg));
+}
+
+/**
+ * The ECU byte completed on K-line
+ * @param[in] arg Not used
+ */
+void EcuSim::KLineByteEvent(void* arg)
+{
+    instance()->kLineNextByte();
+}
+
+/**
+ * The byte time at the current baud rate
+ * @return The time, usec
+ */
+static uint32_t ByteTime()
+{
+    uint32_t speed = HostKLineBaudRate();
+    return speed ? 10000000 / speed : 0;
+}
+
+/**
+ * Track the init patterns, the falling edge could be 5 baud address start bit,
+ * the short low pulse is fast init wakeup
+ * @param[in] level The K-line level
+ */
+void EcuSim::onKLineLevel(uint32_t level)
+{
+    if (level == klLevel_)
+        return;
+    klLevel_ = level;
+
+    VirtualClock* clock = VirtualClock::instance();
+    uint64_t now = clock->now();
+    if (!level) {
+        if (klState_ == KL_SLOW_ADDR)
+            return; // The address data bits
+        klFallTime_ = now;
+        klState_ = KL_IDLE;
+        if (config_.protocol != PROT_ISO14230) {
+            klState_ = KL_SLOW_ADDR;
+            klSample_ = 0;
+            klBits_ = 0;
+            clock->schedule(KLineSampleEvent, this, now + BIT_5BAUD / 2);
+        }
+        return;
+    }
+
+    uint64_t low = now - klFallTime_;
+    if (config_.protocol == PROT_ISO14230 && low >= TINIL_MIN && low <= TINIL_MAX) {
+        stats_.inits++;
+        if (requestFaults() & ECUSIM_FAULT_NO_INIT)
+            return;
+        klState_ = KL_FAST_WAKE;
+        klRxLen_ = 0;
+    }
+}
+
+/**
+ * Sample the 5 baud address in the middle of the bit, send the keywords if it is 0x33
+ */
+void EcuSim::onKLineSample()
+{
+    VirtualClock* clock = VirtualClock::instance();
+    if (klSample_ == 0 && klLevel_) {
+        klState_ = KL_IDLE; // Not the start bit
+        return;
+    }
+    if (klSample_ > 0 && klSample_ <= 8) {
+        klBits_ |= klLevel_ << (klSample_ - 1);
+    }
+    if (klSample_++ < 9) {
+        clock->schedule(KLineSampleEvent, this, clock->now() + BIT_5BAUD);
+        return;
+    }
+
+    // The stop bit
+    klState_ = KL_IDLE;
+    if (!klLevel_ || klBits_ != INIT_ADDRESS)
+        return;
+    stats_.inits++;
+    if (requestFaults() & ECUSIM_FAULT_NO_INIT)
+        return;
+
+    const uint8_t isoKeywords[]  = { 0x55, 0x08, 0x08 };
+    const uint8_t kwpKeywords[] = { 0x55, 0xE9, 0x8F };
+    klState_ = KL_SLOW_SYNC;
+    klGap_ = W2_TIME;
+    klTxEcu_ = 0;
+    kLineSend(isKwp() ? kwpKeywords : isoKeywords, 3, clock->now() + BIT_5BAUD / 2 + W1_TIME);
+}
+
+/**
+ * Check the request format, ISO 14230 header has no 0x40 mode,
+ * the adapter is using ISO 9141 header for the requests after 5 baud init
+ * @param[in] fmt The first header byte
+ * @return true if ISO 14230
+ */
+static bool IsKwpFrame(uint8_t fmt)
+{
+    return (fmt & 0xC0) != 0x40;
+}
+
+/**
+ * Check for the complete request, ISO 14230 frame has the length in header,
+ * ISO 9141 frame is ended by the matching checksum
+ * @param[out] pos The data position
+ * @param[out] len The data length
+ * @return true if completed
+ */
+bool EcuSim::kLineRequestDone(int& pos, int& len) const
+{
+    if (klRxLen_ == 0)
+        return false;
+    if (IsKwpFrame(klRx_[0])) {
+        uint8_t fmt = klRx_[0];
+        pos = (fmt & 0xC0) ? 3 : 1;
+        len = fmt & 0x3F;
+        if (len == 0) {
+            if (klRxLen_ <= pos)
+                return false;
+            len = klRx_[pos++];
+        }
+        return klRxLen_ >= pos + len + 1;
+    }
+    pos = 3;
+    len = klRxLen_ - 4;
+    return klRxLen_ >= 5 && iso_checksum(klRx_, klRxLen_ - 1) == klRx_[klRxLen_ - 1];
+}
+
+/**
+ * Collect the adapter request bytes, the next byte cancels the reply to ISO 9141
+ * frame recognized too early
+ * @param[in] byte The byte
+ */
+void EcuSim::onKLineByte(uint8_t byte)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    uint64_t now = clock->now();
+
+    if (klState_ == KL_SLOW_SYNC) {
+        klState_ = KL_IDLE;
+        if (byte == static_cast<uint8_t>(~klTx_[2])) {
+            const uint8_t invAddress = ~INIT_ADDRESS;
+            klState_ = KL_READY;
+            klLastRx_ = now;
+            klTxEcu_ = 0;
+            kLineSend(&invAddress, 1, now + W4_TIME);
+        }
+        return;
+    }
+    if (klState_ == KL_READY && now - klLastRx_ > P3_MAX)
+        klState_ = KL_IDLE; // The session expired
+    if (klState_ != KL_READY && klState_ != KL_FAST_WAKE)
+        return;
+
+    for (int i = 0; i < config_.ecuCount; i++) {
+        clock->cancel(KLineEcuEvent, &ecus_[i]);
+    }
+    if (klTxEcu_) {
+        clock->cancel(KLineByteEvent, this);
+        klTxLen_ = klTxPos_ = 0;
+        klTxEcu_ = 0;
+        klBusFree_ = now;
+    }
+
+    if (now - klLastRx_ > REQ_GAP)
+        klRxLen_ = 0;
+    klLastRx_ = now;
+    if (klRxLen_ < FRAME_LEN)
+        klRx_[klRxLen_++] = byte;
+
+    int pos, len;
+    if (!kLineRequestDone(pos, len))
+        return;
+    const uint8_t* data = klRx_ + pos;
+    klRxLen_ = 0;
+    if (IsKwpFrame(klRx_[0]) && iso_checksum(klRx_, pos + len) != klRx_[pos + len])
+        return;
+
+    // Either functional or physical address
+    uint8_t target = klRx_[1];
+    uint32_t ecuMask = (1 << config_.ecuCount) - 1;
+    if (pos > 1 && target != ISO_FUNCTIONAL && target != INIT_ADDRESS) {
+        int index = target - 0x10;
+        ecuMask = (index >= 0 && index < config_.ecuCount) ? (1 << index) : 0;
+    }
+
+    // Only StartCommunication is accepted after fast init wakeup
+    if (klState_ == KL_FAST_WAKE) {
+        if (len < 1 || data[0] != 0x81)
+            return;
+        klState_ = KL_READY;
+    }
+    if (ecuMask)
+        onRequest(data, len, ecuMask);
+}
+
+/**
+ * Start sending the bytes, one at the time
+ * @param[in] data The bytes
+ * @param[in] len The number of bytes
+ * @param[in] time The transmit start time, usec
+ */
+void EcuSim::kLineSend(const uint8_t* data, int len, uint64_t time)
+{
+    const uint32_t byteTime = ByteTime();
+    memcpy(klTx_, data, len);
+    klTxLen_ = len;
+    klTxPos_ = 0;
+    klBusFree_ = time + len * byteTime + (len - 1) * klGap_ + FRAME_GAP;
+    VirtualClock::instance()->schedule(KLineByteEvent, this, time + byteTime);
+}
+
+/**
+ * The byte completed, pass it to adapter and schedule the next one
+ */
+void EcuSim::kLineNextByte()
+{
+    if (klTxPos_ >= klTxLen_)
+        return;
+
+    VirtualClock* clock = VirtualClock::instance();
+    HostKLineInject(klTx_[klTxPos_++]);
+    klLastRx_ = clock->now();
+    if (klTxPos_ < klTxLen_) {
+        clock->schedule(KLineByteEvent, this, clock->now() + ByteTime() + klGap_);
+        return;
+    }
+
+    if (klTxEcu_) {
+        stats_.replies++;
+        stats_.replyTime = clock->now();
+    }
+    klTxEcu_ = 0;
+}
+
+/**
+ * Send the next reply frame with the header and checksum, wait if the other ECU is sending
+ * @param[in] ecu The ECU
+ */
+void EcuSim::kLineSendFrame(Ecu* ecu)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    if (ecu->frameIdx >= ecu->numFrames)
+        return;
+    if (klTxEcu_ || clock->now() < klBusFree_) {
+        uint64_t time = klBusFree_ > clock->now() ? klBusFree_ : clock->now() + FRAME_GAP;
+        clock->schedule(KLineEcuEvent, ecu, time);
+        return;
+    }
+
+    const Frame* frame = &ecu->frames[ecu->frameIdx];
+    uint8_t buff[FRAME_LEN + 4];
+    int len = 0;
+    if (isKwp()) {
+        buff[len++] = 0x80 | frame->length;
+        buff[len++] = 0xF1;
+    }
+    else {
+        buff[len++] = 0x48;
+        buff[len++] = 0x6B;
+    }
+    buff[len++] = ecuAddress(ecu);
+    memcpy(buff + len, frame->data, frame->length);
+    len += frame->length;
+    buff[len] = iso_checksum(buff, len);
+    if (ecu->faults & ECUSIM_FAULT_CHECKSUM) {
+        buff[len]++;
+    }
+    len++;
+    if (ecu->faults & ECUSIM_FAULT_TRUNCATE) {
+        len--;
+    }
+
+    klGap_ = config_.byteGap;
+    klTxEcu_ = ecu;
+    kLineSend(buff, len, clock->now());
+
+    if (++ecu->frameIdx < ecu->numFrames) {
+        // Response pending takes the full latency again
+        bool pending = (frame->data[0] == 0x7F && frame->data[2] == 0x78);
+        clock->schedule(KLineEcuEvent, ecu, pending ? replyTime(ecu) : klBusFree_);
+    }
+}
@@ -0,0 +1,328 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include "EcuUart.h"
+#include "Timer.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+using namespace std;
+
+const uint32_t EchoTimeoutBits = 208; // Using 20ms echo timeout at 10400 bit/s
+
+// The simulated USART1 and K-line
+static uint32_t uartSpeed;
+static uint8_t  rxLatch;
+static bool     rxLatchFull;
+static uint8_t  txByte;
+static uint64_t txFreeTime;
+static bool     bitBangMode;
+static uint32_t lineLevel = 1;
+static KLineByteListenerT byteListener;
+static KLineLevelListenerT levelListener;
+
+/**
+ * Constructor
+ */
+EcuUart::EcuUart()
+  : rxHead_(0),
+    rxTail_(0),
+    txLen_(0),
+    txP4_(0),
+    txPos_(0),
+    txState_(TX_IDLE),
+    byteTime_(0),
+    echoTimeout_(0)
+{
+    static OneShotTimer timer(TxTimerHandler);
+    txTimer_ = &timer;
+}
+
+/**
+ * EcuUart singleton
+ * @return The pointer to EcuUart instance
+ */
+EcuUart* EcuUart::instance()
+{
+    static EcuUart instance;
+    return &instance;
+}
+
+/**
+ * Nothing to configure
+ */
+void EcuUart::configure()
+{
+}
+
+/**
+ * Set the speed
+ * @parameter[in] speed EcuUart speed
+ */
+void EcuUart::init(uint32_t speed)
+{
+    uartSpeed = speed;
+
+    // The timing in microseconds, 10 bits per byte for 8N1
+    byteTime_ = 10000000 / speed;
+    echoTimeout_ = EchoTimeoutBits * 1000000 / speed;
+    clearRxFifo();
+}
+
+/**
+ * The byte is on the line, pass it to the receiver
+ * @param[in] byte The byte received
+ */
+static void DeliverByte(uint8_t byte)
+{
+    if (bitBangMode)
+        return;
+    rxLatch = byte;
+    rxLatchFull = true;
+    EcuUart::instance()->irqHandler();
+}
+
+/**
+ * EcuUart IRQ handler, store the received byte with arrival time into ring buffer.
+ * The byte is dropped if the ring buffer is full.
+ */
+void EcuUart::irqHandler()
+{
+    if (!rxLatchFull)
+        return;
+
+    uint32_t stamp = TimeStamp::now();
+    uint8_t byte = rxLatch;
+    rxLatchFull = false;
+
+    // The TX and RX are interconnected, the echo is checked here and not stored
+    if (txState_ == TX_ECHO) {
+        txTimer_->stop();
+        if (byte != txData_[txPos_]) {
+            txState_ = TX_ERROR;
+        }
+        else if (++txPos_ >= txLen_) {
+            txState_ = TX_DONE;
+        }
+        else {
+            // Interbyte delay <P4 = [5-20ms]>
+            txState_ = TX_GAP;
+            txTimer_->start(txP4_);
+        }
+        return;
+    }
+
+    uint16_t next = (rxHead_ + 1) & (RX_RING_LEN - 1);
+    if (next != rxTail_) {
+        rxData_[rxHead_] = byte;
+        rxStamp_[rxHead_] = stamp;
+        rxHead_ = next;
+    }
+}
+
+/**
+ * The transmitted byte is completed, the listener sees it and it is echoed back
+ * @param[in] arg Not used
+ */
+static void TxByteEvent(void* arg)
+{
+    if (byteListener) {
+        (*byteListener)(txByte);
+    }
+    DeliverByte(txByte);
+}
+
+/**
+ * Send byte, blocking call pending on the previous byte completion
+ * @parameter[in] byte Byte to sent
+ */
+void EcuUart::send(uint8_t byte)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    while (clock->now() < txFreeTime)
+        clock->poll();
+
+    txByte = byte;
+    txFreeTime = clock->now() + byteTime_;
+    clock->schedule(TxByteEvent, 0, txFreeTime);
+}
+
+/*
+ * Reading the next byte from receive ring buffer
+ * @return The byte received
+ */
+uint8_t EcuUart::get()
+{
+    if (!ready())
+        return 0;
+    uint8_t byte = rxData_[rxTail_];
+    rxTail_ = (rxTail_ + 1) & (RX_RING_LEN - 1);
+    return byte;
+}
+
+/**
+ * Sleep until a byte is received or timer expired
+ * @param[in] timer The timeout timer
+ * @return true if byte is ready, false if timeout
+ */
+bool EcuUart::wait(const Timer* timer)
+{
+    while (!ready() && !timer->isExpired()) {
+        VirtualClock::instance()->sleep();
+    }
+    return ready();
+}
+
+/**
+ * No receiver errors simulated
+ */
+void EcuUart::clear()
+{
+}
+
+/**
+ * Drop all the bytes from receive ring buffer
+ */
+void EcuUart::clearRxFifo()
+{
+    rxTail_ = rxHead_;
+}
+
+/**
+ * Start the transmission, every byte is echoed back and compared in the receiver,
+ * the next byte is sent by the timer after P4 interval.
+ * @parameter[in] data The bytes to send
+ * @parameter[in] len The number of bytes
+ * @parameter[in] p4Interval The interbyte interval in microseconds
+ * @return true if started, false if busy or message too long
+ */
+bool EcuUart::startTx(const uint8_t* data, int len, uint32_t p4Interval)
+{
+    if (isTxBusy() || len <= 0 || len > TX_BUF_LEN)
+        return false;
+
+    memcpy(txData_, data, len);
+    txLen_ = len;
+    txP4_ = p4Interval;
+    txPos_ = 0;
+    clearRxFifo(); // Drop the bus noise, only echo bytes expected
+    sendNext();
+    return true;
+}
+
+/**
+ * Send the byte at the current position and wait for its echo
+ */
+void EcuUart::sendNext()
+{
+    txState_ = TX_ECHO;
+    txTimer_->start(echoTimeout_);
+    send(txData_[txPos_]);
+}
+
+/**
+ * Sleep until the transmission completed
+ * @return true if all the bytes echoed back, false otherwise
+ */
+bool EcuUart::waitTx()
+{
+    while (isTxBusy()) {
+        VirtualClock::instance()->sleep();
+    }
+    return txResult();
+}
+
+/**
+ * Abort the transmission in progress
+ */
+void EcuUart::abortTx()
+{
+    txTimer_->stop();
+    txState_ = TX_IDLE;
+}
+
+/**
+ * Transmit timer handler, either P4 interval or echo timeout expired
+ */
+void EcuUart::txTimerHandler()
+{
+    if (txState_ == TX_GAP) {
+        sendNext();
+    }
+    else if (txState_ == TX_ECHO) {
+        txState_ = TX_ERROR; // no echo, wiring problem
+    }
+}
+
+/**
+ * Transmit timer callback, redirect to txTimerHandler
+ */
+void EcuUart::TxTimerHandler()
+{
+    EcuUart::instance()->txTimerHandler();
+}
+
+/*
+ * Turn on/off bing bang-mode for ISO initialization, the receiver is disconnected
+ * @parameter[in] val Bing-bang mode flag
+ */
+void EcuUart::setBitBang(bool val)
+{
+    bitBangMode = val;
+    lineLevel = 1;
+}
+
+/*
+ * Set the K-line level in bit-bang mode
+ * @parameter[in] bit USART TX pin value
+ */
+void EcuUart::setBit(uint32_t bit)
+{
+    lineLevel = bit;
+    if (bitBangMode && levelListener) {
+        (*levelListener)(bit);
+    }
+}
+
+/**
+ * Read the K-line level, the transceiver feedback
+ * @return pin status, 1 if set, 0 otherwise
+ */
+uint32_t EcuUart::getBit()
+{
+    return lineLevel;
+}
+
+/**
+ * Set the K-line listeners
+ * @param[in] byteListener The transmitted byte listener
+ * @param[in] levelListener The bit-bang level listener
+ */
+void HostKLineListeners(KLineByteListenerT byteListener, KLineLevelListenerT levelListener)
+{
+    ::byteListener = byteListener;
+    ::levelListener = levelListener;
+}
+
+/**
+ * The ECU byte is completed on K-line
+ * @param[in] byte The byte
+ */
+void HostKLineInject(uint8_t byte)
+{
+    DeliverByte(byte);
+}
+
+/**
+ * The current K-line speed
+ * @return The speed in bit/s
+ */
+uint32_t HostKLineBaudRate()
+{
+    return uartSpeed;
+}
@@ -0,0 +1,67 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include "GpioDrv.h"
+
+const uint32_t PORTS_NUM = 3;
+
+// The simulated port latches, the input reads back the output value
+static uint32_t portDir[PORTS_NUM];
+static uint32_t portPin[PORTS_NUM];
+
+/**
+ * Setting GPIO pin direction
+ * @param[in] portNum GPIO number (0..2)
+ * @param[in] pinNum Port pin number
+ * @param[in] dir GPIO_DIR_INPUT, GPIO_DIR_OUTPUT
+ */
+void GPIOSetDir(uint32_t portNum, uint32_t pinNum, uint32_t dir)
+{
+    if (dir) {
+        portDir[portNum] |= (1UL << pinNum);
+    }
+    else {
+        portDir[portNum] &= ~(1UL << pinNum);
+    }
+}
+
+/**
+ * Setting the port pin value
+ * @param[in] portNum GPIO number (0..2)
+ * @param[in] pinNum Port pin number
+ * @param[in] val Port pin value (0 or 1)
+ */
+void GPIOPinWrite(uint32_t portNum, uint32_t pinNum, uint32_t val)
+{
+    if (val) {
+        portPin[portNum] |= (1UL << pinNum);
+    }
+    else {
+        portPin[portNum] &= ~(1UL << pinNum);
+    }
+}
+
+/**
+ * Read port pin
+ * @param[in] portNum GPIO number (0..2)
+ * @param[in] pinNum Port pin number
+ * @return pin value (0 or 1)
+ */
+uint32_t GPIOPinRead(uint32_t portNum, uint32_t pinNum)
+{
+    return (portPin[portNum] & (1UL << pinNum)) ? 1 : 0;
+}
+
+/**
+ * Port attributes are not simulated
+ * @param[in] portNum GPIO number (0..2)
+ * @param[in] pinNum Port pin number
+ * @param[in] val Port attribute
+ */
+void GPIOPinConfig(uint32_t portNum, uint32_t pinNum, uint32_t val)
+{
+}
@@ -0,0 +1,46 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __HOST_SIM_H__
+#define __HOST_SIM_H__
+
+#include <cstdint>
+
+using namespace std;
+
+struct CanMsgBuffer;
+
+//
+// The simulated buses of the host build. The listeners see the adapter output
+// at the time it is completed on the bus, the inject calls deliver the ECU
+// output to the adapter right away, the caller is responsible for the timing.
+//
+
+// K-line, the transmitted bytes and the bit-bang levels (ISO init)
+typedef void (*KLineByteListenerT)(uint8_t byte);
+typedef void (*KLineLevelListenerT)(uint32_t level);
+void HostKLineListeners(KLineByteListenerT byteListener, KLineLevelListenerT levelListener);
+void HostKLineInject(uint8_t byte);
+uint32_t HostKLineBaudRate();
+
+// CAN, the injected frame is subject to the adapter filter and mask
+typedef void (*CanListenerT)(const CanMsgBuffer* msg);
+void HostCanListener(CanListenerT listener);
+void HostCanInject(const CanMsgBuffer* msg);
+
+// J1850, the transmitted pulse widths in microseconds, the active pulse first.
+// For PWM the count is the number of bits, each one is active/passive pair.
+typedef void (*J1850ListenerT)(const uint16_t* pulses, int count, bool vpwMode);
+void HostJ1850Listener(J1850ListenerT listener);
+bool HostJ1850Inject(const uint16_t* pulses, int count);
+bool HostJ1850Busy();
+
+// Command port, wait for the host input in real time, the clock follows the elapsed time.
+// The complete command line is passed to the receive handler.
+bool HostCmdPortIdle(uint32_t timeout);
+
+#endif //__HOST_SIM_H__
@@ -0,0 +1,52 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <chrono>
+#include "Profiler.h"
+
+using namespace std::chrono;
+
+const uint64_t CORE_CLOCK_MHZ = 72;
+
+ProfZoneStats Profiler::stats_[PROF_ZONES_LEN];
+
+/**
+ * No cycle counter to start
+ */
+void Profiler::configure()
+{
+}
+
+/**
+ * The host time scaled to the target CPU clock, the zones are timed by wall time
+ * as the virtual clock is not moving while the code is running
+ * @return The cycles
+ */
+uint32_t Profiler::cycles()
+{
+    uint64_t ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint32_t>(ns * CORE_CLOCK_MHZ / 1000);
+}
+
+/**
+ * Clear all the zone counters
+ */
+void Profiler::reset()
+{
+    memset(stats_, 0, sizeof(stats_));
+}
+
+/**
+ * Copy and clear all the zone counters, no interrupts on the host
+ * @param[out] stats The zone counters, PROF_ZONES_LEN entries
+ */
+void Profiler::takeStats(ProfZoneStats* stats)
+{
+    memcpy(stats, stats_, sizeof(stats_));
+    memset(stats_, 0, sizeof(stats_));
+}
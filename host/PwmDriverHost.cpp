@@ -0,0 +1,475 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include "Timer.h"
+#include "PwmDriver.h"
+#include "HostSim.h"
+#include "VirtualClock.h"
+
+// The SCT0 clock, ticks per microsecond, 4 for VPW 4x mode
+static uint32_t tickDiv = 1;
+
+// The simulated SCT0 capture state
+static volatile uint8_t  timerFlag;
+static volatile uint32_t timerVal;
+static volatile uint32_t timerVal2;
+static uint32_t timeoutTicks;
+static bool     timeoutOn;
+
+// Receive pulse ring
+const int PULSE_RING_LEN = 256; // Should be power of 2
+static volatile uint16_t pulseRing[PULSE_RING_LEN];
+static volatile uint32_t pulseHead;
+static volatile uint32_t pulseTail;
+static volatile bool     pulseRxOn;
+static volatile bool     pulseIdle;
+
+// Transmit status
+enum TxStatus { TX_IDLE, TX_BUSY, TX_DONE, TX_LOST };
+static volatile TxStatus txStatus = TX_IDLE;
+const int TX_PULSES_LEN = 512;
+static uint16_t txPulsesUs[TX_PULSES_LEN];
+static int      txPulsesCount;
+static bool     txVpw;
+
+// The J1850 bus, the active level is driven either by adapter or by the injected ECU pulses
+static uint32_t busActive;
+static uint32_t outputLevel;
+static uint64_t lastEdge;
+static uint16_t injPulses[TX_PULSES_LEN];
+static int      injCount;
+static int      injIdx;
+static J1850ListenerT j1850Listener;
+
+/**
+ * Nothing to configure
+ */
+void PwmDriver::configure()
+{
+}
+
+/**
+ * PwmDriver singleton
+ * @return The pointer to PwmDriver instance
+ */
+PwmDriver* PwmDriver::instance()
+{
+    static PwmDriver instance;
+    return &instance;
+}
+
+/**
+ * The ticks elapsed since the last bus edge or counter reset
+ * @return The counter value in ticks
+ */
+static uint32_t CounterTicks()
+{
+    return static_cast<uint32_t>(VirtualClock::instance()->now() - lastEdge) * tickDiv;
+}
+
+/**
+ * Store the pulse into ring, drop it if the ring is full
+ * @param[in] pulse The pulse width with flags
+ */
+static void PushPulse(uint32_t pulse)
+{
+    uint32_t next = (pulseHead + 1) & (PULSE_RING_LEN - 1);
+    if (next != pulseTail) {
+        pulseRing[pulseHead] = pulse;
+        pulseHead = next;
+    }
+}
+
+/**
+ * Capture value limited to the pulse width field
+ * @param[in] val The captured counter value
+ * @return The pulse width
+ */
+static inline uint32_t PulseWidth(uint32_t val)
+{
+    return (val < PwmDriver::PULSE_WIDTH) ? val : PwmDriver::PULSE_WIDTH;
+}
+
+/**
+ * The match 0 event, the bus idle timeout
+ * @param[in] arg Not used
+ */
+static void TimeoutEvent(void* arg)
+{
+    if (!timeoutOn)
+        return;
+    timerFlag |= 0x01;
+    if (pulseRxOn && !pulseIdle) {
+        PushPulse(PwmDriver::PULSE_TIMEOUT | (busActive ? PwmDriver::PULSE_ACTIVE : 0));
+        pulseIdle = true;
+    }
+}
+
+/**
+ * Reset the counter and restart the timeout
+ */
+static void ResetCounter()
+{
+    VirtualClock* clock = VirtualClock::instance();
+    lastEdge = clock->now();
+    if (timeoutOn) {
+        clock->schedule(TimeoutEvent, 0, lastEdge + timeoutTicks / tickDiv);
+    }
+}
+
+/**
+ * The bus level changed, capture the completed pulse as SCT0 does
+ * @param[in] level The new bus level
+ */
+static void BusEdge(uint32_t level)
+{
+    uint32_t width = CounterTicks();
+    busActive = level;
+    if (level) { // rising edge, the passive pulse completed
+        timerVal = width;
+        timerFlag |= 0x02;
+        if (pulseRxOn) {
+            PushPulse(PulseWidth(width));
+            pulseIdle = false;
+        }
+    }
+    else { // falling edge, the active pulse completed
+        timerVal = width;
+        timerVal2 = width;
+        timerFlag |= 0x04;
+        if (pulseRxOn) {
+            PushPulse(PulseWidth(width) | PwmDriver::PULSE_ACTIVE);
+            pulseIdle = false;
+        }
+    }
+    ResetCounter();
+}
+
+/**
+ * The end of the injected pulse, toggle the bus
+ * @param[in] arg Not used
+ */
+static void InjectEdgeEvent(void* arg)
+{
+    BusEdge(!busActive);
+    if (++injIdx < injCount) {
+        VirtualClock* clock = VirtualClock::instance();
+        clock->schedule(InjectEdgeEvent, 0, clock->now() + injPulses[injIdx]);
+    }
+    else {
+        injCount = 0;
+        if (busActive) {
+            BusEdge(0); // The passive bus after the last pulse
+        }
+    }
+}
+
+/**
+ * Halt the counter, disable the capture and the timeout
+ */
+void PwmDriver::stop()
+{
+    timeoutOn = false;
+    VirtualClock::instance()->cancel(TimeoutEvent, 0);
+}
+
+/**
+ * Set timeout for PWM protocol operations
+ * @param[in] timeout Timeout value
+ */
+void PwmDriver::setTimeoutPwm(uint32_t timeout)
+{
+    stop();
+    timeoutTicks = timeout;
+}
+
+/**
+ * Wait for J1850 SOF pulse
+ * @param[in] timeout Timeout for SOF
+ * @param[in] p2timeout P2 timeout
+ * @return The width of SOF pulse candidate, 0xFFFFFFFF if P2 timeout expired
+ */
+uint32_t PwmDriver::wait4Sof(uint32_t timeout, Timer* p2timer)
+{
+    stop();
+    timeoutTicks = timeout;
+    ResetCounter();
+
+    timerFlag = 0;
+    while (!(timerFlag & 0x04)) {
+        if (p2timer->isExpired())
+            return 0xFFFFFFFF;
+    }
+    return timerVal;
+}
+
+/**
+ * Start J1850 receiver, the widths of all the bus pulses are captured into pulse ring
+ * @param[in] timeout The bus idle timeout, reported as the pulse with PULSE_TIMEOUT flag
+ */
+void PwmDriver::startRx(uint32_t timeout)
+{
+    timeoutTicks = timeout;
+    timeoutOn = true;
+    pulseHead = pulseTail = 0;
+    pulseIdle = true; // Ignore the timeout until the first edge
+    pulseRxOn = true;
+    ResetCounter();
+}
+
+/**
+ * Get the next captured pulse
+ * @param[out] pulse The pulse width with flags
+ * @return true if available, false if pulse ring is empty
+ */
+bool PwmDriver::getPulse(uint32_t& pulse)
+{
+    if (pulseHead == pulseTail)
+        return false;
+    pulse = pulseRing[pulseTail];
+    pulseTail = (pulseTail + 1) & (PULSE_RING_LEN - 1);
+    return true;
+}
+
+/**
+ * Sleep until the next pulse is captured or timer expired
+ * @param[in] timer The timeout timer
+ * @return true if pulse is ready, false if timeout
+ */
+bool PwmDriver::waitPulse(const Timer* timer)
+{
+    while (pulseHead == pulseTail && !timer->isExpired()) {
+        VirtualClock::instance()->sleep();
+    }
+    return pulseHead != pulseTail;
+}
+
+/**
+ * Stop J1850 receiver
+ */
+void PwmDriver::stopRx()
+{
+    pulseRxOn = false;
+    stop();
+}
+
+/**
+ * Wait for J1850 bus right moment to start transmitting the message
+ * @param[in] timeout1 TV6/TP5 timeout value
+ * @param[in] timeout2 TVP4/TP6 timeout value
+ * @param[in] p2Timer P2 timer pointer
+ * @return true if bus ready, false if bus busy
+ */
+bool PwmDriver::wait4Ready(uint32_t timeout1, uint32_t timeout2, Timer* p2timer)
+{
+    stop();
+    ResetCounter();
+
+    while (!p2timer->isExpired()) {
+        // Run as long as bus active
+        if (busActive)
+            continue;
+        // Got the passive bus, measuring timeout1
+        if (CounterTicks() <= timeout1)
+            continue;
+        // Just wait for rising edge or timeout2 expired
+        VirtualClock* clock = VirtualClock::instance();
+        while (CounterTicks() < timeout2 && !busActive) {
+            clock->poll();
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Copy the transmitted pulses for the listener, in microseconds
+ * @param[in] pulses The pulse widths in ticks
+ * @param[in] count The number of pulses
+ * @param[in] extra The ticks to add to every pulse
+ * @return The total duration in microseconds
+ */
+static uint32_t CopyTxPulses(const uint16_t* pulses, int count, uint32_t extra)
+{
+    uint32_t total = 0;
+    txPulsesCount = (count < TX_PULSES_LEN) ? count : TX_PULSES_LEN;
+    for (int i = 0; i < count; i++) {
+        uint32_t width = (pulses[i] + extra) / tickDiv;
+        if (i < txPulsesCount) {
+            txPulsesUs[i] = width;
+        }
+        total += width;
+    }
+    return total;
+}
+
+/**
+ * The transmit has been completed, the arbitration is lost if the ECU was transmitting
+ * @param[in] arg Not used
+ */
+static void TxCompleteEvent(void* arg)
+{
+    if (injCount) {
+        txStatus = TX_LOST;
+        return;
+    }
+    txStatus = TX_DONE;
+    ResetCounter();
+    if (j1850Listener) {
+        (*j1850Listener)(txPulsesUs, txVpw ? txPulsesCount : txPulsesCount / 2, txVpw);
+    }
+}
+
+/**
+ * Start the transmit, it completes after the sum of pulse widths
+ * @param[in] total The transmit duration in microseconds
+ */
+static void StartTx(uint32_t total)
+{
+    PwmDriver::instance()->stop();
+    txStatus = TX_BUSY;
+    VirtualClock* clock = VirtualClock::instance();
+    clock->schedule(TxCompleteEvent, 0, clock->now() + total);
+}
+
+/**
+ * Start VPW transmit, the pulses are alternating, starting with active SOF
+ * @param[in] pulses The pulse widths
+ * @param[in] count The number of pulses
+ */
+void PwmDriver::startTxVpw(const uint16_t* pulses, int count)
+{
+    txVpw = true;
+    StartTx(CopyTxPulses(pulses, count, 0));
+}
+
+/**
+ * Start PWM transmit, every bit is the pair of active and passive widths (minus one tick)
+ * @param[in] pulses The active/passive width pairs
+ * @param[in] count The number of bits
+ */
+void PwmDriver::startTxPwm(const uint16_t* pulses, int count)
+{
+    txVpw = false;
+    StartTx(CopyTxPulses(pulses, count * 2, 1));
+}
+
+/**
+ * Check if transmit is in progress
+ * @return true if busy
+ */
+bool PwmDriver::isTxBusy() const
+{
+    return txStatus == TX_BUSY;
+}
+
+/**
+ * Sleep until the transmit completed
+ * @return 1 if success, -1 if arbitration lost
+ */
+int PwmDriver::waitTx()
+{
+    while (txStatus == TX_BUSY) {
+        VirtualClock::instance()->sleep();
+    }
+    return (txStatus == TX_DONE) ? 1 : -1;
+}
+
+/**
+ * Get the value on the falling edge
+ * @return The pulse width, 0 if timeout
+ */
+uint32_t PwmDriver::wait4BusPulsePwm()
+{
+    timeoutOn = true;
+    ResetCounter();
+    timerFlag = 0;
+    timerVal2 = 0;
+    while ((timerFlag & 0x05) == 0) // events 0,2, the timeout is always scheduled
+        VirtualClock::instance()->sleep();
+    return (timerFlag & 0x01) ? 0 : timerVal2;
+}
+
+/**
+ * Get the bus level in bing-bang mode (connectivity testing)
+ * @return The bus level
+ */
+uint32_t PwmDriver::getBit()
+{
+    return (busActive || outputLevel) ? 1 : 0;
+}
+
+/**
+ * Set the output in bing-bang mode (connectivity testing)
+ * @param[in] val The driver pin output value
+ */
+void PwmDriver::setBit(int val)
+{
+    stop();
+    outputLevel = val ? 1 : 0;
+}
+
+/**
+ * Set the SCT clock for VPW 4x mode
+ * @param[in] val true for 41.6 kbit/s, false for 10.4 kbit/s
+ */
+void PwmDriver::setHighSpeedVpw(bool val)
+{
+    stop();
+    tickDiv = val ? 4 : 1;
+}
+
+/**
+ * Open driver for operation, either J1850 PWM or VPW
+ * @param[in] mode true for vpw, false for PWM
+ */
+void PwmDriver::open(bool vpwMode)
+{
+    vpwMode_ = vpwMode;
+    setHighSpeedVpw(false);
+}
+
+/**
+ * Set the J1850 listener
+ * @param[in] listener The transmitted frame listener
+ */
+void HostJ1850Listener(J1850ListenerT listener)
+{
+    j1850Listener = listener;
+}
+
+/**
+ * Start driving the bus with ECU pulses, the active pulse first
+ * @param[in] pulses The pulse widths in microseconds, copied
+ * @param[in] count The number of pulses
+ * @return true if started, false if the bus is busy
+ */
+bool HostJ1850Inject(const uint16_t* pulses, int count)
+{
+    if (HostJ1850Busy() || count <= 0 || count > TX_PULSES_LEN)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        injPulses[i] = pulses[i];
+    }
+    injCount = count;
+    injIdx = 0;
+    BusEdge(1);
+
+    VirtualClock* clock = VirtualClock::instance();
+    clock->schedule(InjectEdgeEvent, 0, clock->now() + injPulses[0]);
+    return true;
+}
+
+/**
+ * Check if the bus is driven
+ * @return true if either adapter or ECU is transmitting
+ */
+bool HostJ1850Busy()
+{
+    return injCount != 0 || txStatus == TX_BUSY;
+}
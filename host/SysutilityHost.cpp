@@ -0,0 +1,132 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <lstring.h>
+#include <adaptertypes.h>
+#include <Timer.h>
+#include <CmdUart.h>
+#include <CanDriver.h>
+#include <EcuUart.h>
+#include <PwmDriver.h>
+#include <AdcDriver.h>
+#include <led.h>
+#include <Profiler.h>
+#include "HostSim.h"
+#include "EcuSim.h"
+
+using namespace std;
+using namespace util;
+
+const uint32_t EEPROM_SIZE  = 4032;
+const uint32_t IdleTimeout  = 10; // ms, the longest real time wait for the host input
+
+static uint8_t eeprom[EEPROM_SIZE];
+
+/**
+ * Display the simulated CPU UID
+ */
+void AdptReadSerialNum()
+{
+    AdptSendReply("00000000-00000000-00000000");
+}
+
+/**
+ * Read the simulated EEPROM, it is kept in RAM for the process lifetime
+ * @parameter[in] addr EEPROM address
+ * @parameter[out] data The buffer to read to
+ * @parameter[in] len The number of bytes
+ * @return true if OK, false otherwise
+ */
+bool AdptReadStorage(uint32_t addr, void* data, uint32_t len)
+{
+    if (addr + len > EEPROM_SIZE)
+        return false;
+    memcpy(data, eeprom + addr, len);
+    return true;
+}
+
+/**
+ * Write the simulated EEPROM
+ * @parameter[in] addr EEPROM address
+ * @parameter[in] data The bytes to write
+ * @parameter[in] len The number of bytes
+ * @return true if OK, false otherwise
+ */
+bool AdptWriteStorage(uint32_t addr, const void* data, uint32_t len)
+{
+    if (addr + len > EEPROM_SIZE)
+        return false;
+    memcpy(eeprom + addr, data, len);
+    return true;
+}
+
+/**
+ * No low power mode
+ */
+void AdptPowerModeConfigure()
+{
+}
+
+/**
+ * Display the heap break, the allocation counters are target only
+ */
+void AdptMemStatDisplay()
+{
+    char out[64];
+    sprintf(out, "BRK:%08X", static_cast<unsigned>(reinterpret_cast<uintptr_t>(sbrk(0))));
+    AdptSendReply(out);
+}
+
+/**
+ * Initialize the simulated drivers
+ */
+void AdptHardwareInit()
+{
+    Profiler::configure();
+    TimeStamp::configure();
+    CmdUart::configure();
+    EcuUart::configure();
+    CanDriver::configure();
+    AdptLED::configure();
+    PwmDriver::configure();
+    AdcDriver::configure();
+
+    // The simulated vehicle, "protocol[,key=value]..."
+    const char* ecuSpec = getenv("ALLPRO_ECU");
+    if (ecuSpec && !EcuSim::instance()->configure(ecuSpec)) {
+        fprintf(stderr, "ALLPRO_ECU: invalid value \"%s\"\n", ecuSpec);
+        exit(1);
+    }
+}
+
+/**
+ * Print the simulated ECU statistics on exit
+ */
+static void EcuStatDisplay()
+{
+    const EcuSim* sim = EcuSim::instance();
+    if (!sim->config().protocol)
+        return;
+    const EcuSimStats& stats = sim->stats();
+    fprintf(stderr, "ECU requests:%u replies:%u faults:%u inits:%u\n",
+        stats.requests, stats.replies, stats.faults, stats.inits);
+}
+
+/**
+ * Wait for the host input, exit when the input is closed
+ */
+void AdptSleep()
+{
+    if (!HostCmdPortIdle(IdleTimeout)) {
+        EcuStatDisplay();
+        exit(0);
+    }
+}
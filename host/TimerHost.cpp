@@ -0,0 +1,242 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include "Timer.h"
+#include "VirtualClock.h"
+
+// The simulated MRT channel
+struct LPC_MRT_CH_T {
+    uint64_t deadline;
+};
+
+static LPC_MRT_CH_T mrtChannels[2];
+
+/**
+ * The timer expiration event, only wakes up the sleeping code
+ * @param[in] arg Not used
+ */
+static void WakeUpEvent(void* arg)
+{
+}
+
+/**
+ * Check the deadline, the busy polling is moving the clock forward
+ * @param[in] deadline The absolute time in microseconds
+ * @return true if expired, false otherwise
+ */
+static bool IsDeadlinePassed(uint64_t deadline)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    if (clock->now() >= deadline)
+        return true;
+    clock->poll();
+    return clock->now() >= deadline;
+}
+
+/**
+ * Construct the Timer object
+ * @param[in] timerNum Logical timer number (0..1)
+ */
+Timer::Timer(int timerNum)
+{
+    timer_ = &mrtChannels[timerNum];
+    timer_->deadline = 0;
+}
+
+/**
+ * Start/restart the timer
+ * @param[in] interval Timer interval in milliseconds
+ */
+void Timer::start(uint32_t interval)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    timer_->deadline = clock->now() + interval * 1000ULL;
+    clock->schedule(WakeUpEvent, timer_, timer_->deadline);
+}
+
+/**
+ * Check if timer is still running
+ * @return Timer expiration status (false or true)
+ */
+bool Timer::isExpired() const
+{
+    return IsDeadlinePassed(timer_->deadline);
+}
+
+/**
+ * Factory method to construct the Timer object
+ * @param[in] timerNum Logical timer number (0..1)
+ * @return Timer pointer
+ */
+Timer* Timer::instance(int timerNum)
+{
+    static Timer timer0(0);
+    static Timer timer1(1);
+
+    switch (timerNum) {
+      case Timer::TIMER0:
+          return &timer0;
+
+      case Timer::TIMER1:
+          return &timer1;
+
+      default:
+        return 0;
+    }
+}
+
+static uint64_t longTimerDeadline;
+
+/**
+ * The clock is the time base, nothing to configure
+ */
+void TimeStamp::configure()
+{
+}
+
+/**
+ * The current time, wraps around in ~71 minutes
+ * @return The time in microseconds
+ */
+uint32_t TimeStamp::now()
+{
+    return static_cast<uint32_t>(VirtualClock::instance()->now());
+}
+
+/**
+ * Construct the LongTimer object
+ */
+LongTimer::LongTimer()
+{
+}
+
+/**
+ * Start/restart the timer
+ * @param[in] interval Timer interval in milliseconds
+ */
+void LongTimer::start(uint32_t interval)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    longTimerDeadline = clock->now() + interval * 1000ULL;
+    clock->schedule(WakeUpEvent, &longTimerDeadline, longTimerDeadline);
+}
+
+/**
+ * Check if timer expired
+ * @return Timer expiration status, false/true
+ */
+bool LongTimer::isExpired() const
+{
+    return VirtualClock::instance()->now() >= longTimerDeadline;
+}
+
+/**
+ * Instance method for LongTimer object
+ * @return LongTimer pointer
+ */
+LongTimer* LongTimer::instance()
+{
+    static LongTimer timer;
+    return &timer;
+}
+
+static PeriodicCallbackT periodicCallback;
+static uint32_t periodicInterval;
+static PeriodicCallbackT oneShotCallback;
+
+/**
+ * PeriodicTimer event, reload and run the callback
+ * @param[in] arg Not used
+ */
+static void PeriodicEvent(void* arg)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    clock->schedule(PeriodicEvent, 0, clock->now() + periodicInterval);
+    (*periodicCallback)();
+}
+
+/**
+ * Construct the PeriodicTimer instance
+ * @param[in] callback Timer callback handler
+ */
+PeriodicTimer::PeriodicTimer(PeriodicCallbackT callback)
+{
+    periodicCallback = callback;
+}
+
+/**
+ * Start/restart the timer
+ * @param[in] interval Timer interval in milliseconds
+ */
+void PeriodicTimer::start(uint32_t interval)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    periodicInterval = (interval ? interval : 1) * 1000;
+    clock->schedule(PeriodicEvent, 0, clock->now() + periodicInterval);
+}
+
+/**
+ *  Stop the timer
+ */
+void PeriodicTimer::stop()
+{
+    VirtualClock::instance()->cancel(PeriodicEvent, 0);
+}
+
+/**
+ * OneShotTimer event, run the callback
+ * @param[in] arg Not used
+ */
+static void OneShotEvent(void* arg)
+{
+    (*oneShotCallback)();
+}
+
+/**
+ * Construct the OneShotTimer instance
+ * @param[in] callback Timer callback handler, called from the clock event
+ */
+OneShotTimer::OneShotTimer(PeriodicCallbackT callback)
+{
+    oneShotCallback = callback;
+}
+
+/**
+ * Start/restart the timer
+ * @param[in] interval Timer interval in microseconds
+ */
+void OneShotTimer::start(uint32_t interval)
+{
+    VirtualClock* clock = VirtualClock::instance();
+    clock->schedule(OneShotEvent, 0, clock->now() + (interval ? interval : 1));
+}
+
+/**
+ *  Stop the timer
+ */
+void OneShotTimer::stop()
+{
+    VirtualClock::instance()->cancel(OneShotEvent, 0);
+}
+
+/**
+ * Delay for number of milliseconds
+ * @param[in] value The number of millisecond to delay
+ */
+void Delay1ms(uint32_t value)
+{
+    VirtualClock::instance()->advance(value * 1000ULL);
+}
+
+/**
+ * Delay for number of microseconds
+ * @param[in] value The number of microseconds to delay
+ */
+void Delay1us(uint32_t value)
+{
+    VirtualClock::instance()->advance(value);
+}
@@ -0,0 +1,135 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include "VirtualClock.h"
+
+using namespace std;
+
+/**
+ * Construct the VirtualClock object, starting at zero time
+ */
+VirtualClock::VirtualClock()
+  : now_(0)
+{
+    memset(events_, 0, sizeof(events_));
+}
+
+/**
+ * VirtualClock singleton
+ * @return The pointer to VirtualClock instance
+ */
+VirtualClock* VirtualClock::instance()
+{
+    static VirtualClock instance;
+    return &instance;
+}
+
+/**
+ * Schedule the event, the pending event with the same callback and argument is replaced
+ * @param[in] event The event callback
+ * @param[in] arg The callback argument
+ * @param[in] time The absolute time in microseconds, the past time runs on the next advance
+ * @return true if OK, false if event table is full
+ */
+bool VirtualClock::schedule(ClockEventT event, void* arg, uint64_t time)
+{
+    int slot = -1;
+    for (int i = 0; i < EVENTS_LEN; i++) {
+        if (events_[i].event == event && events_[i].arg == arg) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && !events_[i].event) {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+        return false;
+    events_[slot].event = event;
+    events_[slot].arg = arg;
+    events_[slot].time = time;
+    return true;
+}
+
+/**
+ * Remove the pending event
+ * @param[in] event The event callback
+ * @param[in] arg The callback argument
+ */
+void VirtualClock::cancel(ClockEventT event, void* arg)
+{
+    for (int i = 0; i < EVENTS_LEN; i++) {
+        if (events_[i].event == event && events_[i].arg == arg) {
+            events_[i].event = 0;
+        }
+    }
+}
+
+/**
+ * Find the earliest pending event
+ * @return The event table index, -1 if none
+ */
+int VirtualClock::nextEvent() const
+{
+    int next = -1;
+    for (int i = 0; i < EVENTS_LEN; i++) {
+        if (events_[i].event && (next < 0 || events_[i].time < events_[next].time)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+/**
+ * Run the earliest event if it is due before the limit. The event is removed
+ * before the callback, so the callback is free to schedule it again.
+ * @param[in] limit The time limit
+ * @return true if the event was run, false otherwise
+ */
+bool VirtualClock::runNext(uint64_t limit)
+{
+    int next = nextEvent();
+    if (next < 0 || events_[next].time > limit)
+        return false;
+
+    Event event = events_[next];
+    events_[next].event = 0;
+    if (event.time > now_) {
+        now_ = event.time;
+    }
+    (*event.event)(event.arg);
+    return true;
+}
+
+/**
+ * Move the time forward running all the events due in the order of their time
+ * @param[in] interval The interval in microseconds
+ */
+void VirtualClock::advance(uint64_t interval)
+{
+    uint64_t target = now_ + interval;
+    while (runNext(target))
+        ;
+    if (target > now_) {
+        now_ = target;
+    }
+}
+
+/**
+ * Move the time to the next event and run it, the analog of WFI
+ */
+void VirtualClock::sleep()
+{
+    int next = nextEvent();
+    if (next < 0) {
+        poll();
+        return;
+    }
+    uint64_t time = events_[next].time;
+    advance(time > now_ ? time - now_ : 0);
+}
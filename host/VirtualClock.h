@@ -0,0 +1,46 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __VIRTUAL_CLOCK_H__
+#define __VIRTUAL_CLOCK_H__
+
+#include <cstdint>
+
+using namespace std;
+
+typedef void (*ClockEventT)(void* arg);
+
+//
+// The simulated time base for the host build, in microseconds. The clock is moving
+// only when the code is waiting: the busy polls advance it by POLL_QUANTUM, the sleep
+// skips to the next scheduled event. The events are the host analog of interrupts.
+//
+class VirtualClock {
+public:
+    const static uint32_t POLL_QUANTUM = 10; // usec
+    static VirtualClock* instance();
+    uint64_t now() const { return now_; }
+    bool schedule(ClockEventT event, void* arg, uint64_t time);
+    void cancel(ClockEventT event, void* arg);
+    void advance(uint64_t interval);
+    void poll() { advance(POLL_QUANTUM); }
+    void sleep();
+private:
+    const static int EVENTS_LEN = 32;
+    struct Event {
+        ClockEventT event;
+        void*       arg;
+        uint64_t    time;
+    };
+    VirtualClock();
+    int  nextEvent() const;
+    bool runNext(uint64_t limit);
+    uint64_t now_;
+    Event    events_[EVENTS_LEN];
+};
+
+#endif //__VIRTUAL_CLOCK_H__
@@ -7,50 +7,15 @@
 
 #include <lstring.h>
 #include <cctype>
-#include <LPC15xx.h>
-#include <Timer.h>
-#include <GPIODrv.h>
 #include <CmdUart.h>
-#include <CanDriver.h>
-#include <EcuUart.h>
-#include <PwmDriver.h>
-#include <AdcDriver.h>
-#include <led.h>
 #include <adaptertypes.h>
 
 using namespace std;
 using namespace util;
 
-static string CmdBuffer(RX_CMD_LEN);
+static CmdString CmdBuffer;
 static CmdUart* glblUart;
-
-/**
- * Enable the clocks and peripherals, initialize the drivers
- */
-static void SetAllRegisters()
-{
-    // Enable MRT timer
-    LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 0);
-    LPC_SYSCON->PRESETCTRL1 &= ~(1 << 0);
-    
-    // Enable RIT timer
-    LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 1);
-    LPC_SYSCON->PRESETCTRL1 &= ~(1 << 1);
-    
-    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 11); // MUX
-    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 12); // SVM
-    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 13); // IOCON
-    
-    // LPC I/O pins
-    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 14); // PIO0
-    
-    CmdUart::configure();
-    EcuUart::configure();
-    CanDriver::configure();
-    AdptLED::configure();
-    PwmDriver::configure();
-    AdcDriver::configure();
-}
+static volatile bool HostInput;
 
 /**
  * Outer interface UART receive callback
@@ -58,9 +23,12 @@ static void SetAllRegisters()
  */
 static bool UserUartRcvHandler(uint8_t ch)
 {
-    static string cmdBuffer(RX_BUFFER_LEN);
+    static CmdString cmdBuffer;
     bool ready = false;
     
+    if (ch != '\n') {
+        HostInput = true; // Any character stops the monitoring
+    }
     if (cmdBuffer.length() >= (RX_BUFFER_LEN - 1)) {
         cmdBuffer.resize(0); // Truncate it
     }
@@ -84,11 +52,22 @@ static bool UserUartRcvHandler(uint8_t ch)
     return ready;
 }
 
+/**
+ * Check if any character received from the host since the last call
+ * @return true if received
+ */
+bool AdptCheckHostInput()
+{
+    bool val = HostInput;
+    HostInput = false;
+    return val;
+}
+
 /**
  * Send string to UART
  * @param[in] str String to send
  */
-void AdptSendString(const util::string& str)
+void AdptSendString(string_view str)
 {
     glblUart->send(str);
 }
@@ -114,15 +93,13 @@ static void AdapterRun()
         else {
             AdptCheckHeartBeat();
         }
-        __WFI(); // goto sleep
+        AdptSleep(); // goto sleep
     }
 }
 
 int main(void)
 {
-    SystemCoreClockUpdate();
-    
-    SetAllRegisters();
+    AdptHardwareInit();
     AdapterRun();
 }
 
@@ -15,7 +15,7 @@ const uint64_t onebit = 1;
 // Configuration settings, storing/retrieving properties
 //
 
-AdapterConfig::AdapterConfig() : values_(0)
+AdapterConfig::AdapterConfig() : values_(0), version_(0), numObservers_(0)
 {
     memset(intProps_, 0, sizeof(intProps_));
 }
@@ -25,6 +25,7 @@ void AdapterConfig::setBoolProperty(int id, bool val)
     if (id > 64) 
         return;
     values_ = val ? (values_ | (onebit << id)) : (values_ & ~(onebit << id));
+    notify(id);
 }
 
 bool AdapterConfig::getBoolProperty(int id) const
@@ -38,6 +39,7 @@ void AdapterConfig::setIntProperty(int id, uint32_t val)
 {
     int idx = id - INT_PROPS_START;
     intProps_[idx] = val;
+    notify(id);
 }
 
 uint32_t AdapterConfig::getIntProperty(int id) const
@@ -50,6 +52,7 @@ void AdapterConfig::setBytesProperty(int id, const ByteArray* bytes)
 {
     int idx = id - BYTES_PROPS_START;
     bytesProps_[idx] = *bytes;
+    notify(id);
 }
 
 const ByteArray* AdapterConfig::getBytesProperty(int id) const
@@ -58,6 +61,29 @@ const ByteArray* AdapterConfig::getBytesProperty(int id) const
     return &bytesProps_[idx];
 }
 
+//
+// Register the observer to be called on every property change,
+// the observers are kept for the lifetime of the adapter
+//
+bool AdapterConfig::addObserver(ConfigObserver* observer)
+{
+    if (numObservers_ >= OBSERVERS_LEN) 
+        return false;
+    observers_[numObservers_++] = observer;
+    return true;
+}
+
+//
+// Bump the version and let the observers rebuild their cached values
+//
+void AdapterConfig::notify(int id)
+{
+    version_++;
+    for (int i = 0; i < numObservers_; i++) {
+        observers_[i]->onConfigChange(id);
+    }
+}
+
 AdapterConfig* AdapterConfig::instance()
 {
     static AdapterConfig instance;
@@ -21,6 +21,10 @@ const int OBD_IN_MSG_LEN  = OBD_IN_MSG_DLEN + 5; // 7 data + 4 header + 1 reserv
 const int RX_BUFFER_LEN   = 100; 
 const int RX_CMD_LEN      = 20;         // The incoming cmd
 const int USER_BUF_LEN    = RX_CMD_LEN; // The previous cmd
+const int REPLY_LEN       = 80;         // The reply line
+
+typedef util::fstring<RX_BUFFER_LEN> CmdString;
+typedef util::fstring<REPLY_LEN> ReplyString;
 
 //
 // Command dispatch values
@@ -60,6 +64,15 @@ enum AT_Requests {
     PAR_WARMSTART,
     PAR_WIRING_TEST,
     PAR_USE_AUTO_SP,
+    PAR_CONCURRENT_PROBE,
+    PAR_KWP_TIMING,
+    PAR_ORDERED_REPLY,
+    PAR_KW_CACHE,
+    PAR_VPW_HIGH_SPEED,
+    PAR_MONITOR,
+    PAR_BUS_STAT,
+    PAR_MEM_STAT,
+    PAR_PROF_STAT,
     // int properties
     PAR_CAN_CF = INT_PROPS_START,
     PAR_CAN_CM,
@@ -67,6 +80,7 @@ enum AT_Requests {
     PAR_ISO_INIT_ADDRESS,
     PAR_TIMEOUT,
     PAR_WAKEUP_VAL,
+    PAR_ISO_BAUD,
     // bytes properties
     PAR_HEADER_BYTES = BYTES_PROPS_START,
     PAR_WM_HEADER
@@ -81,11 +95,20 @@ struct ByteArray {
     uint8_t length;
 };
 
+// Configuration change observer, notified after the property is set
+//
+class ConfigObserver {
+public:
+    virtual void onConfigChange(int parameter) = 0;
+};
+
 // Configuration settings
 //
 class AdapterConfig {
 public:
     static AdapterConfig* instance();
+    bool     addObserver(ConfigObserver* observer);
+    uint32_t version() const { return version_; }
     void     setBoolProperty(int parameter, bool val);
     bool     getBoolProperty(int parameter) const;
     void     setIntProperty(int parameter,  uint32_t val);
@@ -96,9 +119,14 @@ private:
     const static int BYTE_PROP_LEN  = 10;
     const static int INT_PROP_LEN   = 10;
     const static int BYTES_PROP_LEN = 10;
+    const static int OBSERVERS_LEN  = 8;
 
     AdapterConfig();
+    void notify(int parameter);
     uint64_t   values_;
+    uint32_t   version_;
+    int        numObservers_;
+    ConfigObserver* observers_[OBSERVERS_LEN];
     uint8_t    byteProps_ [BYTE_PROP_LEN];
     uint32_t   intProps_  [INT_PROP_LEN];
     ByteArray  bytesProps_[BYTES_PROP_LEN];
@@ -118,13 +146,19 @@ union NumericType
     }
 };
 
-void AdptSendString(const util::string& str);
-void AdptSendReply(const util::string& str);
+void AdptSendString(util::string_view str);
+void AdptSendReply(util::string_view str);
 void AdptDispatcherInit();
 void AdptOnCmd(util::string& cmdString);
 void AdptCheckHeartBeat();
+bool AdptCheckHostInput();
 void AdptReadSerialNum();
+void AdptMemStatDisplay();
 void AdptPowerModeConfigure();
+void AdptHardwareInit();
+void AdptSleep();
+bool AdptReadStorage(uint32_t addr, void* data, uint32_t len);
+bool AdptWriteStorage(uint32_t addr, const void* data, uint32_t len);
 
 // Utilities
 void Delay1ms(uint32_t value);
@@ -133,8 +167,8 @@ void KWordsToString(const uint8_t* kw, util::string& str);
 void CanIDToString(uint32_t num, util::string& str, bool extended)
 ;
 
-uint32_t to_bytes(const util::string& str, uint8_t* bytes);
-void to_ascii(const uint8_t* bytes, uint32_t length, util::string& str);
+uint32_t to_bytes(util::string_view str, uint8_t* bytes);
+void to_ascii(const uint8_t* bytes, uint32_t length, util::string& str, char separator);
 
 // LEDs
 #define TX_LED(val) GPIOPinWrite(TX_LED_PORT, TX_LED_NUM, (~val) & 0x1)
@@ -12,6 +12,7 @@
 #include <algorithms.h>
 #include <CmdUart.h>
 #include <AdcDriver.h>
+#include <Profiler.h>
 
 using namespace util;
 
@@ -32,7 +33,7 @@ static const char Copyright3 [] = "warranty; not even for MERCHANTABILITY or FIT
  * @param[in] cmd Command line, ignored
  * @param[in[ par The number in dispatch table
  */
-static void OnSetValueTrue(const string& cmd, int par)
+static void OnSetValueTrue(string_view cmd, int par)
 {
     AdapterConfig::instance()->setBoolProperty(par, true);
     AdptSendReply(OkMessage);
@@ -43,7 +44,7 @@ static void OnSetValueTrue(const string& cmd, int par)
  * @param[in[ cmd Command line, ignored
  * @param[in] par The number in dispatch table
  */
-static void OnSetValueFalse(const string& cmd, int par)
+static void OnSetValueFalse(string_view cmd, int par)
 {
     AdapterConfig::instance()->setBoolProperty(par, false);
     AdptSendReply(OkMessage);
@@ -54,10 +55,11 @@ static void OnSetValueFalse(const string& cmd, int par)
  * @param[in] cmd Command line
  * @param[in] par The number in dispatch table
  */
-static void OnSetValueInt(const string& cmd, int par)
+static void OnSetValueInt(string_view cmd, int par)
 {
-    uint32_t val = stoul(cmd, 0, 16);
-    if (val != ULONG_MAX) {
+    uint32_t pos;
+    uint32_t val = stoul(cmd, &pos, 16);
+    if (pos == cmd.length()) {
         AdapterConfig::instance()->setIntProperty(par, val);
         AdptSendReply(OkMessage);
     }
@@ -66,24 +68,82 @@ static void OnSetValueInt(const string& cmd, int par)
     }    
 }
 
+/**
+ * Store the ISO baud rate
+ * @param[in] baud The baud rate
+ */
+static void SetIsoBaud(uint32_t baud)
+{
+    AdapterConfig::instance()->setIntProperty(PAR_ISO_BAUD, baud);
+    AdptSendReply(OkMessage);
+}
+
+/**
+ * Set ISO baud rate to 10400, "ATIB10"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnSetIsoBaud10(string_view cmd, int par)
+{
+    SetIsoBaud(10400);
+}
+
+/**
+ * Set ISO baud rate to 4800, "ATIB48"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnSetIsoBaud48(string_view cmd, int par)
+{
+    SetIsoBaud(4800);
+}
+
+/**
+ * Set ISO baud rate to 9600, "ATIB96"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnSetIsoBaud96(string_view cmd, int par)
+{
+    SetIsoBaud(9600);
+}
+
+/**
+ * Set any ISO baud rate as decimal number, "AT#IBxxxxx"
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnSetIsoBaud(string_view cmd, int par)
+{
+    const uint32_t MinBaud = 1200;
+    const uint32_t MaxBaud = 115200;
+    
+    uint32_t pos;
+    uint32_t val = stoul(cmd, &pos, 10);
+    if (pos == cmd.length() && val >= MinBaud && val <= MaxBaud) {
+        SetIsoBaud(val);
+    }
+    else {
+        AdptSendReply(ErrMessage);
+    }
+}
+
 /**
  * Store the byte sequence property
  * @param[in] cmd Command line
  * @param[in] par The number in dispatch table
  */
-static void OnSetBytes(const string& cmd, int par)
+static void OnSetBytes(string_view cmd, int par)
 {
-    string cmdData = cmd;
+    fstring<ByteArray::ARRAY_SIZE * 2> cmdData;
     bool sts = false;
     ByteArray bytes;
     
-    if (cmdData.length() == 3) {
-        cmdData = "0" + cmdData; //1.5 bytes
-        sts = to_bytes(cmdData, bytes.data);
-    }
-    else {
-        sts = to_bytes(cmdData, bytes.data);
+    if (cmd.length() == 3) {
+        cmdData = "0"; //1.5 bytes
     }
+    cmdData += cmd;
+    sts = to_bytes(cmdData, bytes.data);
     
     if (sts) {
         bytes.length = cmdData.length() / 2;
@@ -100,7 +160,7 @@ static void OnSetBytes(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSetOK(const string& cmd, int par)
+static void OnSetOK(string_view cmd, int par)
 {
     AdptSendReply(OkMessage);
 }
@@ -110,7 +170,7 @@ static void OnSetOK(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSendReplyCopyright(const string& cmd, int par)
+static void OnSendReplyCopyright(string_view cmd, int par)
 {
     AdptSendReply(Copyright);
     AdptSendReply(Copyright2);
@@ -122,7 +182,7 @@ static void OnSendReplyCopyright(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnWiringTest(const string& cmd, int par)
+static void OnWiringTest(string_view cmd, int par)
 {
     OBDProfile::instance()->wiringCheck();
 }
@@ -132,7 +192,7 @@ static void OnWiringTest(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnGetSerial(const string& cmd, int par)
+static void OnGetSerial(string_view cmd, int par)
 {
     AdptReadSerialNum();
 }
@@ -142,7 +202,7 @@ static void OnGetSerial(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSendReplyVersion(const string& cmd, int par)
+static void OnSendReplyVersion(string_view cmd, int par)
 {
     AdptSendReply(Version);
 }
@@ -152,7 +212,7 @@ static void OnSendReplyVersion(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnBufferDump(const string& cmd, int par)
+static void OnBufferDump(string_view cmd, int par)
 {
     OBDProfile::instance()->dumpBuffer();    
 }
@@ -167,8 +227,10 @@ static void SetDefault()
     config->setBoolProperty(PAR_LINEFEED, true);
     config->setBoolProperty(PAR_ECHO, true);
     config->setBoolProperty(PAR_SPACES, true);
+    config->setBoolProperty(PAR_CONCURRENT_PROBE, true);
     config->setIntProperty(PAR_TIMEOUT, 0);
     config->setIntProperty(PAR_ISO_INIT_ADDRESS, 0x33);
+    config->setIntProperty(PAR_ISO_BAUD, 0);
     AdptSendReply(OkMessage);
 }
 
@@ -177,7 +239,7 @@ static void SetDefault()
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSetDefault(const string& cmd, int par) 
+static void OnSetDefault(string_view cmd, int par) 
 {
     SetDefault();
     AdptSendReply(OkMessage);
@@ -188,7 +250,7 @@ static void OnSetDefault(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnProtocolDescribe(const string& cmd, int par)
+static void OnProtocolDescribe(string_view cmd, int par)
 {    
     OBDProfile::instance()->getProtocolDescription(); 
 }
@@ -198,7 +260,7 @@ static void OnProtocolDescribe(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnProtocolDescribeNum(const string& cmd, int par)
+static void OnProtocolDescribeNum(string_view cmd, int par)
 {
     OBDProfile::instance()->getProtocolDescriptionNum(); 
 }
@@ -208,7 +270,7 @@ static void OnProtocolDescribeNum(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnProtocolClose(const string& cmd, int par) 
+static void OnProtocolClose(string_view cmd, int par) 
 {
     OBDProfile::instance()->closeProtocol();
 }
@@ -218,17 +280,111 @@ static void OnProtocolClose(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnKwDisplay(const string& cmd, int par) 
+static void OnKwDisplay(string_view cmd, int par) 
 {
     OBDProfile::instance()->kwDisplay();
 }
 
+/**
+ * Display J1850 PWM transmit/collision statistics, "AT#CS"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnBusStatDisplay(string_view cmd, int par)
+{
+    OBDProfile::instance()->busStatDisplay();
+}
+
+/**
+ * Display the RAM usage and message pools, "AT#MEM"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMemStatDisplay(string_view cmd, int par)
+{
+    static const char* const PoolNames[] = { "ISO9141", "ISO14230", "PWM", "VPW" };
+    char out[64];
+    
+    AdptMemStatDisplay();
+    for (uint8_t type = Ecumsg::ISO9141; type <= Ecumsg::VPW; type++) {
+        const EcumsgPoolStats* pool = Ecumsg::poolStats(type);
+        sprintf(out, "%s POOL:%u/%u PEAK:%u EXH:%u", PoolNames[type - 1], pool->used,
+                pool->size, pool->peak, pool->exhausted);
+        AdptSendReply(out);
+    }
+}
+
+/**
+ * Display and reset the profiling zones, "AT#PRF". The table is copied first
+ * as the output is going through the zones being displayed.
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnProfStatDisplay(string_view cmd, int par)
+{
+    static const char* const ZoneNames[] = {
+        "ONCMD", "TOBYTES", "TOASCII", "CANREAD", "CANRECV", "CMDSEND",
+        "ISRCAN", "ISRCMD", "ISRECU", "ISRSCT", "ISRRIT", "ISRMRT"
+    };
+    static_assert(sizeof(ZoneNames) / sizeof(ZoneNames[0]) == PROF_ZONES_LEN, "Zone names");
+    ProfZoneStats zones[PROF_ZONES_LEN];
+    char out[64];
+    
+    Profiler::takeStats(zones);
+    for (int i = 0; i < PROF_ZONES_LEN; i++) {
+        const ProfZoneStats& zone = zones[i];
+        if (!zone.count)
+            continue;
+        sprintf(out, "%s N:%u AVG:%u MIN:%u MAX:%u", ZoneNames[i], (unsigned)zone.count,
+                (unsigned)(zone.total / zone.count), (unsigned)zone.min, (unsigned)zone.max);
+        AdptSendReply(out);
+    }
+}
+
+/**
+ * Monitor all the bus messages, "ATMA"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorAll(string_view cmd, int par)
+{
+    OBDProfile::instance()->monitor(MON_ALL, 0);
+}
+
+/**
+ * Monitor the messages for the receiver address, "ATMR"
+ * @param[in] cmd Command line, the receiver address
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorReceiver(string_view cmd, int par)
+{
+    if (!is_xdigits(cmd)) {
+        AdptSendReply(ErrMessage);
+        return;
+    }
+    OBDProfile::instance()->monitor(MON_RECEIVER, stoul(cmd, 0, 16));
+}
+
+/**
+ * Monitor the messages from the transmitter address, "ATMT"
+ * @param[in] cmd Command line, the transmitter address
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorTransmitter(string_view cmd, int par)
+{
+    if (!is_xdigits(cmd)) {
+        AdptSendReply(ErrMessage);
+        return;
+    }
+    OBDProfile::instance()->monitor(MON_TRANSMITTER, stoul(cmd, 0, 16));
+}
+
 /**
  * Read the car voltage level, "ATRV"
  * @param[in] cmd Command line, ignored
  * @param]in] par The number in dispatch table, ignored
  */
-static void OnReadVoltage(const string& cmd, int par) 
+static void OnReadVoltage(string_view cmd, int par) 
 {
     const uint32_t actualVoltage = 1212;
     const uint32_t adcDivdr = 0x0A54;
@@ -250,7 +406,7 @@ static void OnReadVoltage(const string& cmd, int par)
  * @param[in] cmd Command line
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSetProtocol(const string& cmd, int par)
+static void OnSetProtocol(string_view cmd, int par)
 {
     bool useAutoSP = false;
     uint8_t protocol = 0;
@@ -278,7 +434,7 @@ static void OnSetProtocol(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnSendReplyInterface(const string& cmd, int par)
+static void OnSendReplyInterface(string_view cmd, int par)
 {
     AdptSendReply(Interface);
 }
@@ -288,13 +444,13 @@ static void OnSendReplyInterface(const string& cmd, int par)
  * @param[in] cmd Command line, ignored
  * @param[in] par The number in dispatch table, ignored
  */
-static void OnReset(const string& cmd, int par) 
+static void OnReset(string_view cmd, int par) 
 {
     SetDefault();
     AdptSendReply(Interface);
 }
 
-typedef void (*ParCallbackT)(const string& cmd, int par);
+typedef void (*ParCallbackT)(string_view cmd, int par);
 
 struct DispatchType {
     const char* name;
@@ -304,9 +460,26 @@ struct DispatchType {
     ParCallbackT callback;
 };
 
-static const DispatchType dispatchTbl[] = {
+//
+// Sorted by name, the lookup walks it as a prefix tree
+//
+static constexpr DispatchType dispatchTbl[] = {
     { "#1",   PAR_CHIP_COPYRIGHT,    0, 0, OnSendReplyCopyright   },
     { "#3",   PAR_WIRING_TEST,       0, 0, OnWiringTest           },
+    { "#CP0", PAR_CONCURRENT_PROBE,  0, 0, OnSetValueFalse        },
+    { "#CP1", PAR_CONCURRENT_PROBE,  0, 0, OnSetValueTrue         },
+    { "#CS",  PAR_BUS_STAT,          0, 0, OnBusStatDisplay       },
+    { "#HS0", PAR_VPW_HIGH_SPEED,    0, 0, OnSetValueFalse        },
+    { "#HS1", PAR_VPW_HIGH_SPEED,    0, 0, OnSetValueTrue         },
+    { "#IB",  PAR_ISO_BAUD,          4, 6, OnSetIsoBaud           },
+    { "#KC0", PAR_KW_CACHE,          0, 0, OnSetValueFalse        },
+    { "#KC1", PAR_KW_CACHE,          0, 0, OnSetValueTrue         },
+    { "#KT0", PAR_KWP_TIMING,        0, 0, OnSetValueFalse        },
+    { "#KT1", PAR_KWP_TIMING,        0, 0, OnSetValueTrue         },
+    { "#MEM", PAR_MEM_STAT,          0, 0, OnMemStatDisplay       },
+    { "#PRF", PAR_PROF_STAT,         0, 0, OnProfStatDisplay      },
+    { "#RO0", PAR_ORDERED_REPLY,     0, 0, OnSetValueFalse        },
+    { "#RO1", PAR_ORDERED_REPLY,     0, 0, OnSetValueTrue         },
     { "#RSN", PAR_GET_SERIAL,        0, 0, OnGetSerial            },
     { "@1",   PAR_VERSION,           0, 0, OnSendReplyVersion     },
     { "AL",   PAR_ALLOW_LONG,        0, 0, OnSetValueTrue         },
@@ -329,6 +502,9 @@ static const DispatchType dispatchTbl[] = {
     { "H0",   PAR_HEADER_SHOW,       0, 0, OnSetValueFalse        },
     { "H1",   PAR_HEADER_SHOW,       0, 0, OnSetValueTrue         },
     { "I",    PAR_INFO,              0, 0, OnSendReplyInterface   },
+    { "IB10", PAR_ISO_BAUD,          0, 0, OnSetIsoBaud10         },
+    { "IB48", PAR_ISO_BAUD,          0, 0, OnSetIsoBaud48         },
+    { "IB96", PAR_ISO_BAUD,          0, 0, OnSetIsoBaud96         },
     { "IIA",  PAR_ISO_INIT_ADDRESS,  2, 2, OnSetValueInt          },
     { "KW",   PAR_KW_DISPLAY,        0, 0, OnKwDisplay            },
     { "KW0",  PAR_KW_CHECK,          0, 0, OnSetValueFalse        },
@@ -337,6 +513,9 @@ static const DispatchType dispatchTbl[] = {
     { "L1",   PAR_LINEFEED,          0, 0, OnSetValueTrue         },
     { "M0",   PAR_MEMORY,            0, 0, OnSetValueFalse        },
     { "M1",   PAR_MEMORY,            0, 0, OnSetValueTrue         },
+    { "MA",   PAR_MONITOR,           0, 0, OnMonitorAll           },
+    { "MR",   PAR_MONITOR,           2, 2, OnMonitorReceiver      },
+    { "MT",   PAR_MONITOR,           2, 2, OnMonitorTransmitter   },
     { "NL",   PAR_ALLOW_LONG,        0, 0, OnSetValueFalse        },
     { "PC",   PAR_PROTOCOL_CLOSE,    0, 0, OnProtocolClose        },
     { "RV",   PAR_READ_VOLT,         0, 0, OnReadVoltage          },
@@ -353,58 +532,124 @@ static const DispatchType dispatchTbl[] = {
     { "Z",    PAR_RESET_CPU,         0, 0, OnReset                }
 };
 
-static bool ValidateArgLength(const DispatchType& entry, const string& arg)
+const int DispatchTblLen = sizeof(dispatchTbl) / sizeof(dispatchTbl[0]);
+
+constexpr bool NameNotGreater(const char* a, const char* b)
+{
+    return (*a != *b) ? (static_cast<uint8_t>(*a) < static_cast<uint8_t>(*b)) : (*a == 0 || NameNotGreater(a + 1, b + 1));
+}
+
+constexpr bool DispatchTblSorted(int i)
+{
+    return (i + 1 >= DispatchTblLen) || (NameNotGreater(dispatchTbl[i].name, dispatchTbl[i + 1].name) && DispatchTblSorted(i + 1));
+}
+
+static_assert(DispatchTblSorted(0), "dispatchTbl is not sorted by name");
+
+static bool ValidateArgLength(const DispatchType& entry, string_view arg)
 {
     int len = arg.length();
     return len >= entry.minParNum && len <= entry.maxParNum;
 }
 
 /**
- * Dispatch the AT command to the proper handler with particular type
- * @param[in] cmdString Command line
- * @return true if command was dispatched, false otherwise
+ * Narrow the table range to the entries with the given character at the position,
+ * all the entries in range have the same preceding characters
+ * @param[in,out] lo The range start
+ * @param[in,out] hi The range end
+ * @param[in] pos The character position
+ * @param[in] ch The character
+ */
+static void NarrowRange(int& lo, int& hi, uint32_t pos, uint8_t ch)
+{
+    int l = lo, h = hi;
+    while (l < h) { // Lower bound
+        int m = (l + h) / 2;
+        if (static_cast<uint8_t>(dispatchTbl[m].name[pos]) < ch)
+            l = m + 1;
+        else
+            h = m;
+    }
+    lo = l;
+    for (h = hi; l < h;) { // Upper bound
+        int m = (l + h) / 2;
+        if (static_cast<uint8_t>(dispatchTbl[m].name[pos]) <= ch)
+            l = m + 1;
+        else
+            h = m;
+    }
+    hi = l;
+}
+
+/**
+ * Get the end of the range entries with the name length equal to the position,
+ * they are always in front of the range
+ * @param[in] lo The range start
+ * @param[in] hi The range end
+ * @param[in] pos The character position
+ * @return The end index
  */
-static bool DispatchATCmd(const string& cmdString, int numOfChar, int type)
+static int NameEndRange(int lo, int hi, uint32_t pos)
 {
-     // Ignore first two "AT" chars
-    string atcmd = (type == 0) ? cmdString.substr(2) : cmdString.substr(2, numOfChar); 
+    while (lo < hi && dispatchTbl[lo].name[pos] == 0)
+        lo++;
+    return lo;
+}
 
-    for (int i = 0; i < sizeof(dispatchTbl)/sizeof(dispatchTbl[0]); i++) {
+/**
+ * Call the handler of the first entry in range that matches the type and argument length
+ * @param[in] lo The range start
+ * @param[in] hi The range end
+ * @param[in] arg The command argument
+ * @param[in] type 0 for the exact match, 1 for the command with argument
+ * @return true if command was dispatched, false otherwise
+ */
+static bool CallHandler(int lo, int hi, string_view arg, int type)
+{
+    for (int i = lo; i < hi; i++) {
         int cmdType = (dispatchTbl[i].minParNum > 0) ? 1 : 0;
-        
-        if ((cmdType == type) && (atcmd == dispatchTbl[i].name)) {
-            string arg = (type == 1) ? cmdString.substr(numOfChar + 2) : "";
-            
-            // Argument length validation if we have argument
-            if (type && !ValidateArgLength(dispatchTbl[i], arg)) {
-                continue;
-            }
-            
-            // Have callback?
-            if (!dispatchTbl[i].callback)
-                return false;
-            
-            dispatchTbl[i].callback(arg, dispatchTbl[i].id);
-            return true;
-        }
+        if (cmdType != type)
+            continue;
+        // Argument length validation if we have argument
+        if (type && !ValidateArgLength(dispatchTbl[i], arg))
+            continue;
+        // Have callback?
+        if (!dispatchTbl[i].callback)
+            return false;
+        dispatchTbl[i].callback(arg, dispatchTbl[i].id);
+        return true;
     }
     return false;
 }
 
 /**
- * Parse and dispatch AT sequence
- * @param[in] cmdString The user command 
- * @return true if command was parsed, false otherwise
+ * Dispatch the AT command to the proper handler in a single pass. The exact match
+ * goes first, then three and two char sequence prefixes with argument, like "ATSH".
+ * @param[in] cmdString Command line
+ * @return true if command was dispatched, false otherwise
  */
-static bool ParseGenericATCmd(const string& cmdString)
+static bool DispatchATCmd(string_view cmdString)
 {
-    bool dispatched = DispatchATCmd(cmdString, 4, 0); // Do exact string match, like "AT#DP" 
-    if (dispatched)
+    string_view atcmd = cmdString.substr(2); // Ignore first two "AT" chars
+    int prefixLo[4] = { 0 }, prefixHi[4] = { 0 };
+    int lo = 0, hi = DispatchTblLen;
+    uint32_t pos = 0;
+    
+    for (;; pos++) {
+        if (pos == 2 || pos == 3) { // Remember the prefix candidates
+            prefixLo[pos] = lo;
+            prefixHi[pos] = NameEndRange(lo, hi, pos);
+        }
+        if (pos == atcmd.length() || lo == hi)
+            break;
+        NarrowRange(lo, hi, pos, atcmd[pos]);
+    }
+    
+    if (pos == atcmd.length() && CallHandler(lo, NameEndRange(lo, hi, pos), string_view(), 0))
         return true;
-    dispatched = DispatchATCmd(cmdString, 3, 1); // Three char sequence prefixes
-    if (dispatched)
+    if (CallHandler(prefixLo[3], prefixHi[3], atcmd.substr(3), 1))
         return true;
-    return DispatchATCmd(cmdString, 2, 1); // Two char sequence prefixes
+    return CallHandler(prefixLo[2], prefixHi[2], atcmd.substr(2), 1);
 }
 
 /**
@@ -413,7 +658,8 @@ static bool ParseGenericATCmd(const string& cmdString)
  */
 void AdptOnCmd(string& cmdString)
 {
-    static string PreviousCmd(USER_BUF_LEN);
+    ProfileScope profile(PROF_ON_CMD);
+    static CmdString PreviousCmd;
     bool succeeded = false;
     
     // Compress and convert to uppercase 
@@ -436,7 +682,7 @@ void AdptOnCmd(string& cmdString)
         }
     }
     else { // AT sequence
-        succeeded = ParseGenericATCmd(cmdString); // String cmd->numeric
+        succeeded = DispatchATCmd(cmdString); // String cmd->numeric
     }
     
     if (!succeeded) {
@@ -466,9 +712,9 @@ void AdptCheckHeartBeat()
  * Send out string with <CR><LF>
  * @param[in] str String to send
  */
-void AdptSendReply(const string& str)
+void AdptSendReply(string_view str)
 {
-    string s = str;
+    fstring<REPLY_LEN + 2> s(str);
     if (AdapterConfig::instance()->getBoolProperty(PAR_LINEFEED)) {
         s += "\r\n";
         AdptSendString(s);
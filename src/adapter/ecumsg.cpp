@@ -7,93 +7,13 @@
 
 #include <adaptertypes.h>
 #include <algorithms.h>
+#include <checksum.h>
 #include "ecumsg.h"
 
 using namespace util;
 
 const int HEADER_SIZE = 3;
 
-class EcumsgISO9141 : public Ecumsg {
-    friend class Ecumsg;
-public:
-    virtual void addHeaderAndChecksum();
-    virtual bool stripHeaderAndChecksum();
-private:
-    EcumsgISO9141(uint32_t size) : Ecumsg(ISO9141, size) {
-        const uint8_t header[] = { 0x68, 0x6A, 0xF1 };
-        memcpy(header_, header, sizeof(header));
-    }
-};
-
-class EcumsgISO14230 : public Ecumsg {
-    friend class Ecumsg;
-public:
-    virtual void addHeaderAndChecksum();
-    virtual bool stripHeaderAndChecksum();
-private:    
-    EcumsgISO14230(uint32_t size) : Ecumsg(ISO14230, size) {
-        const uint8_t header[] = { 0xC0, 0x33, 0xF1 };
-        memcpy(header_, header, sizeof(header));
-    }
-};
-
-class EcumsgVPW : public Ecumsg {
-    friend class Ecumsg;
-public:
-    virtual void addHeaderAndChecksum();
-    virtual bool stripHeaderAndChecksum();
-private:    
-    EcumsgVPW(uint32_t size) : Ecumsg(VPW, size) {
-        const uint8_t header[] = { 0x68, 0x6A, 0xF1 };
-        memcpy(header_, header, sizeof(header));
-    }
-};
-
-class EcumsgPWM : public Ecumsg {
-    friend class Ecumsg;    
-public:
-    virtual void addHeaderAndChecksum();
-    virtual bool stripHeaderAndChecksum();
-private:
-    EcumsgPWM(uint32_t size) : Ecumsg(PWM, size) {
-        const uint8_t header[] = { 0x61, 0x6A, 0xF1 };
-        memcpy(header_, header, sizeof(header));
-    }
-};
-
-/**
- * Factory method for adapter protocol messages
- * @param[in] type Message type
- * @return The message instance 
- */
-Ecumsg* Ecumsg::instance(uint8_t type)
-{
-    const uint32_t size = 255;
-    Ecumsg* instance = 0;
-    switch(type) {
-        case ISO9141:
-            instance = new EcumsgISO9141(size);
-            break;
-        case ISO14230:
-            instance = new EcumsgISO14230(size);
-            break;
-        case VPW:
-            instance = new EcumsgVPW(size);
-            break;
-        case PWM:
-            instance = new EcumsgPWM(size);
-            break;
-    }
-    
-    if (instance) {
-        // if header
-        const ByteArray* bytes = AdapterConfig::instance()->getBytesProperty(PAR_HEADER_BYTES);
-        if (bytes->length)
-            instance->setHeader(bytes->data);
-    }
-    return instance;
-}
-
 /**
  *  Adds the checksum to ISO 9141/14230 message
  *  @param[in,out] data Data bytes
@@ -101,11 +21,8 @@ Ecumsg* Ecumsg::instance(uint8_t type)
  */
 static void IsoAddChecksum(uint8_t* data, uint8_t& length)
 {
-    uint8_t sum = 0;
-    for (int i = 0; i < length; i++) {
-        sum += data[i];
-    }
-    data[length++] = sum;
+    data[length] = iso_checksum(data, length);
+    length++;
 }
 
 /**
@@ -126,189 +43,272 @@ static void StripHeader(uint8_t* data, uint8_t& length)
  */
 static void J1850AddChecksum(uint8_t* data, uint8_t& length)
 {
-    const uint8_t* ptr = data;
-    int len = length;
-    uint8_t chksum = 0xFF;  // start with all one's
-    
-    while (len--) {
-        int i = 8;
-        uint8_t val = *(ptr++);
-        while (i--) {
-            if (((val ^ chksum) & 0x80) != 0) {
-                chksum ^= 0x0E;
-                chksum = (chksum << 1) | 1;
-            } 
-            else {
-                chksum = chksum << 1;
-            }
-            val = val << 1;
-        }
-    }
-    data[length++] = ~chksum;
+    data[length] = crc8_j1850(data, length);
+    length++;
 }
 
 /**
- * Strip the checksum from J1850 message
- * @param[in,out] data Data bytes
- * @param[in,out] length Data length
+ * Validate the J1850 message CRC, the last byte
+ * @param[in] data Data bytes
+ * @param[in] length Data length
+ * @return true if valid, false otherwise
  */
-static void J1850StripChecksum(uint8_t* data, uint8_t& length)
+static bool J1850ChecksumValid(const uint8_t* data, uint8_t length)
 {
-    length--;
+    return length > HEADER_SIZE && crc8_j1850(data, length - 1) == data[length - 1];
+}
+
+/**
+ * Validate the ISO 9141/14230 message checksum, the last byte
+ * @param[in] data Data bytes
+ * @param[in] length Data length
+ * @return true if valid, false otherwise
+ */
+static bool IsoChecksumValid(const uint8_t* data, uint8_t length)
+{
+    return length > HEADER_SIZE && iso_checksum(data, length - 1) == data[length - 1];
 }
 
 /**
- * Strip the checksum from ISO 9141/1423 message
+ * Strip the checksum from ISO 9141/14230 or J1850 message
  * @param[in,out] data Data bytes
  * @param[in,out] length Data length
  */
-static void ISOStripChecksum(uint8_t* data, uint8_t& length)
+static void StripChecksum(uint8_t* data, uint8_t& length)
 {
     length--;
 }
 
 /**
- * Construct Ecumsg object
+ * Default header bytes and pool capacity by message type
  */
-Ecumsg::Ecumsg(uint8_t type, uint32_t size) : type_(type), length_(0), size_(size)
-{
-    data_ = new uint8_t[size];
-}
+template <uint8_t Type> struct EcumsgTraits;
+
+template <> struct EcumsgTraits<Ecumsg::ISO9141> {
+    static const uint8_t PoolSize = 2; // Request and keepalive
+    static const uint8_t Header[HEADER_SIZE];
+};
+const uint8_t EcumsgTraits<Ecumsg::ISO9141>::Header[HEADER_SIZE] = { 0x68, 0x6A, 0xF1 };
+
+template <> struct EcumsgTraits<Ecumsg::ISO14230> {
+    static const uint8_t PoolSize = 2; // Init request and timing negotiation, or request and keepalive
+    static const uint8_t Header[HEADER_SIZE];
+};
+const uint8_t EcumsgTraits<Ecumsg::ISO14230>::Header[HEADER_SIZE] = { 0xC0, 0x33, 0xF1 };
+
+template <> struct EcumsgTraits<Ecumsg::PWM> {
+    static const uint8_t PoolSize = 1;
+    static const uint8_t Header[HEADER_SIZE];
+};
+const uint8_t EcumsgTraits<Ecumsg::PWM>::Header[HEADER_SIZE] = { 0x61, 0x6A, 0xF1 };
+
+template <> struct EcumsgTraits<Ecumsg::VPW> {
+    static const uint8_t PoolSize = 1;
+    static const uint8_t Header[HEADER_SIZE];
+};
+const uint8_t EcumsgTraits<Ecumsg::VPW>::Header[HEADER_SIZE] = { 0x68, 0x6A, 0xF1 };
 
 /**
- * Destructor
+ * Statically allocated message pool, one per message type
  */
-Ecumsg::~Ecumsg()
-{
-    delete[] data_;
-}
+template <uint8_t Type>
+class EcumsgPool {
+public:
+    static Ecumsg* acquire();
+    static void release(Ecumsg* msg);
+    static EcumsgPoolStats stats;
+private:
+    typedef EcumsgTraits<Type> Traits;
+    static Ecumsg msgs_[Traits::PoolSize];
+    static bool   used_[Traits::PoolSize];
+};
+
+template <uint8_t Type> EcumsgPoolStats EcumsgPool<Type>::stats = { EcumsgTraits<Type>::PoolSize, 0, 0, 0 };
+template <uint8_t Type> Ecumsg EcumsgPool<Type>::msgs_[EcumsgTraits<Type>::PoolSize];
+template <uint8_t Type> bool   EcumsgPool<Type>::used_[EcumsgTraits<Type>::PoolSize];
 
 /**
- * Get the string representation of message bytes
- * @param[out] str The output string
+ * Take the free message from the pool
+ * @return The message instance, nullptr if the pool exhausted
  */
-void Ecumsg::toString(string& str) const
+template <uint8_t Type>
+Ecumsg* EcumsgPool<Type>::acquire()
 {
-    to_ascii(data_, length_, str);
+    for (int i = 0; i < Traits::PoolSize; i++) {
+        if (!used_[i]) {
+            used_[i] = true;
+            if (++stats.used > stats.peak)
+                stats.peak = stats.used;
+            msgs_[i].init(Type, Traits::Header);
+            return &msgs_[i];
+        }
+    }
+    stats.exhausted++;
+    return nullptr;
 }
 
 /**
- * Set the message data bytes
- * @param[in] data Data bytes
- * @param[in] length Data length
+ * Return the message to the pool
+ * @param[in] msg The message instance
  */
-void Ecumsg::setData(const uint8_t* data, uint8_t length)
+template <uint8_t Type>
+void EcumsgPool<Type>::release(Ecumsg* msg)
 {
-    length_ = length;
-    memcpy(data_, data, length);
+    int i = msg - msgs_;
+    if (i >= 0 && i < Traits::PoolSize && used_[i]) {
+        used_[i] = false;
+        stats.used--;
+    }
 }
 
 /**
- * Set header bytes
- * @param[in] header The header bytes
+ * Get the message from the pool for the given type
+ * @param[in] type Message type
+ * @return The message instance, nullptr if the pool exhausted
  */
-void Ecumsg::setHeader(const uint8_t* header)
+Ecumsg* Ecumsg::acquire(uint8_t type)
 {
-    memcpy(header_, header, sizeof(header_)); 
+    Ecumsg* msg = nullptr;
+    switch(type) {
+        case ISO9141:
+            msg = EcumsgPool<ISO9141>::acquire();
+            break;
+        case ISO14230:
+            msg = EcumsgPool<ISO14230>::acquire();
+            break;
+        case VPW:
+            msg = EcumsgPool<VPW>::acquire();
+            break;
+        case PWM:
+            msg = EcumsgPool<PWM>::acquire();
+            break;
+    }
+    
+    if (msg) {
+        // if header
+        const ByteArray* bytes = AdapterConfig::instance()->getBytesProperty(PAR_HEADER_BYTES);
+        if (bytes->length)
+            memcpy(msg->header_, bytes->data, sizeof(msg->header_));
+    }
+    return msg;
 }
 
 /**
- * Adds the header/checksum to ISO 9141 message
+ * Return the message to its pool, nullptr is ignored
+ * @param[in] msg The message instance
  */
-void EcumsgISO9141::addHeaderAndChecksum()
+void Ecumsg::release(Ecumsg* msg)
 {
-    // Shift data on 3 bytes to accommodate the header
-    memmove(&data_[HEADER_SIZE], &data_[0], length_);
-    length_ += HEADER_SIZE;
-    memcpy(&data_[0], header_, HEADER_SIZE);
-    
-    IsoAddChecksum(data_, length_);
+    if (!msg)
+        return;
+    switch(msg->type_) {
+        case ISO9141:
+            EcumsgPool<ISO9141>::release(msg);
+            break;
+        case ISO14230:
+            EcumsgPool<ISO14230>::release(msg);
+            break;
+        case VPW:
+            EcumsgPool<VPW>::release(msg);
+            break;
+        case PWM:
+            EcumsgPool<PWM>::release(msg);
+            break;
+    }
 }
 
 /**
- * Adds the header/checksum to ISO 14230 message
+ * Get the pool usage for the given message type
+ * @param[in] type Message type
+ * @return The pool statistics, nullptr for unknown type
  */
-void EcumsgISO14230::addHeaderAndChecksum()
+const EcumsgPoolStats* Ecumsg::poolStats(uint8_t type)
 {
-    // Shift data on 3 bytes to accommodate the header
-    memmove(&data_[HEADER_SIZE], &data_[0], length_);
-    uint8_t len = length_;
-    length_ += HEADER_SIZE;
-    memcpy(&data_[0], header_, HEADER_SIZE);
-    
-    // The length is in the 1st byte
-    data_[0] = (data_[0] & 0xC0) | len;
-    
-    IsoAddChecksum(data_, length_);
+    switch(type) {
+        case ISO9141:
+            return &EcumsgPool<ISO9141>::stats;
+        case ISO14230:
+            return &EcumsgPool<ISO14230>::stats;
+        case VPW:
+            return &EcumsgPool<VPW>::stats;
+        case PWM:
+            return &EcumsgPool<PWM>::stats;
+    }
+    return nullptr;
 }
 
 /**
- * Adds the header/checksum to J1850 VPW message
+ * Reset the message taken from the pool
+ * @param[in] type Message type
+ * @param[in] header The default header bytes
  */
-void EcumsgVPW::addHeaderAndChecksum()
+void Ecumsg::init(uint8_t type, const uint8_t* header)
 {
-    // Shift data on 3 bytes to accommodate the header
-    memmove(&data_[HEADER_SIZE], &data_[0], length_);
-    length_ += HEADER_SIZE;
-    memcpy(&data_[0], header_, HEADER_SIZE);
-    
-    J1850AddChecksum(data_, length_);
+    type_ = type;
+    length_ = 0;
+    memcpy(header_, header, sizeof(header_));
 }
 
 /**
- * Adds the header/checksum to J1850 PWM message
+ * Get the string representation of message bytes
+ * @param[out] str The output string
+ * @param[in] separator The character between bytes, 0 if none
  */
-void EcumsgPWM::addHeaderAndChecksum()
+void Ecumsg::toString(string& str, char separator) const
 {
-    // Shift data on 3 bytes to accommodate the header
-    memmove(&data_[HEADER_SIZE], &data_[0], length_);
-    length_ += HEADER_SIZE;
-    memcpy(&data_[0], header_, HEADER_SIZE);
-    
-    J1850AddChecksum(data_, length_);
+    to_ascii(data_, length_, str, separator);
 }
 
 /**
- * Strips the header/checksum from ISO 9141 message
- * @return true if header is valid, false otherwise
+ * Set the message data bytes
+ * @param[in] data Data bytes
+ * @param[in] length Data length
  */
-bool EcumsgISO9141::stripHeaderAndChecksum()
+void Ecumsg::setData(const uint8_t* data, uint8_t length)
 {
-    StripHeader(data_, length_);
-    ISOStripChecksum(data_, length_);
-    return true;
+    length_ = length;
+    memcpy(data_, data, length);
 }
 
 /**
- * Strips the header/checksum from ISO 14230 message
- * @return true if header is valid, false otherwise
+ * Adds the header/checksum to the message, ISO 14230 has the length in the 1st byte
  */
-bool EcumsgISO14230::stripHeaderAndChecksum()
+void Ecumsg::addHeaderAndChecksum()
 {
-    StripHeader(data_, length_);
-    ISOStripChecksum(data_, length_);
-    return true;
+    // Shift data on 3 bytes to accommodate the header
+    memmove(&data_[HEADER_SIZE], &data_[0], length_);
+    uint8_t len = length_;
+    length_ += HEADER_SIZE;
+    memcpy(&data_[0], header_, HEADER_SIZE);
+    
+    if (type_ == ISO14230) {
+        data_[0] = (data_[0] & 0xC0) | len;
+    }
+    
+    if (isJ1850())
+        J1850AddChecksum(data_, length_);
+    else
+        IsoAddChecksum(data_, length_);
 }
 
 /**
- * Strips the header/checksum from J1850 VPW message
- * @return true if header is valid, false otherwise
+ * Strips the header/checksum from the message
+ * @return true if checksum is valid, false otherwise
  */
-bool EcumsgVPW::stripHeaderAndChecksum()
+bool Ecumsg::stripHeaderAndChecksum()
 {
+    if (!checksumValid())
+        return false;
     StripHeader(data_, length_);
-    J1850StripChecksum(data_, length_);
+    StripChecksum(data_, length_);
     return true;
 }
 
 /**
- * Strips the header/checksum from J1850 PWM message
- * @return true if header is valid, false otherwise
+ * Validate the checksum of the message with header
+ * @return true if valid, false otherwise
  */
-bool EcumsgPWM::stripHeaderAndChecksum()
+bool Ecumsg::checksumValid() const
 {
-    StripHeader(data_, length_);
-    J1850StripChecksum(data_, length_);
-    return true;
+    return isJ1850() ? J1850ChecksumValid(data_, length_) : IsoChecksumValid(data_, length_);
 }
-
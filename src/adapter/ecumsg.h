@@ -13,34 +13,73 @@
 
 using namespace std;
 
+template <uint8_t Type> class EcumsgPool;
+
+//
+// The message pool usage, per protocol
+//
+struct EcumsgPoolStats {
+    uint8_t  size;      // Pool capacity
+    uint8_t  used;      // Messages currently acquired
+    uint8_t  peak;      // High watermark of used
+    uint16_t exhausted; // Failed acquire count
+};
+
+//
+// ECU message, the instances are statically allocated in per protocol pools
+// and obtained by acquire()/release() or EcumsgPtr handle, no heap involved
+//
 class Ecumsg {
+    template <uint8_t Type> friend class EcumsgPool;
 public:
 	const static uint8_t ISO9141  = 1;
 	const static uint8_t ISO14230 = 2;
 	const static uint8_t PWM      = 3;
 	const static uint8_t VPW      = 4;
+	const static uint32_t SIZE    = 255;
 	
-	static Ecumsg* instance(uint8_t type);
-    virtual ~Ecumsg();
+	static Ecumsg* acquire(uint8_t type);
+	static void release(Ecumsg* msg);
+	static const EcumsgPoolStats* poolStats(uint8_t type);
 	const uint8_t* data() const { return data_; }
     uint8_t* data() { return data_; }
 	uint8_t type() const { return type_; }
 	uint8_t length() const { return length_; }
     void length(uint8_t length) { length_ = length; }
-	virtual void addHeaderAndChecksum() = 0;
-	virtual bool stripHeaderAndChecksum() = 0;
+	void addHeaderAndChecksum();
+	bool stripHeaderAndChecksum();
+	bool checksumValid() const;
 	Ecumsg& operator+=(uint8_t byte) { data_[length_++] = byte; return *this; }
 	void setData(const uint8_t* data, uint8_t length);
-	void toString(util::string& str) const;
-protected:
-	Ecumsg(uint8_t type, uint32_t size);
-	void setHeader(const uint8_t* data);
+	void toString(util::string& str, char separator) const;
+private:
+	Ecumsg() : type_(0), length_(0) {}
+	Ecumsg(const Ecumsg&);
+	Ecumsg& operator=(const Ecumsg&);
+	void init(uint8_t type, const uint8_t* header);
+	bool isJ1850() const { return type_ == PWM || type_ == VPW; }
 	
-	uint8_t* data_;
+	uint8_t data_[SIZE];
 	uint8_t type_;
     uint8_t length_;
-	uint8_t size_;
 	uint8_t header_[3];
 };
 
+//
+// Scoped owner of the pooled message, released on the scope exit
+//
+class EcumsgPtr {
+public:
+    explicit EcumsgPtr(uint8_t type) : msg_(Ecumsg::acquire(type)) {}
+    explicit EcumsgPtr(Ecumsg* msg) : msg_(msg) {}
+    ~EcumsgPtr() { Ecumsg::release(msg_); }
+    Ecumsg* get() const { return msg_; }
+    Ecumsg* operator->() const { return msg_; }
+    Ecumsg& operator*() const { return *msg_; }
+private:
+    EcumsgPtr(const EcumsgPtr&);
+    EcumsgPtr& operator=(const EcumsgPtr&);
+    Ecumsg* msg_;
+};
+
 #endif //__ECUMSG_H__
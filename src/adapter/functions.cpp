@@ -6,10 +6,11 @@
  */
 
 #include <climits>
-#include <LPC15xx.h>
 #include <lstring.h>
 #include <algorithms.h>
+#include <hexconv.h>
 #include <adaptertypes.h>
+#include <Profiler.h>
 
 using namespace std;
 using namespace util;
@@ -47,41 +48,6 @@ void CanIDToString(uint32_t num, string& str, bool extended)
     }
 }
 
-/**
- * Delay for number of milliseconds using SysTick timer
- * @param[in] value The number of millisecond to delay
- */
-void Delay1ms(uint32_t value)
-{
-    if (value == 0) return;
-    
-    // Use the SysTick to generate the timeout in msecs
-    SysTick->LOAD = value * (SystemCoreClock / 1000);
-    SysTick->VAL  = 0;
-    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
-
-    while (!(SysTick->CTRL & 0x10000)) {
-        ;
-    }
-}
-
-/**
- * Delay for number of microseconds using SysTick timer
- * @param[in] value The number of microseconds to delay
- */
-void Delay1us(uint32_t value)
-{
-    const uint32_t AdjustValue = 50;
-    // Use the SysTick to generate the timeout in us
-    SysTick->LOAD = value * (SystemCoreClock / 1000000) - AdjustValue;
-    SysTick->VAL  = 0;
-    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
-
-    while (!(SysTick->CTRL & 0x10000)) {
-        ;
-    }
-}
-
 /**
  * Binary/ASCII ISO 9141/14230 key words conversion
  * @param[in] kw Keyword byte to convert
@@ -105,42 +71,33 @@ void KWordsToString(const uint8_t* kw, string& str)
  * @param[out] bytes The result as sequence of bytes
  * @return The length of output
  **/
-uint32_t to_bytes(const string& str, uint8_t* bytes)
+uint32_t to_bytes(string_view str, uint8_t* bytes)
 {
-    int len = str.length();
-    
-    if ((len % 2) != 0)
-        return 0;
-    
-    int j = 0;
-    for (int i = 0; i < len / 2; i++) {
-        uint32_t hexValue = stoul(str.substr(j, 2), 0, 16);
-        if (hexValue == ULONG_MAX)
-            return 0;
-        bytes[i] = hexValue;
-        j += 2;
-    }
-    return len / 2;
+    ProfileScope profile(PROF_TO_BYTES);
+    return hex_decode(str.data(), str.length(), bytes);
 }
 
 
 /**
- * Generic binary to string conversion function.
+ * Binary to string conversion with the given separator
  * @param[in] bytes The byte array to convert
  * @param[in] length The buffer length
  * @param[out] str The output string
+ * @param[in] separator The character between bytes, 0 if none
  **/
-void to_ascii(const uint8_t* bytes, uint32_t length, string& str)
+void to_ascii(const uint8_t* bytes, uint32_t length, string& str, char separator)
 {
-    bool useSpaces = AdapterConfig::instance()->getBoolProperty(PAR_SPACES);
-    for (int i = 0; i < length; i++) {
-        str += to_ascii(bytes[i] >> 4);
-        str += to_ascii(bytes[i] & 0x0F);
-        if (useSpaces) {
-            str += ' ';
+    ProfileScope profile(PROF_TO_ASCII);
+    const uint32_t ChunkLen = 16;
+    char buf[ChunkLen * 3 + 1];
+    
+    while (length > 0) {
+        uint32_t len = (length < ChunkLen) ? length : ChunkLen;
+        str.append(buf, hex_encode(bytes, len, buf, separator));
+        bytes += len;
+        length -= len;
+        if (length > 0 && separator) {
+            str += separator;
         }
     }
-    if (useSpaces && str.length() > 0) {
-        str.resize(str.length() - 1); // Truncate the last space
-    }
 }
@@ -6,6 +6,21 @@
  */
 
 #include "autoadapter.h"
+#include "isoserial.h"
+
+// The longest P2 timeout the bus probe can take within 5bps bit interval
+const uint32_t MAX_PROBE_TIMEOUT = 100;
+
+// K-line idle time before the next 5bps init, W5
+const uint32_t W5_TIMEOUT = 300;
+
+// The adapters to probe while K-line is busy with 5bps init
+static const int ProbeAdapters[] = { ADPTR_PWM, ADPTR_VPW, ADPTR_CAN, ADPTR_CAN_EXT };
+static const int ProbeAdaptersNum = sizeof(ProbeAdapters) / sizeof(ProbeAdapters[0]);
+
+int  AutoAdapter::probeNum_;
+int  AutoAdapter::probeProtocol_;
+bool AutoAdapter::sendReply_;
 
 void AutoAdapter::getDescription()
 {
@@ -23,6 +38,16 @@ int AutoAdapter::onRequest(const uint8_t* data, int len)
 }
 
 int AutoAdapter::onConnectEcu(bool sendReply)
+{
+    return isConcurrentProbe() ? onConnectEcuConcurrent(sendReply) : onConnectEcuSequential(sendReply);
+}
+
+/**
+ * Probe the protocols one after another
+ * @param[in] sendReply Send reply flag
+ * @return The protocol number if connected, 0 otherwise
+ */
+int AutoAdapter::onConnectEcuSequential(bool sendReply)
 {
     // PWM
     int protocol = ProtocolAdapter::getAdapter(ADPTR_PWM)->onConnectEcu(sendReply);
@@ -47,3 +72,61 @@ int AutoAdapter::onConnectEcu(bool sendReply)
         return protocol;
     return 0;
 }
+
+/**
+ * Start K-line init and probe J1850 and CAN during 5bps bit intervals,
+ * use the first protocol answered
+ * @param[in] sendReply Send reply flag
+ * @return The protocol number if connected, 0 otherwise
+ */
+int AutoAdapter::onConnectEcuConcurrent(bool sendReply)
+{
+    IsoSerialAdapter* isoAdapter = static_cast<IsoSerialAdapter*>(ProtocolAdapter::getAdapter(ADPTR_ISO));
+
+    probeNum_ = 0;
+    probeProtocol_ = 0;
+    sendReply_ = sendReply;
+
+    isoAdapter->setProbeCallback(ProbeCallback);
+    int protocol = isoAdapter->onConnectEcu(sendReply);
+    isoAdapter->setProbeCallback(nullptr);
+
+    if (probeProtocol_ != 0)
+        return probeProtocol_;
+    if (protocol != 0)
+        return protocol;
+    
+    // K-line init is over before all probes got their turn
+    while (probeNum_ < ProbeAdaptersNum) {
+        if (ProbeCallback())
+            break;
+    }
+    if (probeProtocol_ != 0 || !isoAdapter->probeOverrun())
+        return probeProtocol_;
+    
+    // The probe stretched 5bps bit and the init was aborted, repeat it without probing
+    Delay1ms(W5_TIMEOUT);
+    return isoAdapter->onConnectEcu(sendReply);
+}
+
+/**
+ * Concurrent probing is used only if probe fits the 5bps bit interval
+ * @return true if enabled, false otherwise
+ */
+bool AutoAdapter::isConcurrentProbe() const
+{
+    return config_->getBoolProperty(PAR_CONCURRENT_PROBE) && timeout_ <= MAX_PROBE_TIMEOUT;
+}
+
+/**
+ * Run the next bus probe, called by ISO adapter on 5bps bit interval
+ * @return true if ECU answered, false otherwise
+ */
+bool AutoAdapter::ProbeCallback()
+{
+    if (probeProtocol_ == 0 && probeNum_ < ProbeAdaptersNum) {
+        int adapterType = ProbeAdapters[probeNum_++];
+        probeProtocol_ = ProtocolAdapter::getAdapter(adapterType)->onConnectEcu(sendReply_);
+    }
+    return probeProtocol_ != 0;
+}
@@ -20,6 +20,13 @@ public:
     virtual int getProtocol() const { return PROT_AUTO; }
     virtual void wiringCheck() {}
 private:
+    int onConnectEcuSequential(bool sendReply);
+    int onConnectEcuConcurrent(bool sendReply);
+    bool isConcurrentProbe() const;
+    static bool ProbeCallback();
+    static int  probeNum_;
+    static int  probeProtocol_;
+    static bool sendReply_;
 };
 
 #endif //__AUTO_PROFILE_H__
@@ -14,8 +14,9 @@ using namespace util;
 
 /**
  * Display the message history
+ * @param[in] separator The character between data bytes, 0 if none
  */
-void CanHistory::dumpCurrentBuffer()
+void CanHistory::dumpCurrentBuffer(char separator)
 {
     const int can11Pos = 5;
     const int can29Pos = 10;
@@ -38,7 +39,7 @@ void CanHistory::dumpCurrentBuffer()
 
     const int pos2 = pos1 + 3;
     const int pos3 = pos2 + 3;
-    string out;
+    ReplyString out;
     
     do {
         out.resize(0);
@@ -48,9 +49,9 @@ void CanHistory::dumpCurrentBuffer()
         out.resize(pos2, ' ');
         out += msglog_[i].dlc + '0';
         out.resize(pos3, ' ');
-        to_ascii(msglog_[i].data, 8, out);
+        to_ascii(msglog_[i].data, 8, out, separator);
         out += "  -> ";
-        to_ascii(&msglog_[i].mid, 1, out);
+        to_ascii(&msglog_[i].mid, 1, out, separator);
         
         AdptSendReply(out);
         // Advance the position
@@ -26,7 +26,7 @@ struct CanMsgBuffer;
 class CanHistory {
 public:
 	CanHistory() : currMsgPos_(0), numOfEntries_(0) {}
-	void dumpCurrentBuffer();
+	void dumpCurrentBuffer(char separator);
 	void add2Buffer(const CanMsgBuffer* buff, bool dir, uint8_t mid)
 ;
 private:
@@ -8,7 +8,8 @@
 #include <memory>
 #include <adaptertypes.h>
 #include <Timer.h>
-#include <candriver.h>
+#include <CanDriver.h>
+#include <Profiler.h>
 #include <led.h>
 #include "canmsgbuffer.h"
 #include "isocan.h"
@@ -24,6 +25,8 @@ IsoCanAdapter::IsoCanAdapter()
     extended_ = false;
     canPriority_ = 0;
     filter_[0] = mask_[0] = 0;
+    txId_ = 0;
+    showDLC_ = config_->getBoolProperty(PAR_CAN_DLC);
     driver_ = CanDriver::instance();
     history_ = new CanHistory();
 }
@@ -60,7 +63,7 @@ bool IsoCanAdapter::sendToEcu(const uint8_t* data, int len)
     if (len > ISO_CAN_LEN) {
         return false; // REPLY_DATA_ERROR
     }
-    CanMsgBuffer msgBuffer(getID(), extended_, 8, 0);
+    CanMsgBuffer msgBuffer(txId_, extended_, 8, 0);
     msgBuffer.data[0] = len;
     memcpy(msgBuffer.data + 1, data, len);
     
@@ -81,18 +84,16 @@ bool IsoCanAdapter::sendToEcu(const uint8_t* data, int len)
 void IsoCanAdapter::formatReplyWithHeader(const CanMsgBuffer* msg, util::string& str)
 {
     CanIDToString(msg->id, str, msg->extended);
-    bool useSpaces = AdapterConfig::instance()->getBoolProperty(PAR_SPACES);
-    bool isDLC = AdapterConfig::instance()->getBoolProperty(PAR_CAN_DLC);
-    if (useSpaces) {
-        str += ' '; // number of chars + space
+    if (separator_) {
+        str += separator_; // number of chars + space
     }
-    if (isDLC) {
+    if (showDLC_) {
         str += msg->dlc + '0'; // add DLC byte
-        if (useSpaces) {
-            str += ' ';
+        if (separator_) {
+            str += separator_;
         }
     }
-    to_ascii(msg->data, 8, str);
+    to_ascii(msg->data, 8, str, separator_);
 }
 
 /**
@@ -101,12 +102,12 @@ void IsoCanAdapter::formatReplyWithHeader(const CanMsgBuffer* msg, util::string&
  */
 void IsoCanAdapter::processFrame(const CanMsgBuffer* msg)
 {
-    util::string str;
-    if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
+    ReplyString str;
+    if (showHeader_) {
         formatReplyWithHeader(msg, str);
     }
     else {
-        to_ascii(msg->data, 8, str);
+        to_ascii(msg->data, 8, str, separator_);
     }
     AdptSendReply(str);
 }
@@ -118,6 +119,7 @@ void IsoCanAdapter::processFrame(const CanMsgBuffer* msg)
  */
 bool IsoCanAdapter::receiveFromEcu(bool sendReply)
 {
+    ProfileScope profile(PROF_CAN_RECEIVE);
     const int p2Timeout = getP2MaxTimeout();
     CanMsgBuffer msgBuffer;
     bool msgReceived = false;
@@ -159,8 +161,24 @@ bool IsoCanAdapter::receiveFromEcu(bool sendReply)
 
 int IsoCanAdapter::getP2MaxTimeout() const
 {
-    int p2Timeout = config_->getIntProperty(PAR_TIMEOUT); 
-    return p2Timeout ? p2Timeout : CAN_P2_MAX_TIMEOUT;
+    return timeout_ ? timeout_ : CAN_P2_MAX_TIMEOUT;
+}
+
+/**
+ * Update the cached configuration values, CAN ID and DLC display
+ * @param[in] parameter The changed property
+ */
+void IsoCanAdapter::onConfigChange(int parameter)
+{
+    ProtocolAdapter::onConfigChange(parameter);
+    switch (parameter) {
+        case PAR_WM_HEADER:
+            txId_ = getID();
+            break;
+        case PAR_CAN_DLC:
+            showDLC_ = config_->getBoolProperty(PAR_CAN_DLC);
+            break;
+    }
 }
 
 /**
@@ -183,7 +201,7 @@ int IsoCanAdapter::onRequest(const uint8_t* data, int len)
  */
 int IsoCanAdapter::onConnectEcu(bool sendReply)
 {
-    CanMsgBuffer msgBuffer(getID(), extended_, 8, 0x02, 0x01, 0x00);
+    CanMsgBuffer msgBuffer(txId_, extended_, 8, 0x02, 0x01, 0x00);
 
     open();
     if (driver_->send(&msgBuffer)) { 
@@ -201,7 +219,7 @@ int IsoCanAdapter::onConnectEcu(bool sendReply)
  */
 void IsoCanAdapter::dumpBuffer()
 {
-    history_->dumpCurrentBuffer();
+    history_->dumpCurrentBuffer(separator_);
 }
 
 /**
@@ -287,7 +305,7 @@ void IsoCan11Adapter::setFilterAndMask()
 
 void IsoCan11Adapter::processFlowFrame(const CanMsgBuffer* msg)
 {
-    CanMsgBuffer ctrlData(getID(), false, 8, 0x30, 0x0, 0x00);
+    CanMsgBuffer ctrlData(txId_, false, 8, 0x30, 0x0, 0x00);
     ctrlData.id |= (msg->id & 0x07);
     driver_->send(&ctrlData);
 }
@@ -364,7 +382,7 @@ void IsoCan29Adapter::setFilterAndMask()
 
 void IsoCan29Adapter::processFlowFrame(const CanMsgBuffer* msg)
 {
-    CanMsgBuffer ctrlData(getID(), true, 8, 0x30, 0x0, 0x00);
+    CanMsgBuffer ctrlData(txId_, true, 8, 0x30, 0x0, 0x00);
     ctrlData.id |= (msg->id & 0xFF) << 8;
     driver_->send(&ctrlData);
 }
@@ -25,9 +25,10 @@ public:
     virtual void setFilter(const uint8_t* filter);
     virtual void setMask(const uint8_t* mask);
     virtual void setCanCAF(bool val) {}
-    virtual void setPriorityByte(uint8_t val) { canPriority_ = val; }
+    virtual void setPriorityByte(uint8_t val) { canPriority_ = val; txId_ = getID(); }
     virtual void wiringCheck();
     virtual void dumpBuffer();
+    virtual void onConfigChange(int parameter);
 protected:
     IsoCanAdapter();
     virtual uint32_t getID() const = 0;
@@ -45,13 +46,15 @@ protected:
     CanHistory* history_;
     bool        extended_;
     uint8_t     canPriority_;
+    uint32_t    txId_;         // getID() cached
+    bool        showDLC_;      // ATD1
     uint8_t     filter_[5];    // 4 bytes + length
     uint8_t     mask_[5];      // 4 bytes + length
 };
 
 class IsoCan11Adapter : public IsoCanAdapter {
 public:
-    IsoCan11Adapter() {}
+    IsoCan11Adapter() { txId_ = getID(); }
     virtual void getDescription();
     virtual void getDescriptionNum();
     virtual uint32_t getID() const;
@@ -64,7 +67,7 @@ private:
 
 class IsoCan29Adapter : public IsoCanAdapter {
 public:
-    IsoCan29Adapter() { extended_ = true; }
+    IsoCan29Adapter() { extended_ = true; txId_ = getID(); }
     virtual void getDescription();
     virtual void getDescriptionNum();
     virtual uint32_t getID() const;
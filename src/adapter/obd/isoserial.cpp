@@ -6,11 +6,11 @@
  */
 
 #include <cstring>
-#include <memory>
 #include <adaptertypes.h>
 #include <GpioDrv.h>
 #include <Timer.h>
 #include <EcuUart.h>
+#include <checksum.h>
 #include "j1979.h"
 #include "isoserial.h"
 
@@ -20,6 +20,25 @@ using namespace util;
 static const uint8_t Iso14230Seq[]    = { 0x81 };
 static const uint8_t Iso9141Wakeup[]  = { 0x01, 0x00 };
 static const uint8_t Iso14230Wakeup[] = { 0x3E };
+static const uint8_t Iso14230ReadLimits[] = { 0x83, 0x00 };
+
+// The last successful session, kept in RAM and optionally in EEPROM
+struct IsoSessionCache {
+    uint8_t magic;
+    uint8_t initAddr;
+    uint8_t protocol;
+    uint8_t kwrds[2];
+    uint8_t ecuAddr; // The source address of the replies, 0 if unknown
+    uint8_t checksum;
+    
+    uint8_t sum() const { return magic + initAddr + protocol + kwrds[0] + kwrds[1] + ecuAddr; }
+    bool valid(uint8_t addr) const { return magic == SessionMagic && initAddr == addr && checksum == sum(); }
+    const static uint8_t SessionMagic = 0xA5;
+};
+static IsoSessionCache sessionCache;
+static bool sessionCacheLoaded = false;
+static bool sessionCacheDirty = false; // Changed since written to EEPROM
+const uint32_t SessionCacheAddr = 0; // EEPROM address
 
 #define __BELLS_AND_WHISTLES__
 #ifdef __BELLS_AND_WHISTLES__
@@ -57,11 +76,22 @@ static bool CheckIso14230Header(uint8_t kb1)
 }
 
 /**
- * Check Timer to produce P3 timeout between conseqent requests to avoid "NO DATA" error
+ * Check Timer to produce P3 timeout between conseqent requests to avoid "NO DATA" error.
+ * P3 is counted from the last byte on the bus, the late replies restart it and dropped.
  */
 void IsoSerialAdapter::checkP3Timeout()
 {
-    while (!p3Timer_->isExpired()) ;
+    cancelHeartBeat();
+    uint32_t start = TimeStamp::now();
+    while (!p3Timer_->isExpired()) {
+        if (uart_->ready()) {
+            uart_->get();
+            // Give up waiting for the silence on the noisy line
+            if ((TimeStamp::now() - start) < (P3_MAX_TIMEOUT * 1000))
+                p3Timer_->start(p3Min_);
+        }
+    }
+    uart_->clearRxFifo();
 }
 
 /**
@@ -72,7 +102,8 @@ void IsoSerialAdapter::setKeepAlive()
     if (wakeupTime_) { // If keepalive enabled?
         keepAliveTimer_->start(wakeupTime_);
     }
-    p3Timer_->start(P3_MIN_TIMEOUT);
+    p3Timer_->start(p3Min_);
+    lastTraffic_ = TimeStamp::now();
 }
 
 bool IsoSerialAdapter::isKeepAlive()
@@ -87,8 +118,36 @@ IsoSerialAdapter::IsoSerialAdapter()
 {
     protocol_          = PROT_AUTO;
     uart_              = EcuUart::instance();
+    baud_              = ECU_SPEED;
     keepAliveTimer_    = LongTimer::instance();
     p3Timer_           = Timer::instance(1);
+    probeCallback_     = nullptr;
+    probeOverrun_      = false;
+    ecuAddr_           = 0;
+    initAborted_       = false;
+    hbState_           = HB_IDLE;
+    hbMsg_             = nullptr;
+    lastTraffic_       = 0;
+    orderedReply_      = config_->getBoolProperty(PAR_ORDERED_REPLY);
+    allowLong_         = config_->getBoolProperty(PAR_ALLOW_LONG);
+    resetTiming();
+}
+
+/**
+ * Update the cached configuration values, ordered replies and long messages
+ * @param[in] parameter The changed property
+ */
+void IsoSerialAdapter::onConfigChange(int parameter)
+{
+    ProtocolAdapter::onConfigChange(parameter);
+    switch (parameter) {
+        case PAR_ORDERED_REPLY:
+            orderedReply_ = config_->getBoolProperty(PAR_ORDERED_REPLY);
+            break;
+        case PAR_ALLOW_LONG:
+            allowLong_ = config_->getBoolProperty(PAR_ALLOW_LONG);
+            break;
+    }
 }
 
 /**
@@ -96,7 +155,10 @@ IsoSerialAdapter::IsoSerialAdapter()
  */
 void IsoSerialAdapter::open()
 {
-    uart_->init(ECU_SPEED);
+    // IB, 10400 bit/s by default
+    uint32_t baud = config_->getIntProperty(PAR_ISO_BAUD);
+    baud_ = baud ? baud : ECU_SPEED;
+    uart_->init(baud_);
 }
 
 /**
@@ -104,7 +166,9 @@ void IsoSerialAdapter::open()
  */
 void IsoSerialAdapter::closeProtocol()
 { 
+    cancelHeartBeat();
     connected_ = false;
+    resetTiming();
 }
 
 /**
@@ -114,6 +178,7 @@ void IsoSerialAdapter::closeProtocol()
 void IsoSerialAdapter::close()
 {
     closeProtocol();
+    storeSession();
 }
 
 /**
@@ -137,32 +202,78 @@ bool IsoSerialAdapter::sendToEcu(const Ecumsg* msg, int p4Timeout)
     
     TX_LED(1); // Turn the transmit LED on
 
-    for (int i = 0; i < msg->length(); i++) {
-        uart_->send(msg->data()[i]);
-        
-        // Get the echo byte, it takes 1.2ms
-        if (!uart_->getEcho(msg->data()[i])) {
-            TX_LED(0); // Turn the transmit LED off
-            return false;
-        }    
-        // Interbyte delay <P4 = [5-20ms]>
-        if (i > 0)
-            Delay1ms(p4Timeout);
-    } 
+    // Interbyte delay <P4 = [5-20ms]>
+    bool sts = uart_->startTx(msg->data(), msg->length(), p4Timeout * 1000) && uart_->waitTx();
 
     TX_LED(0); // Turn the transmit LED off
-    return true;
+    return sts;
+}
+
+/**
+ * Calculate the ISO 14230 frame length from the format and length bytes
+ * @param[in] data The frame bytes received so far
+ * @param[in] len The number of bytes received so far
+ * @return The frame length including checksum, 0 if not known yet
+ */
+static int KwpFrameLength(const uint8_t* data, int len)
+{
+    if (len == 0)
+        return 0;
+    int hdrLen = (data[0] & 0xC0) ? 3 : 1; // Target and source address present?
+    int dataLen = data[0] & 0x3F;
+    if (dataLen == 0) { // Separate length byte
+        if (len <= hdrLen)
+            return 0;
+        dataLen = data[hdrLen];
+        hdrLen++;
+    }
+    return hdrLen + dataLen + 1;
+}
+
+/**
+ * Get the ISO 14230 header length
+ * @param[in] data The frame bytes
+ * @return The header length including the optional length byte
+ */
+static int KwpHeaderLength(const uint8_t* data)
+{
+    int hdrLen = (data[0] & 0xC0) ? 3 : 1;
+    return (data[0] & 0x3F) ? hdrLen : hdrLen + 1;
+}
+
+/**
+ * Get the header length of either ISO 9141 or ISO 14230 frame
+ * @param[in] data The frame bytes
+ * @return The header length
+ */
+static int FrameHeaderLength(const uint8_t* data)
+{
+    return ((data[0] & 0xC0) == 0x40) ? 3 : KwpHeaderLength(data);
+}
+
+/**
+ * Validate the ISO 9141/14230 additive checksum
+ * @param[in] data The frame bytes, checksum is the last byte
+ * @param[in] len The frame length
+ * @return true if valid, false otherwise
+ */
+static bool IsoChecksumValid(const uint8_t* data, int len)
+{
+    return len > 1 && util::iso_checksum(data, len - 1) == data[len - 1];
 }
 
 /**
  * Receives a sequence of bytes from the ECU until timeout expired or 
- * the maximum number of bytes received
+ * the maximum number of bytes received. ISO 14230 frames end as soon as
+ * the length from the format byte is received.
  * @param[in] msg Ecumsg instance
  * @param[in] maxLen The maximum bytes to receive
  * @param[in] p2timeout The P2 timeout
  * @param[in] p1timeout The P1 timeout
+ * @param[in] kwpFrame Use ISO 14230 format byte to find the frame end
+ * @return false if ISO 14230 frame ended early or checksum is wrong, true otherwise
  */
-void IsoSerialAdapter::receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout)
+bool IsoSerialAdapter::receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout, bool kwpFrame)
 {
     msg->length(0);
     
@@ -170,26 +281,74 @@ void IsoSerialAdapter::receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, in
     Timer* timer = Timer::instance(1);
     timer->start(p2Timeout);
     
-    int i = 0;
-    for(; i < maxLen; i++) { // Only retrieve maxLen bytes
-        // Do we have Rx overrun issue?
-        uart_->clear();
+    // The timestamps are in microseconds and taken at the end of the byte
+    const uint32_t p1Gap = p1Timeout * 1000 + uart_->byteTime();
+    const uint32_t p1Wait = p1Timeout + (uart_->byteTime() + 999) / 1000;
+    uint32_t lastStamp = 0;
+    int frameLen = 0;
+    
+    for (int i = 0; i < maxLen; i++) { // Only retrieve maxLen bytes
+        // Sleep until data received or timeout
+        if (!uart_->wait(timer))
+            break; // exit by timeout
+        
+        // The bytes are timestamped on arrival, the late byte starts the next message
+        uint32_t stamp = uart_->getStamp();
+        if (i > 0 && (stamp - lastStamp) > p1Gap)
+            break;
         
-        // Wait for data to be received
-        while(!uart_->ready()) {
-            if (timer->isExpired())
-                goto extm; // exit by timeout
-        }
-
         (*msg) += uart_->get();
         RX_LED(1); // Turn the receive LED on
+        lastStamp = stamp;
+        
+        // Stop right after the checksum, no need to wait for P1 gap
+        if (kwpFrame) {
+            if (!frameLen)
+                frameLen = KwpFrameLength(msg->data(), msg->length());
+            if (frameLen && msg->length() >= frameLen)
+                break;
+        }
 
-        // Reload the timer with p1Timeout
-        timer->start(p1Timeout);
+        // Reload the timer with P1 time left since the byte arrival
+        uint32_t elapsed = (TimeStamp::now() - stamp) / 1000;
+        timer->start(elapsed < p1Wait ? p1Wait - elapsed : 0);
     }
-extm:
+
     RX_LED(0); // Turn the receive LED off
     appendToHistory(msg); // Buffer dump
+    
+    if (!kwpFrame || msg->length() == 0)
+        return true;
+    if (msg->length() < frameLen) // Truncated by maxLen is not an error
+        return msg->length() == maxLen;
+    return IsoChecksumValid(msg->data(), frameLen);
+}
+
+/**
+ * Hold the K-line level for one 5bps bit interval. If the probe callback is set
+ * let it use the interval to probe the other buses.
+ * @param[in] interval The bit interval
+ * @return true if OK, false if the other bus answered or the probe took longer than
+ *         the bit, the ECU would read the wrong address then, init should be abandoned
+ */
+bool IsoSerialAdapter::holdBit(uint32_t interval)
+{
+    if (!probeCallback_) {
+        Delay1ms(interval);
+        return true;
+    }
+    
+    p3Timer_->start(interval);
+    if (probeCallback_()) {
+        return false;
+    }
+    if (p3Timer_->isExpired()) {
+        probeOverrun_ = true;
+        return false;
+    }
+    while (!p3Timer_->isExpired())
+        ;
+    return true;
 }
 
 /**
@@ -202,6 +361,9 @@ bool IsoSerialAdapter::ecuSlowInit()
     const int BIT_INTERVAL = 200; // 200ms
     bool sts = true;
 
+    initAborted_ = false;
+    probeOverrun_ = false;
+    
     TX_LED(1); // Turn the transmit LED on
 
     // Disable USART
@@ -214,14 +376,17 @@ bool IsoSerialAdapter::ecuSlowInit()
     for (int i = 0; i < 10; i++) {
         uint8_t val = (ch & 0x01);
         uart_->setBit(val);
-        Delay1ms(BIT_INTERVAL);
+        if (!holdBit(BIT_INTERVAL)) {
+            initAborted_ = true; // The other protocol is connected or the bit overrun
+            break;
+        }
         ch >>= 1;
     }
 
     TX_LED(0); // Turn the transmit LED off
 
     // Get the feedback status, the last bit (stop bit)
-    if (!uart_->getBit()) {
+    if (!initAborted_ && !uart_->getBit()) {
         sts = false;   // Wiring error, no +12V power?
     }
     
@@ -284,9 +449,12 @@ bool IsoSerialAdapter::ecuFastInit()
 int IsoSerialAdapter::onConnectEcuSlow(int protocol)
 {
     uint8_t kb1, kb2;
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(Ecumsg::ISO9141));
+    EcumsgPtr msg(Ecumsg::ISO9141);
+    if (!msg.get())
+        return REPLY_ERROR;
 
     connected_ = false;
+    resetTiming();
 
 #ifdef __BELLS_AND_WHISTLES__
     if (protocol != PROT_AUTO) {
@@ -294,10 +462,15 @@ int IsoSerialAdapter::onConnectEcuSlow(int protocol)
     }
 #endif
 
+    // The ECU address is known from the first reply
+    ecuAddr_ = 0;
+
     // Send 0x33 at 5 bit/s on "K" & "L" lines
-    // And switch back to 10400 bit/s
+    // And switch back to the ISO baud rate
     if (!ecuSlowInit())
         return REPLY_WIRING_ERROR;
+    if (initAborted_)
+        return REPLY_ERROR;
 
 #ifdef __BELLS_AND_WHISTLES__
     // Send the first "."
@@ -398,9 +571,12 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
     uint8_t kb1;
     int sts = REPLY_ERROR;
     const int p2Timeout = getP2MaxTimeout();
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(Ecumsg::ISO14230));
+    EcumsgPtr msg(Ecumsg::ISO14230);
+    if (!msg.get())
+        return REPLY_ERROR;
 
     connected_ = false;
+    resetTiming();
 
 #ifdef __BELLS_AND_WHISTLES__
     if (protocol != PROT_AUTO) {
@@ -408,7 +584,7 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
     }
 #endif
 
-    // Send wakeup pattern at 10400 bit/s
+    // Send wakeup pattern at the ISO baud rate
     if (!ecuFastInit())
         return REPLY_WIRING_ERROR;
 
@@ -419,12 +595,12 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
 
     for (;;) {
         // maxlen -> (3hdr bytes + 3data bytes + checksum) => 7
-        receiveFromEcu(msg.get(), 7, p2Timeout, P1_MAX_TIMEOUT); 
+        bool frameOk = receiveFromEcu(msg.get(), 7, p2Timeout, P1_MAX_TIMEOUT, true); 
         if (msg->length() == 0)
             break;
         if (connected_)
             continue; // Already connected, just get the rest of replies
-        if (msg->length() < 5) {
+        if (!frameOk || msg->length() < 5) {
             sts = REPLY_DATA_ERROR;
             continue;
         }    
@@ -446,9 +622,10 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
             continue;
         }             
         
-        // Save keywords
+        // Save keywords and the ECU address
         isoKwrds_[0] = kb1 = msg->data()[n+1];
         isoKwrds_[1] = msg->data()[n+2];
+        ecuAddr_ = (n >= 3) ? msg->data()[2] : 0;
 
         if (kwCheck_) {
             if (CheckIso14230Header(kb1)) {
@@ -469,21 +646,163 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
     
     setKeepAlive();
     
+    if (connected_ && config_->getBoolProperty(PAR_KWP_TIMING)) {
+        negotiateTiming();
+    }
+    
     return sts;
 }
 
 /**
- * Send wakeup sequence to the ECU
+ * Read the ECU timing limits with KWP2000 AccessTimingParameters service
+ * and switch both ECU and adapter to the fastest set all ECUs support.
+ * Keep the default timing if any ECU does not support it.
+ */
+void IsoSerialAdapter::negotiateTiming()
+{
+    const int TimingLen = 5; // P2min, P2max, P3min, P3max, P4min
+    const uint8_t P3MaxDefault = 0x14; // 5 sec, do not shorten the session timeout
+    uint8_t data[2 + TimingLen] = { 0x83, 0x03, 0, 0, 0, P3MaxDefault, 0 };
+    EcumsgPtr msg(Ecumsg::ISO14230);
+    if (!msg.get())
+        return;
+
+    msg->setData(Iso14230ReadLimits, sizeof(Iso14230ReadLimits));
+    msg->addHeaderAndChecksum();
+    checkP3Timeout();
+    if (!sendToEcu(msg.get(), p4_))
+        return;
+
+    // Every ECU replies with "C3 00 P2min P2max P3min P3max P4min", take the slowest values
+    bool supported = false;
+    for (;;) {
+        bool frameOk = receiveFromEcu(msg.get(), OBD_IN_MSG_LEN, p2Max_, P1_MAX_TIMEOUT, true);
+        if (msg->length() == 0)
+            break;
+        int n = KwpHeaderLength(msg->data());
+        if (!frameOk || msg->length() < n + 2 + TimingLen + 1 || msg->data()[n] != 0xC3) {
+            supported = false;
+            break;
+        }
+        supported = true;
+        for (int i = 0; i < TimingLen; i++) {
+            uint8_t val = msg->data()[n + 2 + i];
+            if (val > data[2 + i])
+                data[2 + i] = val;
+        }
+    }
+    setKeepAlive();
+    
+    // P2max above 0xF0 uses the different resolution, leave it alone
+    if (!supported || data[3] == 0 || data[3] > 0xF0)
+        return;
+
+    // Set the new values, "83 03 P2min P2max P3min P3max P4min"
+    msg->setData(data, sizeof(data));
+    msg->addHeaderAndChecksum();
+    checkP3Timeout();
+    if (!sendToEcu(msg.get(), p4_))
+        return;
+        
+    bool accepted = false;
+    for (;;) {
+        bool frameOk = receiveFromEcu(msg.get(), OBD_IN_MSG_LEN, p2Max_, P1_MAX_TIMEOUT, true);
+        if (msg->length() == 0)
+            break;
+        int n = KwpHeaderLength(msg->data());
+        if (!frameOk || msg->data()[n] != 0xC3) {
+            accepted = false;
+            break;
+        }
+        accepted = true;
+    }
+    
+    // The resolution is 0.5ms for P2min/P3min/P4min and 25ms for P2max,
+    // P2max is limited by the longest Timer interval
+    if (accepted) {
+        int p2Max = data[3] * 25;
+        p2Max_ = (p2Max < static_cast<int>(Timer::MAX_INTERVAL)) ? p2Max : Timer::MAX_INTERVAL;
+        p3Min_ = (data[4] + 1) / 2;
+        p4_    = (data[6] + 1) / 2;
+    }
+    setKeepAlive();
+}
+
+/**
+ * Revert to the default ISO timing
+ */
+void IsoSerialAdapter::resetTiming()
+{
+    p2Max_ = P2_MAX_TIMEOUT;
+    p3Min_ = P3_MIN_TIMEOUT;
+    p4_    = P4_TIMEOUT;
+}
+
+/**
+ * Keepalive task, called from the main loop. Runs as the state machine, every call
+ * returns immediately, the transmit and receive are interrupt driven.
  */
 void IsoSerialAdapter::sendHeartBeat()
 { 
-    if (!isKeepAlive()) {
-        return;
+    switch (hbState_) {
+        case HB_IDLE:
+            // The keepalive timer is restarted by every request, so no beat with the traffic
+            if (isKeepAlive() && p3Timer_->isExpired()) {
+                startHeartBeat();
+            }
+            break;
+            
+        case HB_SENDING:
+            if (uart_->isTxBusy())
+                break;
+            TX_LED(0); // Turn the transmit LED off
+            if (!uart_->txResult()) {
+                hbState_ = HB_IDLE;
+                Ecumsg::release(hbMsg_);
+                hbMsg_ = nullptr;
+                close(); // Beat failed
+                break;
+            }
+            hbMsg_->length(0);
+            p3Timer_->start(getP2MaxTimeout());
+            hbState_ = HB_RECEIVING;
+            break;
+            
+        case HB_RECEIVING:
+            // Wait for multiply replies, each one should come within P2
+            while (uart_->ready()) {
+                uint8_t byte = uart_->get();
+                if (hbMsg_->length() < OBD_IN_MSG_LEN)
+                    (*hbMsg_) += byte;
+                p3Timer_->start(getP2MaxTimeout());
+            }
+            if (!p3Timer_->isExpired())
+                break;
+            hbState_ = HB_IDLE;
+            appendToHistory(hbMsg_); // Buffer dump
+            if (hbMsg_->length() == 0) {
+                close(); // Beat failed
+            }
+            else {
+                setKeepAlive(); // Start measuring P3 timeout again
+            }
+            Ecumsg::release(hbMsg_);
+            hbMsg_ = nullptr;
+            break;
     }
+}
 
-    const uint32_t p2Timeout = getP2MaxTimeout();
+/**
+ * Build the wakeup message for the current protocol
+ * @return The message instance, caller is responsible to release it,
+ *         nullptr if the message pool exhausted
+ */
+Ecumsg* IsoSerialAdapter::wakeupMessage() const
+{
     uint8_t msgtype = (protocol_ == PROT_ISO14230) ?  Ecumsg::ISO14230 : Ecumsg::ISO9141;
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(msgtype));
+    Ecumsg* msg = Ecumsg::acquire(msgtype);
+    if (!msg)
+        return nullptr;
     
     if (customWkpMsg_[0]) { // Use custom wakeup seq
         msg->setData(customWkpMsg_ + 1, customWkpMsg_[0]);
@@ -497,91 +816,353 @@ void IsoSerialAdapter::sendHeartBeat()
         }
         msg->addHeaderAndChecksum();
     }
+    return msg;
+}
 
-    int numReplies = 0;
-    if (!sendToEcu(msg.get(), P4_TIMEOUT)) {
-        close(); // Beat failed
+/**
+ * Build the wakeup message and start sending it
+ */
+void IsoSerialAdapter::startHeartBeat()
+{
+    hbMsg_ = wakeupMessage();
+    if (!hbMsg_)
+        return; // Retry on the next idle pass
+
+    insertToHistory(hbMsg_); // Buffer dump
+    TX_LED(1); // Turn the transmit LED on
+    if (!uart_->startTx(hbMsg_->data(), hbMsg_->length(), p4_ * 1000)) {
+        TX_LED(0);
+        Ecumsg::release(hbMsg_);
+        hbMsg_ = nullptr;
+        close();
         return;
     }
+    hbState_ = HB_SENDING;
+}
 
-    // Wait for multiply replies
-    for (int i = 0; ; i++) {            
-        receiveFromEcu(msg.get(), OBD_IN_MSG_LEN, p2Timeout, P1_MAX_TIMEOUT);
-        if (msg->length() > 0) {
-            numReplies++;
-        }
-        else { // Timeout
-            break;
-        }
-    }         
+/**
+ * Stop the keepalive in progress, the byte on the wire is completed by UART.
+ * The ECU has to drop the aborted frame or could still answer the sent one, the next
+ * request goes after P3min of silence on the bus, sooner it collides with the replies.
+ */
+void IsoSerialAdapter::cancelHeartBeat()
+{
+    if (hbState_ == HB_IDLE)
+        return;
     
-    if (numReplies == 0) {
-        close(); // Beat failed
+    uart_->abortTx();
+    TX_LED(0);
+    hbState_ = HB_IDLE;
+    Ecumsg::release(hbMsg_);
+    hbMsg_ = nullptr;
+    p3Timer_->start(p3Min_);
+}
+
+/**
+ * Check if the reply is the last one expected for the physically addressed request,
+ * the multiple message modes and "response pending" keep waiting
+ * @param[in] req The request message with header
+ * @param[in] reply The reply message with header
+ * @param[in] replyLen The reply length
+ * @return true if no more replies expected
+ */
+static bool IsLastReply(const uint8_t* req, const uint8_t* reply, int replyLen, bool kwp)
+{
+    bool physical = kwp ? ((req[0] & 0xC0) == 0x80) : (req[0] & 0x04);
+    if (!physical || reply[2] != req[1])
+        return false;
+
+    // KWP header could have the separate length byte
+    uint8_t mode = req[FrameHeaderLength(req)];
+    if (mode == 0x03 || mode == 0x07 || mode == 0x09 || mode == 0x0A)
+        return false;
+    int n = FrameHeaderLength(reply);
+    if (reply[n] == 0x7F && replyLen > n + 2 && reply[n + 2] == 0x78)
+        return false;
+    return true;
+}
+
+/**
+ * Check the reply header for the traffic not addressed to us
+ * @param[in] req The request message with header
+ * @param[in] reply The reply message with header
+ * @return true if foreign message
+ */
+static bool IsForeignReply(const uint8_t* req, const uint8_t* reply, bool kwp)
+{
+    if (kwp) { // Target should be the tester address
+        return (reply[0] & 0xC0) && reply[1] != req[2];
     }
-    else {
-        setKeepAlive(); // Start measuring P3 timeout again
+    // Another tester request with the same header
+    return reply[0] == req[0] && reply[1] == req[1];
+}
+
+/**
+ * Send the reply to the host, stripping header/checksum if option "Send Header" is not set
+ * @param[in] msg Ecumsg instance
+ * @return false if the checksum is wrong and the reply is dropped, true otherwise
+ */
+bool IsoSerialAdapter::sendReply(Ecumsg* msg)
+{
+    ReplyString str;
+    
+    if (!showHeader_ && !msg->stripHeaderAndChecksum())
+        return false;
+    msg->toString(str, separator_);
+    AdptSendReply(str); 
+    return true;
+}
+
+const int MAX_ECU_REPLIES = 8;
+struct ReplyFrame {
+    uint8_t length;
+    uint8_t data[OBD_IN_MSG_LEN + 6];
+};
+static ReplyFrame replyFrames[MAX_ECU_REPLIES];
+
+/**
+ * Send the replies collected for "ordered reply" option
+ * @param[in] msg Ecumsg instance to use for sending
+ * @param[in] numFrames The number of replies
+ * @return The number of replies sent
+ */
+int IsoSerialAdapter::flushReplies(Ecumsg* msg, int numFrames)
+{
+    int numSent = 0;
+    for (int i = 0; i < numFrames; i++) {
+        msg->setData(replyFrames[i].data, replyFrames[i].length);
+        if (sendReply(msg))
+            numSent++;
     }
+    return numSent;
 }
 
 /**
- * ISO serial request handler
+ * ISO serial request handler. The replies are filtered by the header, the malformed
+ * and foreign ones are dropped. With "ordered reply" option set the replies are
+ * grouped by the source address.
  * @param[in] data Data bytes
  * @param[in] len Data length
  * @return The completion status
  */
 int IsoSerialAdapter::onRequest(const uint8_t* data, int len)
 { 
-    bool reply = false;
+    int numReplies = 0;
+    int numSent = 0;
+    int numFrames = 0;
+    int sts = REPLY_NO_DATA;
     const int p2Timeout = getP2MaxTimeout();
     const int maxLen = get2MaxLen();
-    util::string str;
+    const bool kwp = isKwpProtocol();
+    uint8_t reqHeader[4];
     
     uint8_t msgtype = (protocol_ == PROT_ISO14230) ? Ecumsg::ISO14230 : Ecumsg::ISO9141;
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(msgtype));
+    EcumsgPtr msg(msgtype);
+    if (!msg.get())
+        return REPLY_ERROR;
     
     msg->setData(data, len);
     msg->addHeaderAndChecksum();
+    memcpy(reqHeader, msg->data(), sizeof(reqHeader));
 
     // Ready to send it.. but how about P3 timeout?
     checkP3Timeout();
     
-    if (!sendToEcu(msg.get(), P4_TIMEOUT)) {
+    if (!sendToEcu(msg.get(), p4_)) {
+        resetTiming();
         return REPLY_WIRING_ERROR;
     }
 
     // Wait for multiple replies
-    for (int i = 0; ; i++) {
-        receiveFromEcu(msg.get(), maxLen, p2Timeout, P1_MAX_TIMEOUT); 
+    for (;;) {
+        bool frameOk = receiveFromEcu(msg.get(), maxLen, p2Timeout, P1_MAX_TIMEOUT, kwp); 
         if (msg->length() == 0)
             break;
-        if (msg->length() < 5)
-            return REPLY_DATA_ERROR;
+        // ISO 9141 frame has no length, it is validated by the checksum. The frame
+        // truncated by maxLen has no checksum to validate, it is a data error.
+        bool truncated = kwp ? KwpFrameLength(msg->data(), msg->length()) > msg->length()
+                             : msg->length() == maxLen && !msg->checksumValid();
+        if (!kwp)
+            frameOk = msg->checksumValid();
+        if (msg->length() < 5 || truncated) {
+            sts = REPLY_DATA_ERROR;
+            continue;
+        }
+        if (!frameOk) {
+            sts = REPLY_CHKS_ERROR;
+            continue;
+        }
+        if (IsForeignReply(reqHeader, msg->data(), kwp))
+            continue;
             
-        reply = true; // Mark that we have received reply
+        // Mark that we have received reply. The slow init does not tell the ECU address,
+        // remember the first responder for the session resume, RAM only
+        if (numReplies++ == 0 && ecuAddr_ == 0) {
+            ecuAddr_ = msg->data()[2];
+            saveSession();
+        }
+        bool last = IsLastReply(reqHeader, msg->data(), msg->length(), kwp);
         
-        // Strip the message header/checksum if option "Send Header" is not set
-        if (!config_->getBoolProperty(PAR_HEADER_SHOW)) {
-            // Was the message OK?
-            if (!msg->stripHeaderAndChecksum()) {
-                return REPLY_CHKS_ERROR;
+        if (orderedReply_) {
+            // The buffer is full, send the sorted replies first to keep them ahead,
+            // the message is used for sending so keep the current frame aside
+            if (numFrames == MAX_ECU_REPLIES) {
+                ReplyFrame frame;
+                frame.length = msg->length();
+                memcpy(frame.data, msg->data(), frame.length);
+                numSent += flushReplies(msg.get(), numFrames);
+                msg->setData(frame.data, frame.length);
+                numFrames = 0;
+            }
+            // Insert it after all the replies with the same or lower source address
+            int i = numFrames++;
+            for (; i > 0 && replyFrames[i - 1].data[2] > msg->data()[2]; i--) {
+                replyFrames[i] = replyFrames[i - 1];
             }
+            replyFrames[i].length = msg->length();
+            memcpy(replyFrames[i].data, msg->data(), msg->length());
         }
-
-        msg->toString(str);
-        AdptSendReply(str); 
-        str.resize(0);
+        else if (sendReply(msg.get())) {
+            numSent++;
+        }
+        
+        if (last)
+            break;
     }
+    numSent += flushReplies(msg.get(), numFrames);
 
     setKeepAlive();
     
     // Do we have at least one reply?    
-    if (!reply) {
-        return REPLY_NO_DATA;
+    if (numReplies == 0) {
+        resetTiming(); // Fall back to the safe timing
+        return sts;
+    }
+    if (numSent == 0) {
+        return REPLY_CHKS_ERROR;
     }
 
     return REPLY_NONE;
 }
 
+/**
+ * Check the wakeup reply is the positive response with the valid checksum
+ * from the cached ECU address
+ * @param[in] msg The reply
+ * @param[in] frameOk The frame status from receiveFromEcu
+ * @param[in] service The request service
+ * @return true if the session is alive
+ */
+bool IsoSerialAdapter::isSessionReply(const Ecumsg* msg, bool frameOk, uint8_t service) const
+{
+    const uint8_t* data = msg->data();
+    if (msg->length() < 5 || !(data[0] & 0xC0))
+        return false;
+    if (!isKwpProtocol() && !msg->checksumValid())
+        return false;
+    int n = FrameHeaderLength(data);
+    return frameOk && msg->length() > n + 1 && data[2] == sessionCache.ecuAddr && data[n] == (service | 0x40);
+}
+
+/**
+ * Resume the session with cached keywords. If the ECU could still be in session just
+ * send the wakeup message, otherwise use fast init for ISO 14230 ECU. The failed
+ * fast init invalidates the cache.
+ * @param[in] protocol The requested protocol number
+ * @param[out] fastInitDone Set if fast init was used
+ * @return true if connected
+ */
+bool IsoSerialAdapter::resumeSession(int protocol, bool& fastInitDone)
+{
+    fastInitDone = false;
+
+    // Restore the cache from EEPROM after power up
+    if (!sessionCacheLoaded) {
+        sessionCacheLoaded = true;
+        if (config_->getBoolProperty(PAR_KW_CACHE)) {
+            AdptReadStorage(SessionCacheAddr, &sessionCache, sizeof(sessionCache));
+        }
+    }
+    if (!sessionCache.valid(isoInitByte_))
+        return false;
+    if (protocol != PROT_AUTO && protocol != sessionCache.protocol)
+        return false;
+    
+    // The ECU keeps the session until P3max expired
+    protocol_ = sessionCache.protocol;
+    bool inSession = lastTraffic_ && (TimeStamp::now() - lastTraffic_) < (P3_MAX_TIMEOUT * 1000);
+    if (inSession && sessionCache.ecuAddr) {
+        EcumsgPtr msg(wakeupMessage());
+        checkP3Timeout();
+        if (msg.get() && sendToEcu(msg.get(), p4_)) {
+            uint8_t service = msg->data()[FrameHeaderLength(msg->data())];
+            bool frameOk = receiveFromEcu(msg.get(), OBD_IN_MSG_LEN, getP2MaxTimeout(), P1_MAX_TIMEOUT, isKwpProtocol());
+            if (isSessionReply(msg.get(), frameOk, service)) {
+                memcpy(isoKwrds_, sessionCache.kwrds, sizeof(isoKwrds_));
+                ecuAddr_ = sessionCache.ecuAddr;
+                connected_ = true;
+                setKeepAlive();
+                return true;
+            }
+        }
+    }
+    
+    if (sessionCache.protocol == PROT_ISO14230) {
+        fastInitDone = true;
+        onConnectEcuFast(protocol);
+        if (connected_)
+            return true;
+        invalidateSession();
+        return false;
+    }
+    protocol_ = protocol;
+    return false;
+}
+
+/**
+ * Drop the cached session, the next connect is using the full init
+ */
+void IsoSerialAdapter::invalidateSession()
+{
+    sessionCache.magic = 0;
+    sessionCacheDirty = true;
+    storeSession();
+}
+
+/**
+ * Remember the connected session in RAM, EEPROM is written by storeSession
+ */
+void IsoSerialAdapter::saveSession()
+{
+    IsoSessionCache cache;
+    cache.magic = IsoSessionCache::SessionMagic;
+    cache.initAddr = isoInitByte_;
+    cache.protocol = protocol_;
+    memcpy(cache.kwrds, isoKwrds_, sizeof(cache.kwrds));
+    cache.ecuAddr = ecuAddr_;
+    cache.checksum = cache.sum();
+    
+    if (memcmp(&cache, &sessionCache, sizeof(cache)) == 0)
+        return;
+    sessionCache = cache;
+    sessionCacheLoaded = true;
+    sessionCacheDirty = true;
+}
+
+/**
+ * Write the changed session to EEPROM if option is set, called on connect and close only
+ * to keep IAP writes out of the request handling
+ */
+void IsoSerialAdapter::storeSession()
+{
+    if (!sessionCacheDirty)
+        return;
+    sessionCacheDirty = false;
+    if (config_->getBoolProperty(PAR_KW_CACHE)) {
+        AdptWriteStorage(SessionCacheAddr, &sessionCache, sizeof(sessionCache));
+    }
+}
+
 /**
  * Response for "ATDP"
  */
@@ -606,7 +1187,7 @@ void IsoSerialAdapter::getDescription()
  */
 void IsoSerialAdapter::kwDisplay()
 {
-    util::string str;
+    ReplyString str;
     KWordsToString(isoKwrds_, str);
     AdptSendReply(str);
 }
@@ -643,33 +1224,42 @@ int IsoSerialAdapter::onConnectEcu(bool sendReply)
     if (connected_ ) {
         return protocol_;
     }
+    cancelHeartBeat();
     
     // Set speed and etc
     configureProperties(); 
     open();
 
     int requestedProtocol = protocol_;
+    bool fastInitDone;
     
+    // Try to resume the previous session first, skipping the slow init
+    if (resumeSession(requestedProtocol, fastInitDone)) {
+        ;
+    }
     // Get ISO9141/14230 message formatted
-    if (requestedProtocol != PROT_AUTO) {
+    else if (requestedProtocol != PROT_AUTO) {
         switch (requestedProtocol) {
             case PROT_ISO9141:
             case PROT_ISO14230_5BPS:
                 onConnectEcuSlow(requestedProtocol);
                 break;
             case PROT_ISO14230:
-                onConnectEcuFast(requestedProtocol);
+                if (!fastInitDone)
+                    onConnectEcuFast(requestedProtocol);
                 break;
         }
     }
     else {
         onConnectEcuSlow(PROT_AUTO);
-        if (!connected_) {
+        if (!connected_ && !initAborted_ && !fastInitDone) {
             onConnectEcuFast(PROT_AUTO);
         }
     }
 
     if (connected_) {
+        saveSession();
+        storeSession();
         #ifdef __BELLS_AND_WHISTLES__
         if (requestedProtocol != PROT_AUTO) {
             AdptSendReply(EchoOk);
@@ -687,6 +1277,7 @@ int IsoSerialAdapter::onConnectEcu(bool sendReply)
  */
 void IsoSerialAdapter::wiringCheck()
 {
+    cancelHeartBeat();
     // Disable USART
     uart_->setBitBang(true);
 
@@ -721,8 +1312,7 @@ ext:
  */
 int IsoSerialAdapter::getP2MaxTimeout() const
 {
-    int p2Timeout = config_->getIntProperty(PAR_TIMEOUT); 
-    return p2Timeout ? p2Timeout : P2_MAX_TIMEOUT;
+    return timeout_ ? timeout_ : p2Max_;
 }
 
 /**
@@ -731,8 +1321,7 @@ int IsoSerialAdapter::getP2MaxTimeout() const
  */
 int IsoSerialAdapter::get2MaxLen() const
 {
-    bool longAllowed = config_->getBoolProperty(PAR_ALLOW_LONG);
-    return longAllowed ? OBD_IN_MSG_LEN + 6 : OBD_IN_MSG_LEN;
+    return allowLong_ ? OBD_IN_MSG_LEN + 6 : OBD_IN_MSG_LEN;
 }
 
 void IsoSerialAdapter::configureProperties()
@@ -13,6 +13,10 @@
 
 static const int ECU_SPEED = 10400;
 
+// Runs the other bus probes while 5 baud init holds the K-line,
+// returns true if the init should be abandoned
+typedef bool (*ProbeCallbackT)();
+
 class EcuUart;
 class Timer;
 class LongTimer;
@@ -32,19 +36,38 @@ public:
     virtual void sendHeartBeat();
     virtual int getProtocol() const { return protocol_; }
     virtual void kwDisplay();
+    virtual void onConfigChange(int parameter);
+    void setProbeCallback(ProbeCallbackT callback) { probeCallback_ = callback; }
+    bool probeOverrun() const { return probeOverrun_; }
 private:
     IsoSerialAdapter();
     bool ecuSlowInit();
     bool ecuFastInit();
+    bool holdBit(uint32_t interval);
     void setKeepAlive();
     void checkP3Timeout();
     bool isKeepAlive();
     bool sendToEcu(const Ecumsg* msg, int p4Timeout);
-    void receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout);
+    bool receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout, bool kwpFrame = false);
+    bool isKwpProtocol() const { return protocol_ == PROT_ISO14230 || protocol_ == PROT_ISO14230_5BPS; }
     void configureProperties();
     int  onConnectEcuSlow(int protocol);
     int  onConnectEcuFast(int protocol);
     int  getP2MaxTimeout() const;
+    void negotiateTiming();
+    void resetTiming();
+    void startHeartBeat();
+    bool sendReply(Ecumsg* msg);
+    int  flushReplies(Ecumsg* msg, int numFrames);
+    Ecumsg* wakeupMessage() const;
+    bool resumeSession(int protocol, bool& fastInitDone);
+    bool isSessionReply(const Ecumsg* msg, bool frameOk, uint8_t service) const;
+    void invalidateSession();
+    void saveSession();
+    void storeSession();
+    void cancelHeartBeat();
+    
+    enum HeartBeatState { HB_IDLE, HB_SENDING, HB_RECEIVING };
     int  get2MaxLen() const;
 
     bool     kwCheck_;
@@ -52,10 +75,23 @@ private:
     uint8_t  isoKwrds_[2];
     int      protocol_;
     uint8_t  isoInitByte_;
+    uint32_t baud_;
     uint32_t wakeupTime_;
     EcuUart* uart_;
     LongTimer* keepAliveTimer_;
     Timer*   p3Timer_;
+    ProbeCallbackT probeCallback_;
+    int      p2Max_; // The negotiated timing, ms
+    int      p3Min_;
+    int      p4_;
+    HeartBeatState hbState_;
+    uint32_t lastTraffic_;
+    Ecumsg*  hbMsg_;
+    bool     initAborted_;
+    bool     probeOverrun_; // The probe stretched 5bps bit, the init is aborted
+    uint8_t  ecuAddr_;      // The init responder address, 0 if unknown
+    bool     orderedReply_; // AT#RO1
+    bool     allowLong_;    // ATAL
 };
 
 #endif //__ISO_SERIAL_H__
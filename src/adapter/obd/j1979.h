@@ -19,6 +19,7 @@ enum IsoTimeouts {
     P1_MAX_TIMEOUT     =  20,
     P2_MAX_TIMEOUT     =  50,
     P3_MIN_TIMEOUT     =  55,
+    P3_MAX_TIMEOUT     =  5000,
     W4_TIMEOUT         =  33,
     P4_TIMEOUT         =  7,
     KEEP_ALIVE_MAX_NUM =  5, // Disconnect after 5 failed,
@@ -21,6 +21,8 @@ static const char Err5Message[] = "FB ERROR";          // Wiring
 static const char Err6Message[] = "BUS BUSY";          // Bus collision or busy
 static const char Err7Message[] = "BUS ERROR";         // Bus error
 static const char Err8Message[] = "DATA ERROR>";       // Checksum
+static const char Err9Message[] = "STOPPED";           // Interrupted by the host
+static const char Err10Message[] = "BUFFER FULL";      // Receive overflow
 static const char Err0Message[] = "Program Error";     // Wrong coding?
 
 
@@ -118,9 +120,17 @@ int OBDProfile::setProtocol(int num, bool refreshConnection)
  * @param[in] cmdString The command
  * @return The status code
  */
-void OBDProfile::onRequest(const string& cmdString)
+void OBDProfile::onRequest(string_view cmdString)
+{
+    sendReplyCode(onRequestImpl(cmdString));
+}    
+
+/**
+ * Send the completion status to the host
+ * @param[in] result The status code
+ */
+void OBDProfile::sendReplyCode(int result)
 {
-    int result = onRequestImpl(cmdString);
     switch(result) {
         case REPLY_CMD_WRONG:
             AdptSendReply(ErrMessage);
@@ -149,6 +159,12 @@ void OBDProfile::onRequest(const string& cmdString)
         case REPLY_WIRING_ERROR:
             AdptSendReply(Err5Message);
             break;        
+        case REPLY_STOPPED:
+            AdptSendReply(Err9Message);
+            break;
+        case REPLY_BUFFER_FULL:
+            AdptSendReply(Err10Message);
+            break;
         case REPLY_NONE:
             break;
         default:
@@ -162,7 +178,7 @@ void OBDProfile::onRequest(const string& cmdString)
  * @param[in] cmdString The command
  * @return The status code
  */
-int OBDProfile::onRequestImpl(const string& cmdString)
+int OBDProfile::onRequestImpl(string_view cmdString)
 {
     const char* OBD_TEST_SEQ = "0100";
     uint8_t data[OBD_IN_MSG_LEN];
@@ -254,6 +270,25 @@ int OBDProfile::kwDisplay()
     return REPLY_OK;
 }
 
+/**
+ * J1850 PWM transmit statistics, applies only to PWM adapter
+ */
+void OBDProfile::busStatDisplay()
+{
+    ProtocolAdapter::getAdapter(ADPTR_PWM)->busStatDisplay();
+}
+
+/**
+ * Monitor the bus traffic until the host sends any character, implemented only
+ * in J1850 adapters
+ * @param[in] filter The filter type
+ * @param[in] addr The receiver or transmitter address
+ */
+void OBDProfile::monitor(int filter, uint8_t addr)
+{
+    sendReplyCode(adapter_->onMonitor(filter, addr));
+}
+
 /**
  * ISO 9141/14230 hearbeat, implemented only in ISO serial adapter
  */
@@ -280,4 +315,27 @@ ProtocolAdapter::ProtocolAdapter()
 { 
     connected_ = false;
     config_ = AdapterConfig::instance();
+    timeout_ = config_->getIntProperty(PAR_TIMEOUT);
+    showHeader_ = config_->getBoolProperty(PAR_HEADER_SHOW);
+    separator_ = config_->getBoolProperty(PAR_SPACES) ? ' ' : 0;
+    config_->addObserver(this);
+}
+
+/**
+ * Update the cached configuration values
+ * @param[in] parameter The changed property
+ */
+void ProtocolAdapter::onConfigChange(int parameter)
+{
+    switch (parameter) {
+        case PAR_TIMEOUT:
+            timeout_ = config_->getIntProperty(PAR_TIMEOUT);
+            break;
+        case PAR_HEADER_SHOW:
+            showHeader_ = config_->getBoolProperty(PAR_HEADER_SHOW);
+            break;
+        case PAR_SPACES:
+            separator_ = config_->getBoolProperty(PAR_SPACES) ? ' ' : 0;
+            break;
+    }
 }
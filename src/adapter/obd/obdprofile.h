@@ -22,13 +22,16 @@ public:
     void sendHeartBeat();
     void dumpBuffer();
     void closeProtocol();
-    void onRequest(const util::string& cmdString);
+    void onRequest(util::string_view cmdString);
     int getProtocol() const;
     void wiringCheck();
     int kwDisplay();
+    void busStatDisplay();
+    void monitor(int filter, uint8_t addr);
 private:
+    void sendReplyCode(int result);
     bool sendLengthCheck(const uint8_t* msg, int len);
-    int onRequestImpl(const util::string& cmdString);
+    int onRequestImpl(util::string_view cmdString);
     ProtocolAdapter* adapter_;
 };
 
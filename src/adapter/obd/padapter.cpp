@@ -83,8 +83,48 @@ void ProtocolAdapter::appendToHistory(const Ecumsg* msg)
 void ProtocolAdapter::dumpBuffer()
 {
     for (int i = 0; i < sizeof(history_); i += ITEM_LEN) {
-        string str;
-        to_ascii(history_ + i, ITEM_LEN, str);
+        ReplyString str;
+        to_ascii(history_ + i, ITEM_LEN, str, separator_);
         AdptSendReply(str);
     }
 }
+
+/**
+ * Check the monitored frame header "priority/target/source" against the filter
+ * @param[in] msg The frame with header
+ * @param[in] filter The filter type
+ * @param[in] addr The receiver or transmitter address
+ * @return true if frame should be displayed
+ */
+bool ProtocolAdapter::monitorMatch(const Ecumsg* msg, int filter, uint8_t addr)
+{
+    if (msg->length() < 3)
+        return false;
+    switch (filter) {
+        case MON_RECEIVER:
+            return msg->data()[1] == addr;
+        case MON_TRANSMITTER:
+            return msg->data()[2] == addr;
+        default:
+            return true;
+    }
+}
+
+/**
+ * Send the monitored frame to the host. The header/checksum are stripped if option
+ * "Send Header" is not set, the IFR bytes are shown only with headers on.
+ * @param[in] msg The frame with header or IFR bytes
+ * @param[in] ifr The IFR flag
+ */
+void ProtocolAdapter::sendMonitorReply(Ecumsg* msg, bool ifr)
+{
+    ReplyString str;
+    
+    if (!showHeader_) {
+        if (ifr)
+            return;
+        msg->stripHeaderAndChecksum();
+    }
+    msg->toString(str, separator_);
+    AdptSendReply(str);
+}
@@ -24,7 +24,17 @@ enum ReplyTypes {
     REPLY_BUS_BUSY,
     REPLY_BUS_ERROR,
     REPLY_CHKS_ERROR,
-    REPLY_WIRING_ERROR
+    REPLY_WIRING_ERROR,
+    REPLY_STOPPED,
+    REPLY_BUFFER_FULL
+};
+
+// Monitor filters
+//
+enum MonitorFilters {
+    MON_ALL,
+    MON_RECEIVER,
+    MON_TRANSMITTER
 };
 
 // Protocols
@@ -53,7 +63,7 @@ enum AdapterTypes {
    ADPTR_CAN_EXT
 };
 
-class ProtocolAdapter {
+class ProtocolAdapter : public ConfigObserver {
 public:
     static ProtocolAdapter* getAdapter(int adapterType);
     virtual int onConnectEcu(bool sendReply) = 0;
@@ -69,13 +79,22 @@ public:
     virtual void sendHeartBeat() {}
     virtual int getProtocol() const = 0;
     virtual void kwDisplay() {}
+    virtual void busStatDisplay() {}
+    virtual int onMonitor(int filter, uint8_t addr) { return REPLY_CMD_WRONG; }
+    virtual void onConfigChange(int parameter);
     bool isConnected() const { return connected_; }
 protected:
     static void insertToHistory(const Ecumsg* msg);
     static void appendToHistory(const Ecumsg* msg);
+    static bool monitorMatch(const Ecumsg* msg, int filter, uint8_t addr);
+    void sendMonitorReply(Ecumsg* msg, bool ifr);
     ProtocolAdapter();
     bool           connected_;
     AdapterConfig* config_;
+    // Cached configuration, updated by onConfigChange()
+    uint32_t       timeout_;    // ATST value, 0 for protocol default
+    bool           showHeader_; // ATH1
+    char           separator_;  // Space with ATS1, 0 otherwise
 private:
     const static int HISTORY_LEN = 256;
     const static int ITEM_LEN    = 16;
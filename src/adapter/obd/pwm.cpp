@@ -5,7 +5,7 @@
  *
  */
 
-#include <memory>
+#include <cstdio>
 #include <adaptertypes.h>
 #include <GpioDrv.h>
 #include <Timer.h>
@@ -19,6 +19,10 @@ PwmAdapter::PwmAdapter()
 {
     driver_ = PwmDriver::instance();
     timer_ = Timer::instance(0);
+    decState_ = DEC_IDLE;
+    frameHead_ = frameTail_ = 0;
+    frameOverrun_ = false;
+    memset(&stat_, 0, sizeof(stat_));
 }
 
 /**
@@ -37,37 +41,29 @@ void PwmAdapter::close()
     connected_ = false;
 }
 
+// The bit widths [bit value] as active/passive pairs, minus one SCT tick
+static const uint16_t PwmSymbols[2][2] = {
+    { TP2_TX_NOM - 1, TP3_TX_NOM - TP2_TX_NOM - 1 }, // "0"
+    { TP1_TX_NOM - 1, TP3_TX_NOM - TP1_TX_NOM - 1 }  // "1"
+};
+static const uint16_t PwmSof[2] = { TP7_TX_NOM - 1, TP4_TX_NOM - TP7_TX_NOM - 1 };
+static uint16_t txPulses[2 * (1 + 8 * J1850_BYTES_MAX)];
+
 /**
- * Send a byte over PWM
+ * Convert the byte into PWM pulse width pairs
  * @param[in] val Byte to send
- * @returns true if OK, false if arbitration was lost
+ * @param[out] pulses The pulse width pairs
+ * @return The number of bits added
  */
-bool PwmAdapter::sendByte(uint8_t val)
+static int AddByte(uint8_t val, uint16_t* pulses)
 {
     for (int i = 0; i < 8; i++) {
-        if (val & 0x80) {
-            // Send "1"
-            driver_->sendPulsePwm(TP1_TX_NOM, TP3_TX_NOM-TP1_TX_NOM);
-        }
-        else {
-            // Send "0"
-            driver_->sendPulsePwm(TP2_TX_NOM, TP3_TX_NOM-TP2_TX_NOM);
-        }
-        //if (driver_->getBit()) {
-        //    return false; // Arbitration lost
-        //}
+        const uint16_t* symbol = PwmSymbols[(val >> 7) & 0x01];
+        *(pulses++) = symbol[0];
+        *(pulses++) = symbol[1];
         val = val << 1;
     }
-    return true;
-}
-
-/**
- * Send PWM SOF pulse
- */
-void PwmAdapter::sendSof()
-{
-    driver_->stop();
-    driver_->sendPulsePwm(TP7_TX_NOM, TP4_TX_NOM-TP7_TX_NOM);
+    return 8;
 }
 
 /**
@@ -100,7 +96,9 @@ int PwmAdapter::getIfr()
 }
 
 /**
- * Send buffer to ECU using PWM
+ * Send buffer to ECU using PWM. The frame is converted into the pulse widths
+ * table up front and transmitted by SCT interrupt. If arbitration is lost the frame
+ * is retransmitted when the bus becomes idle again, up to RETRANSMIT_MAX times.
  * @param[in] msg Message to send
  * @return  1 if success, -1 if arbitration lost or bus busy, 0 if error getting IFR
  */
@@ -109,27 +107,39 @@ int PwmAdapter::sendToEcu(const Ecumsg* msg)
     // For buffer dump
     insertToHistory(msg);
 
-    // Wait for bus to be inactive
-    //
-    if(!driver_->wait4Ready(TP5_TX_MIN, TP6_TX_NOM, timer_)) {
-        driver_->stop();
-        return -1; // Bus busy
+    int len = (msg->length() < J1850_BYTES_MAX) ? msg->length() : J1850_BYTES_MAX;
+    int count = 1;
+    txPulses[0] = PwmSof[0];
+    txPulses[1] = PwmSof[1];
+    for (int i = 0; i < len; i++) {
+        count += AddByte(msg->data()[i], txPulses + count * 2);
     }
-    
-    TX_LED(true);  // Turn the transmit LED on
-    
-    sendSof();
-    
-    for (int i = 0; i < msg->length(); i++) {
-        if (!sendByte(msg->data()[i])) {
-            TX_LED(false); // Turn the transmit LED off
+
+    for (int attempt = 0; ; attempt++) {
+        // Wait for bus to be inactive
+        //
+        if(!driver_->wait4Ready(TP5_TX_MIN, TP6_TX_NOM, timer_)) {
             driver_->stop();
-            return -1;     // Lost arbitration
+            stat_.failures++;
+            return -1; // Bus busy
         }
+        
+        TX_LED(true);  // Turn the transmit LED on
+        driver_->startTxPwm(txPulses, count);
+        int sts = driver_->waitTx();
+        TX_LED(false); // Turn the transmit LED off
+        if (sts > 0)
+            break;
+        
+        // Lost arbitration, the other frame is on the bus
+        stat_.collisions++;
+        if (attempt == RETRANSMIT_MAX) {
+            stat_.failures++;
+            return -1;
+        }
+        stat_.retries++;
     }
-    
-    driver_->sendEodPwm();
-    TX_LED(false); // Turn the transmit LED off
+    stat_.frames++;
 
     // Get IFR byte
     int ifrStatus = getIfr();
@@ -155,7 +165,9 @@ bool PwmAdapter::waitForSof()
 void PwmAdapter::sendIfr()
 {
     Delay1us(15);
-    sendByte(0xF1);
+    int count = AddByte(0xF1, txPulses);
+    driver_->startTxPwm(txPulses, count);
+    driver_->waitTx();
 }
 
 /**
@@ -202,6 +214,186 @@ exte: // Invalid pulse width, BUS_ERROR
     return -1;
 }
 
+/**
+ * Start capturing the bus pulses and reset the decoder, the frames are queued
+ * until retrieved by receiveFrame. Used by the monitor, the request/reply flow
+ * is measuring the pulses directly to respond with IFR in time.
+ */
+void PwmAdapter::startReceiver()
+{
+    decState_ = DEC_IDLE;
+    frameHead_ = frameTail_ = 0;
+    frameOverrun_ = false;
+    driver_->startRx(TP4_RX_MAX);
+}
+
+/**
+ * Put the decoded frame or IFR bytes into the frame queue
+ * @param[in] ifr The IFR flag
+ */
+void PwmAdapter::queueFrame(bool ifr)
+{
+    int next = (frameHead_ + 1) & (FRAME_QUEUE_LEN - 1);
+    if (next == frameTail_) {
+        frameOverrun_ = true;
+        return;
+    }
+    decFrame_.ifr = ifr;
+    frames_[frameHead_] = decFrame_;
+    frameHead_ = next;
+}
+
+/**
+ * Decoder state machine, turn the captured pulses into bytes and frames. The bit value
+ * is given by the active pulse width, the long passive pulse is EOD followed by
+ * IFR bytes, the bus idle timeout is EOF.
+ * @param[in] pulse The pulse width with flags
+ */
+void PwmAdapter::decodePulse(uint32_t pulse)
+{
+    uint32_t width = pulse & PwmDriver::PULSE_WIDTH;
+    bool active = pulse & PwmDriver::PULSE_ACTIVE;
+    
+    if (pulse & PwmDriver::PULSE_TIMEOUT) { // EOF
+        if (decState_ != DEC_IDLE && decBits_ == 0 && decFrame_.length > 0) {
+            queueFrame(decState_ == DEC_IFR);
+        }
+        decState_ = DEC_IDLE;
+        RX_LED(0); // Turn the receive LED off
+        return;
+    }
+
+    switch (decState_) {
+        case DEC_IDLE: // Looking for SOF
+            if (active && width >= TP7_RX_MIN && width <= TP7_RX_MAX) {
+                decState_ = DEC_DATA;
+                decFrame_.length = 0;
+                decBits_ = 0;
+                decByte_ = 0;
+                RX_LED(1); // Turn the receive LED on
+            }
+            break;
+
+        case DEC_DATA:
+        case DEC_IFR:
+            if (!active) {
+                if (width <= TP3_RX_MAX) // The passive part of the bit
+                    break;
+                // EOD, the frame is completed if on byte boundary, IFR could follow
+                bool valid = (decBits_ == 0 && decFrame_.length > 0);
+                if (valid) {
+                    queueFrame(decState_ == DEC_IFR);
+                }
+                if (valid && decState_ == DEC_DATA) {
+                    decState_ = DEC_IFR;
+                    decFrame_.length = 0;
+                }
+                else {
+                    decState_ = DEC_IDLE;
+                    RX_LED(0);
+                }
+                break;
+            }
+            if (width > TP2_RX_MAX || decFrame_.length >= OBD_IN_MSG_LEN) {
+                decState_ = DEC_IDLE; // Invalid pulse width or too long, drop the frame
+                RX_LED(0);
+                break;
+            }
+            decByte_ = (decByte_ << 1) | ((width < TP2_RX_MIN) ? 1 : 0);
+            if (++decBits_ == 8) {
+                decFrame_.data[decFrame_.length++] = decByte_;
+                decBits_ = 0;
+                decByte_ = 0;
+            }
+            break;
+    }
+}
+
+/**
+ * Receives the next frame captured by interrupt driven receiver. Sleeps between
+ * the captured pulses and decodes them until the frame is available or timer expired.
+ * @param[out] msg Message to receive
+ * @param[in] maxlen Maximum message length
+ * @return 0 if timeout, 1 if frame, 2 if IFR bytes
+ */
+int PwmAdapter::receiveFrame(Ecumsg* msg, int maxLen)
+{
+    msg->length(0); // Reset the buffer byte length
+    
+    for (;;) {
+        uint32_t pulse;
+        while (driver_->getPulse(pulse)) {
+            decodePulse(pulse);
+        }
+        if (frameHead_ != frameTail_)
+            break;
+        if (!driver_->waitPulse(timer_))
+            return 0; // Timeout, no frame
+    }
+
+    const PwmFrame& frame = frames_[frameTail_];
+    bool ifr = frame.ifr;
+    msg->setData(frame.data, (frame.length < maxLen) ? frame.length : maxLen);
+    frameTail_ = (frameTail_ + 1) & (FRAME_QUEUE_LEN - 1);
+    if (ifr)
+        return 2;
+    appendToHistory(msg); // Save data for buffer dump
+    return 1;
+}
+
+/**
+ * Listen to the bus and send all the valid frames to the host, until any
+ * character received from the host. No IFR is sent in this mode.
+ * @param[in] filter The filter type
+ * @param[in] addr The receiver or transmitter address
+ * @return The completion status
+ */
+int PwmAdapter::onMonitor(int filter, uint8_t addr)
+{
+    const int HostCheckInterval = 100; // ms
+    bool frameShown = false;
+    int sts = REPLY_STOPPED;
+    
+    EcumsgPtr msg(Ecumsg::PWM);
+    if (!msg.get())
+        return REPLY_ERROR;
+    
+    AdptCheckHostInput(); // Discard the previous input
+    startReceiver();
+    while (!AdptCheckHostInput()) {
+        timer_->start(HostCheckInterval);
+        int frameType = receiveFrame(msg.get(), OBD_IN_MSG_LEN);
+        if (frameType == 2) { // IFR bytes belong to the previous frame
+            if (frameShown) {
+                sendMonitorReply(msg.get(), true);
+            }
+        }
+        else if (frameType == 1) {
+            frameShown = msg->checksumValid() && monitorMatch(msg.get(), filter, addr);
+            if (frameShown) {
+                sendMonitorReply(msg.get(), false);
+            }
+        }
+        if (frameOverrun_) {
+            sts = REPLY_BUFFER_FULL;
+            break;
+        }
+    }
+    driver_->stopRx();
+    return sts;
+}
+
+/**
+ * Display the transmit statistics
+ */
+void PwmAdapter::busStatDisplay()
+{
+    char out[64];
+    sprintf(out, "TX:%u COLL:%u RETRY:%u FAIL:%u", (unsigned)stat_.frames, 
+            (unsigned)stat_.collisions, (unsigned)stat_.retries, (unsigned)stat_.failures);
+    AdptSendReply(out);
+}
+
 /**
  * PWM request handler
  * @param[in] data command 
@@ -236,9 +428,11 @@ int PwmAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
 {
     int p2Timeout = getP2MaxTimeout();
     bool gotReply = false;
-    util::string str;
+    ReplyString str;
     
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(Ecumsg::PWM));
+    EcumsgPtr msg(Ecumsg::PWM);
+    if (!msg.get())
+        return REPLY_ERROR;
     
     msg->setData(data, len);
     msg->addHeaderAndChecksum();
@@ -275,16 +469,18 @@ int PwmAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
         // OK, got OBD message, reset timer
         timer_->start(p2Timeout);
         
+        // Was the message OK?
+        if (!msg->checksumValid()) {
+            return REPLY_CHKS_ERROR;
+        }
+
         // Extract the ISO message if option "Send Header" not set
-        if (!config_->getBoolProperty(PAR_HEADER_SHOW)) {
-            // Was the message OK?
-            if (!msg->stripHeaderAndChecksum()) {
-                return REPLY_CHKS_ERROR;
-            }
+        if (!showHeader_) {
+            msg->stripHeaderAndChecksum();
         }
 
         if (sendReply && msg->length() > 0) {
-            msg->toString(str);
+            msg->toString(str, separator_);
             AdptSendReply(str);
         }
         str.resize(0);
@@ -301,8 +497,7 @@ int PwmAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
  */
 int PwmAdapter::getP2MaxTimeout() const
 {
-    int p2Timeout = config_->getIntProperty(PAR_TIMEOUT);
-    return p2Timeout ? p2Timeout : P2_J1850;
+    return timeout_ ? timeout_ : P2_J1850;
 }
 
 /**
@@ -23,8 +23,24 @@ public:
     virtual void close();
     virtual void wiringCheck();
     virtual int onConnectEcu(bool sendReply);
+    virtual int onMonitor(int filter, uint8_t addr);
+    virtual void busStatDisplay();
     virtual int getProtocol() const { return PROT_J1850_PWM; }
 private:
+    const static int FRAME_QUEUE_LEN = 8; // Should be power of 2
+    const static int RETRANSMIT_MAX = 3;
+    enum DecoderState { DEC_IDLE, DEC_DATA, DEC_IFR };
+    struct TxStatistics {
+        uint32_t frames;     // Frames sent
+        uint32_t collisions; // Arbitration lost
+        uint32_t retries;    // Retransmit attempts
+        uint32_t failures;   // Frames not sent
+    };
+    struct PwmFrame {
+        uint8_t length;
+        bool    ifr;
+        uint8_t data[OBD_IN_MSG_LEN];
+    };
     PwmAdapter();
     bool waitForSof();
     int receiveByte(uint8_t& val);
@@ -33,11 +49,22 @@ private:
     int receiveFromEcu(Ecumsg* msg, int maxLen);
     int getP2MaxTimeout() const;
     int requestImpl(const uint8_t* data, int len, bool sendReply);
-    bool sendByte(uint8_t val);
-    void sendSof();
     void sendIfr();
+    void startReceiver();
+    void decodePulse(uint32_t pulse);
+    void queueFrame(bool ifr);
+    int receiveFrame(Ecumsg* msg, int maxLen);
     Timer*     timer_;
     PwmDriver* driver_;
+    DecoderState decState_;
+    uint8_t    decByte_;
+    int        decBits_;
+    PwmFrame   decFrame_;
+    PwmFrame   frames_[FRAME_QUEUE_LEN];
+    int        frameHead_;
+    int        frameTail_;
+    bool       frameOverrun_;
+    TxStatistics stat_;
 };
 
 #endif //__PWM_H__
@@ -5,7 +5,6 @@
  *
  */
 
-#include <memory>
 #include <adaptertypes.h>
 #include <GpioDrv.h>
 #include <Timer.h>
@@ -19,6 +18,10 @@ VpwAdapter::VpwAdapter()
 {
     driver_ = PwmDriver::instance();
     timer_ = Timer::instance(0);
+    decState_ = DEC_IDLE;
+    frameHead_ = frameTail_ = 0;
+    frameOverrun_ = false;
+    highSpeed_ = false;
 }
 
 /**
@@ -27,6 +30,7 @@ VpwAdapter::VpwAdapter()
 void VpwAdapter::open()
 {
     driver_->open(true);
+    setHighSpeed(config_->getBoolProperty(PAR_VPW_HIGH_SPEED));
 }
 
 /**
@@ -35,10 +39,51 @@ void VpwAdapter::open()
 void VpwAdapter::close()
 {
     connected_ = false;
+    setHighSpeed(config_->getBoolProperty(PAR_VPW_HIGH_SPEED));
 }
 
 /**
- * Send buffer to ECU using VPW
+ * Switch between 10.4 kbit/s and 41.6 kbit/s (4x) mode. The same timing constants
+ * are used, the driver clock is changed.
+ * @param[in] val true for 4x mode
+ */
+void VpwAdapter::setHighSpeed(bool val)
+{
+    highSpeed_ = val;
+    driver_->setHighSpeedVpw(val);
+}
+
+/**
+ * Follow the bus speed change commanded by the message, either sent or received.
+ * Mode $A1 starts 4x mode, mode $20 returns to normal mode.
+ * @param[in] msg The message with header
+ */
+void VpwAdapter::checkSpeedChange(const Ecumsg* msg)
+{
+    const uint8_t BeginHighSpeed = 0xA1;
+    const uint8_t ReturnToNormal = 0x20;
+    
+    if (msg->length() < 4)
+        return;
+    uint8_t mode = msg->data()[3];
+    if (mode == BeginHighSpeed && !highSpeed_) {
+        setHighSpeed(true);
+    }
+    else if (mode == ReturnToNormal && highSpeed_) {
+        setHighSpeed(false);
+    }
+}
+
+// The symbol widths [active][bit value], the first symbol after SOF is passive
+static const uint16_t VpwSymbols[2][2] = {
+    { TV1_TX_NOM, TV2_TX_NOM }, // passive, "0" is short
+    { TV2_TX_NOM, TV1_TX_NOM }  // active,  "1" is short
+};
+static uint16_t txPulses[1 + 8 * J1850_BYTES_MAX];
+
+/**
+ * Send buffer to ECU using VPW. The frame is converted into the pulse widths
+ * table up front and transmitted by SCT interrupt.
  * @param[in] msg Message to send
  * @return  1 if success, -1 if arbitration lost, 0 if bus busy
  */
@@ -46,6 +91,17 @@ int VpwAdapter::sendToEcu(const Ecumsg* msg)
 {
     insertToHistory(msg); // Buffer dump
     
+    int len = (msg->length() < J1850_BYTES_MAX) ? msg->length() : J1850_BYTES_MAX;
+    int count = 0;
+    txPulses[count++] = TV3_TX_NOM; // SOF pulse, 200us
+    for (int i = 0; i < len; i++) {
+        uint8_t ch = msg->data()[i];
+        for (int bit = 0; bit < 8; bit++) {
+            txPulses[count++] = VpwSymbols[bit & 0x01][(ch >> 7) & 0x01];
+            ch <<= 1;
+        }
+    }
+    
     // Wait for bus to be inactive
     //
     if (!driver_->wait4Ready(TV6_TX_NOM, TV4_TX_MIN, timer_)) {
@@ -53,116 +109,184 @@ int VpwAdapter::sendToEcu(const Ecumsg* msg)
     }
 
     TX_LED(true);  // Turn the transmit LED on
+    driver_->startTxVpw(txPulses, count);
+    int sts = driver_->waitTx();
+    TX_LED(false); // Turn the transmit LED off
+    return sts;
+}
 
-    // SOF pulse
-    driver_->sendSofVpw(TV3_TX_NOM); // 200us
-  
-    for (int i = 0; i < msg->length(); i++) {
-        uint8_t ch = msg->data()[i];  // sent next byte in buffer
-        int bits = 8;
-
-        while (bits--) {  // send each bit in the byte
-            if (bits & 0x01) { // Passive, set bus to 0
-                if (ch & 0x80)  {
-                    driver_->sendPulseVpw(TV2_TX_NOM); // 128us
-                    Delay1us(TV2_TX_NOM / 2);
-                }
-                else {
-                    driver_->sendPulseVpw(TV1_TX_NOM); // 64us
-                    Delay1us(TV1_TX_NOM / 2);
-                }
-                if (driver_->getBit()) {
-                    driver_->stop();
-                    TX_LED(0); // Turn the transmit LED off
-                    return -1; // Lost arbitration
-                }
-            }
-            else {  // Active, set bus to 1
-                if (ch & 0x80) {
-                    driver_->sendPulseVpw(TV1_TX_NOM); // 64us
-                }
-                else {
-                    driver_->sendPulseVpw(TV2_TX_NOM); // 128us
-                }
-            }
-            ch <<= 1;
-        }
+/**
+ * Start capturing the bus pulses and reset the decoder, the frames are queued
+ * until retrieved by receiveFromEcu
+ */
+void VpwAdapter::startReceiver()
+{
+    decState_ = DEC_IDLE;
+    frameHead_ = frameTail_ = 0;
+    frameOverrun_ = false;
+    driver_->startRx(TV3_RX_MAX);
+}
+
+/**
+ * Put the decoded frame or IFR bytes into the frame queue
+ * @param[in] ifr The IFR flag
+ */
+void VpwAdapter::queueFrame(bool ifr)
+{
+    int next = (frameHead_ + 1) & (FRAME_QUEUE_LEN - 1);
+    if (next == frameTail_) {
+        frameOverrun_ = true;
+        return;
     }
-    
-    driver_->sendEodVpw();
-    TX_LED(false); // Turn the transmit LED off
-    return 1;
+    decFrame_.ifr = ifr;
+    frames_[frameHead_] = decFrame_;
+    frameHead_ = next;
 }
 
 /**
- * Wait for VPW SOF pulse to arrive
- * @return true if SOF, false if timeout
- * Note: Using timer_ object is for max P2 timeout
+ * Decoder state machine, turn the captured pulses into bytes and frames. The frame
+ * is completed by EOD, the active normalization bit after EOD starts IFR bytes.
+ * @param[in] pulse The pulse width with flags
  */
-bool VpwAdapter::waitForSof()
+void VpwAdapter::decodePulse(uint32_t pulse)
 {
-    for (;;) {
-        uint32_t val = driver_->wait4Sof(TV3_RX_MAX, timer_);
-        if (val == 0xFFFFFFFF) // P2 timer expired
-            return false;
-        if (val >= TV3_RX_MIN) 
+    uint32_t width = pulse & PwmDriver::PULSE_WIDTH;
+    bool active = pulse & PwmDriver::PULSE_ACTIVE;
+    bool timeout = pulse & PwmDriver::PULSE_TIMEOUT;
+    
+    switch (decState_) {
+        case DEC_IDLE: // Looking for SOF
+            if (active && !timeout && width >= TV3_RX_MIN && width <= TV3_RX_MAX) {
+                decState_ = DEC_DATA;
+                decFrame_.length = 0;
+                decBits_ = 0;
+                decByte_ = 0;
+                RX_LED(1); // Turn the receive LED on
+            }
+            break;
+
+        case DEC_NB: // Looking for IFR normalization bit
+            if (active && !timeout && width >= TV1_RX_MIN && width <= TV2_RX_MAX) {
+                decState_ = DEC_IFR;
+                decFrame_.length = 0;
+                decBits_ = 0;
+                decByte_ = 0;
+                break;
+            }
+            decState_ = DEC_IDLE;
+            RX_LED(0); // Turn the receive LED off
+            break;
+
+        case DEC_DATA:
+        case DEC_IFR:
+            if (!active && (timeout || width >= TV3_RX_MIN)) { 
+                // EOD, the frame is completed if on byte boundary
+                bool ifr = (decState_ == DEC_IFR);
+                bool valid = (decBits_ == 0 && decFrame_.length > 0);
+                if (valid) {
+                    queueFrame(ifr);
+                }
+                decState_ = (valid && !ifr && !timeout) ? DEC_NB : DEC_IDLE;
+                if (decState_ == DEC_IDLE) {
+                    RX_LED(0); // Turn the receive LED off
+                }
+                break;
+            }
+            if (timeout || width < TV1_RX_MIN || width > TV2_RX_MAX || decFrame_.length >= OBD_IN_MSG_LEN) {
+                decState_ = DEC_IDLE; // Invalid pulse width or too long, drop the frame
+                RX_LED(0);
+                break;
+            }
+            decByte_ = (decByte_ << 1) | ((width > VPW_RX_MID) ? 1 : 0);
+            if (++decBits_ == 8) {
+                decFrame_.data[decFrame_.length++] = decByte_ ^ 0x55;
+                decBits_ = 0;
+                decByte_ = 0;
+            }
             break;
     }
-    return true;
 }
 
 /**
- * Receives a sequence of bytes from the VPW ECU
- * @return 0 if timeout, 1 if OK, -1 if bus error
+ * Receives the next frame from the VPW ECU. Sleeps between the captured pulses
+ * and decodes them until the frame is available or timer expired.
+ * @param[out] msg Message to receive
+ * @param[in] maxlen Maximum message length
+ * @return 0 if timeout, 1 if frame, 2 if IFR bytes
  */
 int VpwAdapter::receiveFromEcu(Ecumsg* msg, int maxLen)
 {
-    uint8_t* ptr = msg->data();
     msg->length(0); // Reset the buffer byte length
     
-    // Wait SOF
-    if (!waitForSof()) {
-        return 0; // Timeout, no SOF
+    for (;;) {
+        uint32_t pulse;
+        while (driver_->getPulse(pulse)) {
+            decodePulse(pulse);
+        }
+        if (frameHead_ != frameTail_)
+            break;
+        if (!driver_->waitPulse(timer_))
+            return 0; // Timeout, no frame
     }
 
-    RX_LED(1); // Turn the receive LED on
-
-    int i;
-    for(i = 0; i < maxLen; i++) { // Only retrieve maxLen bytes
-        int bits = 8;
-        uint8_t ch = 0;
-        bool state = false;
-        uint32_t pulse = 0;
+    const VpwFrame& frame = frames_[frameTail_];
+    bool ifr = frame.ifr;
+    msg->setData(frame.data, (frame.length < maxLen) ? frame.length : maxLen);
+    frameTail_ = (frameTail_ + 1) & (FRAME_QUEUE_LEN - 1);
+    if (ifr)
+        return 2;
+    appendToHistory(msg); // Save data for buffer dump
+    return 1;
+}
 
-        while (bits--) {
-            ch <<= 1;
-            pulse = driver_->wait4BusChangeVpw();
-            if (!pulse) {
-                goto extr; // EOD Max expired, terminate receive on timeout
+/**
+ * Listen to the bus and send all the valid frames to the host, until any
+ * character received from the host. The receiver is never transmitting.
+ * @param[in] filter The filter type
+ * @param[in] addr The receiver or transmitter address
+ * @return The completion status
+ */
+int VpwAdapter::onMonitor(int filter, uint8_t addr)
+{
+    const int HostCheckInterval = 100; // ms
+    bool frameShown = false;
+    int sts = REPLY_STOPPED;
+    
+    EcumsgPtr msg(Ecumsg::VPW);
+    if (!msg.get())
+        return REPLY_ERROR;
+    
+    AdptCheckHostInput(); // Discard the previous input
+    startReceiver();
+    while (!AdptCheckHostInput()) {
+        timer_->start(HostCheckInterval);
+        int frameType = receiveFromEcu(msg.get(), OBD_IN_MSG_LEN);
+        if (frameType == 2) { // IFR bytes belong to the previous frame
+            if (frameShown) {
+                sendMonitorReply(msg.get(), true);
             }
-            state = !state;
-            if (pulse < TV1_RX_MIN) {
-                goto exte; // pulse is too short
+        }
+        else if (frameType == 1) {
+            bool valid = msg->checksumValid();
+            bool highSpeed = highSpeed_;
+            if (valid) {
+                checkSpeedChange(msg.get()); // Follow the bus speed
+            }
+            frameShown = valid && monitorMatch(msg.get(), filter, addr);
+            if (frameShown) {
+                sendMonitorReply(msg.get(), false);
             }
-            if (pulse > TV2_RX_MAX) {
-                goto exte; // pulse is too long
+            if (highSpeed != highSpeed_) {
+                startReceiver();
             }
-            ch |= (pulse > VPW_RX_MID) ? 1 : 0;
         }
-        *(ptr++) = ch ^ 0x55;
+        if (frameOverrun_) {
+            sts = REPLY_BUFFER_FULL;
+            break;
+        }
     }
-
-extr: // ok
-    driver_->stop();
-    msg->length(i);
-    RX_LED(false);        // Turn the receive LED off
-    appendToHistory(msg); // Save data for buffer dump
-    return 1;
-
-exte: // Invalid pulse width, BUS_ERROR
-    driver_->stop();
-    RX_LED(false);  // Turn the receive LED off
-    return -1;
+    driver_->stopRx();
+    return sts;
 }
 
 /**
@@ -199,9 +323,11 @@ int VpwAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
 {
     int p2Timeout = getP2MaxTimeout();
     bool gotReply = false;
-    util::string str;
+    ReplyString str;
 
-    unique_ptr<Ecumsg> msg(Ecumsg::instance(Ecumsg::VPW));
+    EcumsgPtr msg(Ecumsg::VPW);
+    if (!msg.get())
+        return REPLY_ERROR;
 
     msg->setData(data, len);
     msg->addHeaderAndChecksum();
@@ -218,19 +344,34 @@ int VpwAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
             return REPLY_BUS_BUSY;
     }
 
+    // The speed change is effective after the message
+    checkSpeedChange(msg.get());
+
     // Set the reply operation timeout
     timer_->start(p2Timeout);
+    startReceiver();
     do {
         int sts = receiveFromEcu(msg.get(), OBD_IN_MSG_LEN);
-        if (sts == -1) { // Bus timing error
-            continue;
-        }
         if (sts == 0) {  // Timeout
             break;
         }
+        if (sts == 2) {  // IFR bytes
+            continue;
+        }
+        
         if (msg->length() < OBD2_BYTES_MIN || msg->length() > OBD2_BYTES_MAX) {
             continue;
         }
+        
+        // Other node could command the speed change, only the valid frame is trusted
+        bool valid = msg->checksumValid();
+        if (valid) {
+            bool highSpeed = highSpeed_;
+            checkSpeedChange(msg.get());
+            if (highSpeed != highSpeed_) {
+                startReceiver();
+            }
+        }
         if (msg->data()[1] != expct2ndByte) { // ignore all replies but expected
             continue;
         }
@@ -238,21 +379,25 @@ int VpwAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
         // OK, got OBD message, reset Timer
         timer_->start(p2Timeout);
 
+        // Was the message OK?
+        if (!valid) {
+            driver_->stopRx();
+            return REPLY_CHKS_ERROR;
+        }
+
         // Extract the ISO message if option "Send Header" not set
-        if (!config_->getBoolProperty(PAR_HEADER_SHOW)) {
-            // Was the message OK?
-            if (!msg->stripHeaderAndChecksum()) {
-                return REPLY_CHKS_ERROR;
-            }
+        if (!showHeader_) {
+            msg->stripHeaderAndChecksum();
         }
 
         if (sendReply) {
-            msg->toString(str);
+            msg->toString(str, separator_);
             AdptSendReply(str);
         }
         str.resize(0);
         gotReply = true;
     } while(!timer_->isExpired());
+    driver_->stopRx();
 
     // Reply
     return gotReply ? REPLY_NONE : REPLY_NO_DATA;
@@ -264,8 +409,7 @@ int VpwAdapter::requestImpl(const uint8_t* data, int len, bool sendReply)
  */
 int VpwAdapter::getP2MaxTimeout() const
 {
-    int p2Timeout = config_->getIntProperty(PAR_TIMEOUT);
-    return p2Timeout ? p2Timeout : P2_J1850;
+    return timeout_ ? timeout_ : P2_J1850;
 }
 
 /**
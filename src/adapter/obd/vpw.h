@@ -23,16 +23,37 @@ public:
     virtual void close();
     virtual void wiringCheck();
     virtual int onConnectEcu(bool sendReply);
+    virtual int onMonitor(int filter, uint8_t addr);
     virtual int getProtocol() const { return PROT_J1850_VPW; }
 private:
+    const static int FRAME_QUEUE_LEN = 8; // Should be power of 2
+    enum DecoderState { DEC_IDLE, DEC_DATA, DEC_NB, DEC_IFR };
+    struct VpwFrame {
+        uint8_t length;
+        bool    ifr;
+        uint8_t data[OBD_IN_MSG_LEN];
+    };
     VpwAdapter();
-    bool waitForSof();
     int sendToEcu(const Ecumsg* msg);
     int receiveFromEcu(Ecumsg* msg, int maxLen);
     int getP2MaxTimeout() const;
     int requestImpl(const uint8_t* data, int len, bool sendReply);
+    void startReceiver();
+    void setHighSpeed(bool val);
+    void checkSpeedChange(const Ecumsg* msg);
+    void decodePulse(uint32_t pulse);
+    void queueFrame(bool ifr);
     Timer*     timer_;
     PwmDriver* driver_;
+    DecoderState decState_;
+    uint8_t    decByte_;
+    int        decBits_;
+    VpwFrame   decFrame_;
+    VpwFrame   frames_[FRAME_QUEUE_LEN];
+    int        frameHead_;
+    int        frameTail_;
+    bool       frameOverrun_;
+    bool       highSpeed_;
 };
 
 #endif //__VPW_H__
@@ -34,6 +34,81 @@
 
 #include <stdlib.h>
 
+#ifdef RAM_STATS
+#include <RamStats.h>
+
+HeapStats AdptHeapStats;
+
+// Prepended to every block, keeps 8 byte alignment
+struct HeapBlock {
+    uint32_t size;
+    uint32_t site;
+};
+
+static int HeapSiteIndex(uint32_t caller)
+{
+    for (int i = 0; i < HEAP_SITES_LEN - 1; i++) {
+        HeapSite& site = AdptHeapStats.sites[i];
+        if (site.caller == caller || site.caller == 0) {
+            site.caller = caller;
+            return i;
+        }
+    }
+    return HEAP_SITES_LEN - 1;
+}
+
+static void *HeapAlloc(size_t size, void *caller)
+{
+    HeapBlock *block = (HeapBlock *)malloc(size + sizeof(HeapBlock));
+    if (!block)
+        return 0;
+    block->size = size;
+    block->site = HeapSiteIndex((uint32_t)caller);
+
+    HeapSite& site = AdptHeapStats.sites[block->site];
+    site.count++;
+    site.total++;
+    site.bytes += size;
+    AdptHeapStats.allocs++;
+    AdptHeapStats.current += size;
+    if (AdptHeapStats.current > AdptHeapStats.peak)
+        AdptHeapStats.peak = AdptHeapStats.current;
+    return block + 1;
+}
+
+static void HeapFree(void *p)
+{
+    if (!p)
+        return;
+    HeapBlock *block = (HeapBlock *)p - 1;
+    HeapSite& site = AdptHeapStats.sites[block->site];
+    site.count--;
+    site.bytes -= block->size;
+    AdptHeapStats.frees++;
+    AdptHeapStats.current -= block->size;
+    free(block);
+}
+
+void *operator new(size_t size)
+{
+    return HeapAlloc(size, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size)
+{
+    return HeapAlloc(size, __builtin_return_address(0));
+}
+
+void operator delete(void *p)
+{
+    HeapFree(p);
+}
+
+void operator delete[](void *p)
+{
+    HeapFree(p);
+}
+#else
 void *operator new(size_t size)
 {
     return malloc(size);
@@ -53,6 +128,7 @@ void operator delete[](void *p)
 {
     free(p);
 }
+#endif
 
 extern "C" int __aeabi_atexit(void *object,
 		void (*destructor)(void *),
@@ -379,6 +379,25 @@ extern unsigned int __data_section_table_end;
 extern unsigned int __bss_section_table;
 extern unsigned int __bss_section_table_end;
 
+#ifdef RAM_STATS
+#include <RamStats.h>
+
+//*****************************************************************************
+// Paint the RAM between the heap start and the current stack pointer, the
+// stack high watermark is found later by the first overwritten word.
+//*****************************************************************************
+extern unsigned int _pvHeapStart;
+
+__attribute__ ((section(".after_vectors")))
+void stack_paint(unsigned int start) {
+    unsigned int marker;
+    unsigned int *pulDest = (unsigned int*) start;
+    unsigned int *pulEnd = &marker - 16; // Keep clear of the callers frames
+    while (pulDest < pulEnd)
+        *pulDest++ = STACK_PAINT_PATTERN;
+}
+#endif
+
 
 //*****************************************************************************
 // Reset entry point for your code.
@@ -412,6 +431,10 @@ ResetISR(void) {
         SectionLen = *SectionTableAddr++;
         bss_init(ExeAddr, SectionLen);
     }
+
+#ifdef RAM_STATS
+    stack_paint((unsigned int) &_pvHeapStart);
+#endif
     
     // Optionally enable Cortex-M3 SWV trace (off by default at reset)
     // Note - your board support must also set up the switch matrix 
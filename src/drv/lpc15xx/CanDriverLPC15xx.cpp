@@ -11,7 +11,8 @@
 #include <LPC15xx.h>
 #include <romapi_15xx.h>
 #include "CanDriver.h"
-#include "GPIODrv.h"
+#include "GpioDrv.h"
+#include "Profiler.h"
 #include <canmsgbuffer.h>
 #include <led.h>
 
@@ -32,6 +33,7 @@ static volatile uint32_t msgBitMask;
 extern "C" {
     void C_CAN0_IRQHandler(void)
     {
+        ProfileScope profile(PROF_ISR_CAN);
         LPC_CAND_API->hwCAN_Isr(CanDriver::handle_);
     }
 
@@ -239,6 +241,7 @@ bool CanDriver::setFilterAndMask(uint32_t filter, uint32_t mask, bool extended)
  */
 bool CanDriver::read(CanMsgBuffer* buff)
 {
+    ProfileScope profile(PROF_CAN_READ);
     CAN_MSG_OBJ msg;
     uint32_t mask = msgBitMask;
     for (int i = 1; i < 32; i++) {
@@ -23,7 +23,7 @@ public:
     static void configure();
     void irqHandler();
     void init(uint32_t speed);
-    void send(const util::string& str);
+    void send(util::string_view str);
     void send(uint8_t ch);
     bool ready() const { return ready_; }
     void ready(bool val) { ready_ = val; }
@@ -34,7 +34,6 @@ private:
     void rxIrqHandler();
 
     char txData_[TX_BUFFER_LEN];
-    util::string    rdData_;
     uint16_t        txLen_;
     uint16_t        txPos_;
     volatile bool   ready_;
@@ -7,8 +7,9 @@
 
 #include <cstring>
 #include "UartLPC15xx.h"
-#include "GPIODrv.h"
+#include "GpioDrv.h"
 #include "CmdUart.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -139,8 +140,10 @@ void CmdUart::irqHandler()
  */
 void CmdUart::send(uint8_t ch) 
 {
+    uint32_t start = Profiler::cycles();
     while (!(UARTGetStatus(LPC_USART0) & UART_STAT_TXRDY))
         ;
+    Profiler::record(PROF_CMD_SEND, start);
     UARTSendByte(LPC_USART0, ch);
 }
 
@@ -148,17 +151,19 @@ void CmdUart::send(uint8_t ch)
  * Send the string asynch
  * @parameter[in] str String to send
  */
-void CmdUart::send(const util::string& str)
+void CmdUart::send(util::string_view str)
 {
     // wait for TX interrupt disabled when the previous transmission completed
+    uint32_t start = Profiler::cycles();
     while ((UARTGetIntsEnabled(LPC_USART0) & UART_INTEN_TXRDY)) {
         ;
     }
+    Profiler::record(PROF_CMD_SEND, start);
 
     // start the new transmission 
     txPos_ = 0;
-    txLen_ = str.length();
-    memcpy(txData_, str.c_str(), txLen_);
+    txLen_ = (str.length() < TX_BUFFER_LEN) ? str.length() : TX_BUFFER_LEN;
+    memcpy(txData_, str.data(), txLen_);
     UARTIntEnable(LPC_USART0, UART_INTEN_TXRDY);
 }
 
@@ -167,6 +172,7 @@ void CmdUart::send(const util::string& str)
  */
 extern "C" void UART0_IRQHandler(void)
 {
+    ProfileScope profile(PROF_ISR_CMD_UART);
     if (CmdUart::instance())
         CmdUart::instance()->irqHandler();
 }
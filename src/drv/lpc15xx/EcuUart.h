@@ -13,22 +13,51 @@
 
 using namespace std;
 
+class Timer;
+class OneShotTimer;
+
 class EcuUart {
 public:
     static EcuUart* instance();
     static void configure();
+    void irqHandler();
     void init(uint32_t speed);
     void send(uint8_t byte);
+    bool startTx(const uint8_t* data, int len, uint32_t p4Interval);
+    bool isTxBusy() const { return txState_ == TX_ECHO || txState_ == TX_GAP; }
+    bool txResult() const { return txState_ == TX_DONE; }
+    bool waitTx();
+    void abortTx();
     uint8_t get();
-    bool getEcho(uint8_t byte);
-    bool ready();
-    void clear() {}
-    void clearRxFifo() {}
+    uint32_t getStamp() const { return rxStamp_[rxTail_]; }
+    uint32_t byteTime() const { return byteTime_; }
+    bool ready() const { return rxHead_ != rxTail_; }
+    bool wait(const Timer* timer);
+    void clear();
+    void clearRxFifo();
     void setBitBang(bool val);
     void setBit(uint32_t val);
     uint32_t getBit();
 private:
-    EcuUart() {}
+    const static int RX_RING_LEN = 64; // Should be power of 2
+    const static int TX_BUF_LEN = 32;
+    enum TxState { TX_IDLE, TX_ECHO, TX_GAP, TX_DONE, TX_ERROR };
+    EcuUart();
+    static void TxTimerHandler();
+    void txTimerHandler();
+    void sendNext();
+    volatile uint8_t  rxData_[RX_RING_LEN];
+    volatile uint32_t rxStamp_[RX_RING_LEN];
+    volatile uint16_t rxHead_;
+    volatile uint16_t rxTail_;
+    uint8_t  txData_[TX_BUF_LEN];
+    uint32_t txLen_;
+    uint32_t txP4_;
+    volatile uint32_t txPos_;
+    volatile TxState  txState_;
+    OneShotTimer*     txTimer_;
+    uint32_t byteTime_;
+    uint32_t echoTimeout_;
 };
 
 #endif //__ECU_UART_H__
@@ -8,7 +8,9 @@
 #include <cstring>
 #include "UartLPC15xx.h"
 #include "EcuUart.h"
-#include "GPIODrv.h"
+#include "GpioDrv.h"
+#include "Timer.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -17,6 +19,24 @@ const int RxPin  = 7;
 const int RxPort = 0;
 const int TxPort = 0;
 const uint32_t PinAssign = ((RxPin << 16) + (RxPort * 32)) | ((TxPin << 8)  + (TxPort * 32));
+const uint32_t EchoTimeoutBits = 208; // Using 20ms echo timeout at 10400 bit/s
+
+/**
+ * Constructor
+ */
+EcuUart::EcuUart()
+  : rxHead_(0),
+    rxTail_(0),
+    txLen_(0),
+    txP4_(0),
+    txPos_(0),
+    txState_(TX_IDLE),
+    byteTime_(0),
+    echoTimeout_(0)
+{
+    static OneShotTimer timer(TxTimerHandler);
+    txTimer_ = &timer;
+}
 
 /**
  * EcuUart singleton
@@ -62,6 +82,10 @@ void EcuUart::init(uint32_t speed)
     uint8_t uartMem[UART_MEM_LEN];
 
     NVIC_DisableIRQ(UART1_IRQn);
+    
+    // The timing in microseconds, 10 bits per byte for 8N1
+    byteTime_ = 10000000 / speed;
+    echoTimeout_ = EchoTimeoutBits * 1000000 / speed;
 
       // Setup the UART handle
     UART_HANDLE_T uartHandle =
@@ -77,6 +101,47 @@ void EcuUart::init(uint32_t speed)
 
     // Initialize the UART with the configuration parameters
     LPC_UARTD_API->uart_init(uartHandle, &cfg);
+
+    clearRxFifo();
+    NVIC_EnableIRQ(UART1_IRQn);
+    UARTIntEnable(LPC_USART1, UART_INTEN_RXRDY);
+}
+
+/**
+ * EcuUart IRQ handler, store the received byte with arrival time into ring buffer.
+ * The byte is dropped if the ring buffer is full.
+ */
+void EcuUart::irqHandler()
+{
+    if (!(UARTGetStatus(LPC_USART1) & UART_STAT_RXRDY))
+        return;
+
+    uint32_t stamp = TimeStamp::now();
+    uint8_t byte = UARTReadByte(LPC_USART1);
+    
+    // The TX and RX are interconnected, the echo is checked here and not stored
+    if (txState_ == TX_ECHO) {
+        txTimer_->stop();
+        if (byte != txData_[txPos_]) {
+            txState_ = TX_ERROR;
+        }
+        else if (++txPos_ >= txLen_) {
+            txState_ = TX_DONE;
+        }
+        else {
+            // Interbyte delay <P4 = [5-20ms]>
+            txState_ = TX_GAP;
+            txTimer_->start(txP4_);
+        }
+        return;
+    }
+    
+    uint16_t next = (rxHead_ + 1) & (RX_RING_LEN - 1);
+    if (next != rxTail_) {
+        rxData_[rxHead_] = byte;
+        rxStamp_[rxHead_] = stamp;
+        rxHead_ = next;
+    }
 }
 
 /**
@@ -90,45 +155,147 @@ void EcuUart::send(uint8_t byte)
     UARTSendByte(LPC_USART1, byte);
 }
 
+/*
+ * Reading the next byte from receive ring buffer
+ * @return The byte received
+ */
+uint8_t EcuUart::get()
+{
+    if (!ready())
+        return 0;
+    uint8_t byte = rxData_[rxTail_];
+    rxTail_ = (rxTail_ + 1) & (RX_RING_LEN - 1);
+    return byte;
+}
+
 /**
- * Checking EcuUart receive ready flag
- * @return The flag
+ * Sleep until a byte is received or timer expired
+ * @param[in] timer The timeout timer
+ * @return true if byte is ready, false if timeout
  */
-bool EcuUart::ready()
+bool EcuUart::wait(const Timer* timer)
 {
-    return (UARTGetStatus(LPC_USART1) & UART_STAT_RXRDY);
+    for (;;) {
+        // Check with interrupts disabled, pending interrupt will still wake up WFI
+        __disable_irq();
+        if (ready() || timer->isExpired()) {
+            __enable_irq();
+            break;
+        }
+        __WFI();
+        __enable_irq();
+    }
+    return ready();
 }
 
-/*
- * Reading a byte from USART
- * @return The byte received
+/**
+ * Clear the receiver overrun and error flags
  */
-uint8_t EcuUart::get()
+void EcuUart::clear()
+{
+    LPC_USART1->STAT = UART_STAT_OVERRUNINT | UART_STAT_FRM_ERRINT | UART_STAT_PAR_ERRINT | UART_STAT_RXNOISEINT;
+}
+
+/**
+ * Drop all the bytes from receive ring buffer
+ */
+void EcuUart::clearRxFifo()
 {
-    return UARTReadByte(LPC_USART1);
+    __disable_irq();
+    rxTail_ = rxHead_;
+    __enable_irq();
 }
 
 /**
- * As USART TX and RX pins are interconnected thru MC33660, sending a byte will always echo it back
- * just wait and read it back.
- * @parameter[in] byte The already sent byte to compare echo with
- * @return The completion status
+ * Start the interrupt driven transmission. As USART TX and RX pins are interconnected
+ * thru MC33660, every byte is echoed back and compared in the RX interrupt, the next byte
+ * is sent by the timer after P4 interval.
+ * @parameter[in] data The bytes to send
+ * @parameter[in] len The number of bytes
+ * @parameter[in] p4Interval The interbyte interval in microseconds
+ * @return true if started, false if busy or message too long
  */
-bool EcuUart::getEcho(uint8_t byte)
+bool EcuUart::startTx(const uint8_t* data, int len, uint32_t p4Interval)
 {
-    const uint32_t EchoTimeout = 20; // Using 20ms echo timeout
+    if (isTxBusy() || len <= 0 || len > TX_BUF_LEN)
+        return false;
 
-    // Use the SysTick to generate the timeout
-    SysTick->LOAD = EchoTimeout * (SystemCoreClock / 1000);
-    SysTick->VAL  = 0;
-    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+    memcpy(txData_, data, len);
+    txLen_ = len;
+    txP4_ = p4Interval;
+    txPos_ = 0;
+    clearRxFifo(); // Drop the bus noise, only echo bytes expected
+    sendNext();
+    return true;
+}
+
+/**
+ * Send the byte at the current position and wait for its echo
+ */
+void EcuUart::sendNext()
+{
+    txState_ = TX_ECHO;
+    txTimer_->start(echoTimeout_);
+    send(txData_[txPos_]);
+}
 
-    while (!ready()) {
-        if (SysTick->CTRL & 0x10000) // check timeout
-            return false;
+/**
+ * Sleep until the transmission completed
+ * @return true if all the bytes echoed back, false otherwise
+ */
+bool EcuUart::waitTx()
+{
+    for (;;) {
+        __disable_irq();
+        if (!isTxBusy()) {
+            __enable_irq();
+            break;
+        }
+        __WFI();
+        __enable_irq();
     }
-    uint8_t echo = get();
-    return (echo == byte);
+    return txResult();
+}
+
+/**
+ * Abort the transmission in progress
+ */
+void EcuUart::abortTx()
+{
+    __disable_irq();
+    txTimer_->stop();
+    txState_ = TX_IDLE;
+    __enable_irq();
+}
+
+/**
+ * Transmit timer handler, either P4 interval or echo timeout expired
+ */
+void EcuUart::txTimerHandler()
+{
+    if (txState_ == TX_GAP) {
+        sendNext();
+    }
+    else if (txState_ == TX_ECHO) {
+        txState_ = TX_ERROR; // no echo, wiring problem
+    }
+}
+
+/**
+ * Transmit timer callback, redirect to txTimerHandler
+ */
+void EcuUart::TxTimerHandler()
+{
+    EcuUart::instance()->txTimerHandler();
+}
+
+/**
+ * UART1 IRQ Handler, redirect to irqHandler
+ */
+extern "C" void UART1_IRQHandler(void)
+{
+    ProfileScope profile(PROF_ISR_ECU_UART);
+    EcuUart::instance()->irqHandler();
 }
 
 /*
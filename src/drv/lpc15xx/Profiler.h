@@ -0,0 +1,90 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+//
+// The profiling zones on the hot paths, timed by the Cortex-M3 DWT cycle counter.
+// The zone costs two counter reads and a few adds, it is always built in.
+//
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <cstdint>
+
+using namespace std;
+
+enum ProfZone {
+    PROF_ON_CMD,       // AdptOnCmd
+    PROF_TO_BYTES,     // to_bytes
+    PROF_TO_ASCII,     // to_ascii
+    PROF_CAN_READ,     // CanDriver::read
+    PROF_CAN_RECEIVE,  // IsoCanAdapter::receiveFromEcu
+    PROF_CMD_SEND,     // CmdUart::send waiting for the previous transmission
+    PROF_ISR_CAN,
+    PROF_ISR_CMD_UART,
+    PROF_ISR_ECU_UART,
+    PROF_ISR_SCT,
+    PROF_ISR_RIT,
+    PROF_ISR_MRT,
+    PROF_ZONES_LEN
+};
+
+struct ProfZoneStats {
+    uint32_t count;
+    uint32_t min;      // Cycles
+    uint32_t max;
+    uint64_t total;
+};
+
+class Profiler {
+public:
+    static void configure();
+    static uint32_t cycles();
+    static void reset();
+    static void takeStats(ProfZoneStats* stats);
+
+    /**
+     * Add the zone call, the counter wraps around so the difference is still valid
+     * @param[in] zone The zone number
+     * @param[in] start The cycle counter on the zone entry
+     */
+    static void record(int zone, uint32_t start) {
+        uint32_t elapsed = cycles() - start;
+        ProfZoneStats& stats = stats_[zone];
+        if (stats.count == 0 || elapsed < stats.min)
+            stats.min = elapsed;
+        if (elapsed > stats.max)
+            stats.max = elapsed;
+        stats.count++;
+        stats.total += elapsed;
+    }
+private:
+    static ProfZoneStats stats_[PROF_ZONES_LEN];
+};
+
+#ifdef __arm__
+/**
+ * Read DWT->CYCCNT, inline to keep the zone overhead low
+ * @return The CPU cycles
+ */
+inline uint32_t Profiler::cycles()
+{
+    return *reinterpret_cast<volatile uint32_t*>(0xE0001004);
+}
+#endif
+
+// The zone for the rest of the scope
+class ProfileScope {
+public:
+    ProfileScope(int zone) : zone_(zone), start_(Profiler::cycles()) {}
+    ~ProfileScope() { Profiler::record(zone_, start_); }
+private:
+    int      zone_;
+    uint32_t start_;
+};
+
+#endif //__PROFILER_H__
@@ -0,0 +1,45 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <LPC15xx.h>
+#include "Profiler.h"
+
+ProfZoneStats Profiler::stats_[PROF_ZONES_LEN];
+
+/**
+ * Enable the trace and start the DWT cycle counter
+ */
+void Profiler::configure()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * Clear all the zone counters, the interrupt zones are updated by ISR
+ */
+void Profiler::reset()
+{
+    __disable_irq();
+    memset(stats_, 0, sizeof(stats_));
+    __enable_irq();
+}
+
+/**
+ * Copy and clear all the zone counters in one critical section,
+ * so no sample is torn or lost between the copy and the clear
+ * @param[out] stats The zone counters, PROF_ZONES_LEN entries
+ */
+void Profiler::takeStats(ProfZoneStats* stats)
+{
+    __disable_irq();
+    memcpy(stats, stats_, sizeof(stats_));
+    memset(stats_, 0, sizeof(stats_));
+    __enable_irq();
+}
@@ -15,6 +15,10 @@ using namespace std;
 class Timer;
 class PwmDriver {
 public:
+    // The captured pulse, width in microseconds and flags
+    const static uint32_t PULSE_ACTIVE  = 0x8000;
+    const static uint32_t PULSE_TIMEOUT = 0x4000;
+    const static uint32_t PULSE_WIDTH   = 0x3FFF;
     static PwmDriver* instance();
     static void configure();
     void open(bool vpwMode);
@@ -24,19 +28,22 @@ public:
     void setBit(int val);
     uint32_t wait4Sof(uint32_t timeout, Timer* p2timer);
     uint32_t getBit();
+    // Interrupt driven capture of the bus pulses
+    void startRx(uint32_t timeout);
+    bool getPulse(uint32_t& pulse);
+    bool waitPulse(const Timer* timer);
+    void stopRx();
+    // Interrupt driven transmit of the precomputed pulse widths
+    bool isTxBusy() const;
+    int waitTx();
     // VPW specific
-    uint32_t wait4BusChangeVpw();
-    void sendSofVpw(uint32_t interval);
-    void sendPulseVpw(uint32_t interval);
-    void sendEodVpw();
+    void startTxVpw(const uint16_t* pulses, int count);
+    void setHighSpeedVpw(bool val);
     // PWM specific
     void setTimeoutPwm(uint32_t timeout);
     uint32_t wait4BusPulsePwm();
-    void sendPulsePwm(uint32_t interval1, uint32_t interval2);
-    void sendEodPwm();
+    void startTxPwm(const uint16_t* pulses, int count);
 private:
-    void sendHalfBit1(uint32_t interval);
-    void sendHalfBit2(uint32_t interval);
     PwmDriver() {}
     bool vpwMode_;
 };
@@ -1,7 +1,8 @@
 #include <LPC15xx.h>
-#include "GPIODrv.h"
+#include "GpioDrv.h"
 #include "Timer.h"
 #include "PwmDriver.h"
+#include "Profiler.h"
 
 const int VregPin  = 5;
 const int VregPort = 0;
@@ -9,6 +10,26 @@ static volatile uint8_t  timerFlag;
 static volatile uint32_t timerVal;
 static volatile uint32_t timerVal2;
 
+// Receive pulse ring, filled by SCT0 ISR
+const int PULSE_RING_LEN = 256; // Should be power of 2, fits PWM frame with IFR
+static volatile uint16_t pulseRing[PULSE_RING_LEN];
+static volatile uint32_t pulseHead;
+static volatile uint32_t pulseTail;
+static volatile bool     pulseRxOn;
+static volatile bool     pulseIdle;
+
+// Transmit pulse table, fed to match reload registers by SCT0 ISR
+enum TxStatus { TX_IDLE, TX_BUSY, TX_DONE, TX_LOST };
+static const uint16_t* txPulses;
+static volatile int    txCount;
+static volatile int    txIdx;
+static volatile TxStatus txStatus = TX_IDLE;
+static bool txVpw;
+static volatile bool txReleased;
+
+// PWM arbitration, the bus should follow the released output within this delay, usec
+const uint32_t PWM_RELEASE_MAX = 4;
+
 
 void PwmDriver::configure()
 {
@@ -124,6 +145,8 @@ void PwmDriver::stop()
     LPC_SCT0->EV4_STATE = 0;
     LPC_SCT0->EV5_STATE = 0;
     LPC_SCT0->EV6_STATE = 0;
+    LPC_SCT0->LIMIT = 0x0000007E; // restore events 1-6 as counter limit
+    LPC_SCT0->EVEN  = 0x00000007; // restore events 0-2 interrupts
 }
 
 /**
@@ -155,21 +178,90 @@ uint32_t PwmDriver::wait4Sof(uint32_t timeout, Timer* p2timer)
 }
 
 /**
- * Timer is running since last wait4Sof call. Get the values for rising or falling edge.
- * The counter is not resetting! It is related to the previous bus change.
- * @return The timer counter value
+ * Start J1850 receiver, the widths of all the bus pulses are captured by SCT0 ISR
+ * into pulse ring. The counter is reset by every edge.
+ * @param[in] timeout The bus idle timeout, reported as the pulse with PULSE_TIMEOUT flag
  */
-uint32_t PwmDriver::wait4BusChangeVpw()
+void PwmDriver::startRx(uint32_t timeout)
 {
-    // Use both edges and timeout
+    LPC_SCT0->CTRL |= (1 << 2);  // halt it
+    LPC_SCT0->COUNT = 0;
+    LPC_SCT0->STATE = 0;
+    LPC_SCT0->MATCH0    = timeout;
+    LPC_SCT0->MATCHREL0 = timeout;
     LPC_SCT0->EV0_STATE = 0x01;  // event 0 happens in state 0
     LPC_SCT0->EV1_STATE = 0x01;  // event 1 happens in state 0
     LPC_SCT0->EV2_STATE = 0x01;  // event 2 happens in state 0
+    
+    pulseHead = pulseTail = 0;
+    pulseIdle = true; // Ignore the timeout until the first edge
+    pulseRxOn = true;
+    LPC_SCT0->CTRL &= ~(1 << 2); // unhalt it
+}
 
-    timerFlag = 0;
-    while (!(timerFlag & 0x07)) // events 0-2
-        ; 
-    return (timerFlag & 0x01) ? 0 : timerVal;
+/**
+ * Get the next captured pulse
+ * @param[out] pulse The pulse width with flags
+ * @return true if available, false if pulse ring is empty
+ */
+bool PwmDriver::getPulse(uint32_t& pulse)
+{
+    if (pulseHead == pulseTail)
+        return false;
+    pulse = pulseRing[pulseTail];
+    pulseTail = (pulseTail + 1) & (PULSE_RING_LEN - 1);
+    return true;
+}
+
+/**
+ * Sleep until the next pulse is captured or timer expired
+ * @param[in] timer The timeout timer
+ * @return true if pulse is ready, false if timeout
+ */
+bool PwmDriver::waitPulse(const Timer* timer)
+{
+    for (;;) {
+        __disable_irq();
+        if (pulseHead != pulseTail || timer->isExpired()) {
+            __enable_irq();
+            break;
+        }
+        __WFI();
+        __enable_irq();
+    }
+    return pulseHead != pulseTail;
+}
+
+/**
+ * Stop J1850 receiver
+ */
+void PwmDriver::stopRx()
+{
+    pulseRxOn = false;
+    stop();
+}
+
+/**
+ * Store the pulse into ring, drop it if the ring is full
+ * @param[in] pulse The pulse width with flags
+ */
+static void PushPulse(uint32_t pulse)
+{
+    uint32_t next = (pulseHead + 1) & (PULSE_RING_LEN - 1);
+    if (next != pulseTail) {
+        pulseRing[pulseHead] = pulse;
+        pulseHead = next;
+    }
+}
+
+/**
+ * Capture value limited to the pulse width field
+ * @param[in] val The captured counter value
+ * @return The pulse width
+ */
+static inline uint32_t PulseWidth(uint32_t val)
+{
+    return (val < PwmDriver::PULSE_WIDTH) ? val : PwmDriver::PULSE_WIDTH;
 }
 
 /**
@@ -217,45 +309,85 @@ done:
 }
 
 /**
- * Start the PWM pulse sequence with SOF pulse
- * @param[in] interval The SOD width
+ * Start VPW transmit. The pulses are alternating, starting with active SOF. The output is toggled
+ * by events 3 and 4 on match 3, the next width is loaded into match reload register by ISR.
+ * The rising edge in passive state (event 1) means the other node is active, arbitration lost.
+ * @param[in] pulses The pulse widths, should stay valid till the end of transmit
+ * @param[in] count The number of pulses
  */
-void PwmDriver::sendSofVpw(uint32_t interval)
+void PwmDriver::startTxVpw(const uint16_t* pulses, int count)
 {
+    txPulses = pulses;
+    txCount = count;
+    txIdx = 0;
+    txStatus = TX_BUSY;
+    txVpw = true;
+    
     LPC_SCT0->CTRL |= (1 << 2);  // halt it
     LPC_SCT0->EV0_STATE = 0x00;  // event 0 disabled
-    LPC_SCT0->EV1_STATE = 0x00;  // event 1 disabled
+    LPC_SCT0->EV1_STATE = 0x02;  // event 1 happens in state 1, arbitration check
     LPC_SCT0->EV2_STATE = 0x00;  // event 2 disabled
     LPC_SCT0->EV3_STATE = 0x04;  // event 3 happens in state 2
     LPC_SCT0->EV4_STATE = 0x02;  // event 4 happens in state 1
+    LPC_SCT0->LIMIT = 0x18;      // only events 3,4 reset the counter
     LPC_SCT0->COUNT = 0;         // reset counter
     LPC_SCT0->STATE = 2;         // start in state 2
-    LPC_SCT0->MATCH3 = interval;
-    LPC_SCT0->MATCHREL3 = interval; 
+    LPC_SCT0->MATCH3 = pulses[0];
+    LPC_SCT0->MATCHREL3 = (count > 1) ? pulses[1] : 0xFFFFFFFF; 
+    LPC_SCT0->EVFLAG = 0x1A;     // clear old flags
+    LPC_SCT0->EVEN = 0x1A;       // events 1,3,4 generate interrupts
     LPC_SCT0->OUTPUT = 0x01;     // start with high level, output 0
     LPC_SCT0->CTRL &= ~(1 << 2); // unhalt it
 }
 
 /**
- * Timer is running. Set the new reload value and wait till it's reloaded.
- * @param[in] interval The pulse width
+ * Check if transmit is in progress
+ * @return true if busy
  */
-void PwmDriver::sendPulseVpw(uint32_t interval)
+bool PwmDriver::isTxBusy() const
 {
-    LPC_SCT0->MATCHREL3 = interval;
-    volatile uint32_t state = LPC_SCT0->STATE;
-    while (LPC_SCT0->STATE == state)
-        ;
+    return txStatus == TX_BUSY;
 }
 
 /**
- * Timer is running (state 2). The output0 should be high. Reload the new value for EOD (low output)
- * and let the timer stop on completion.
+ * Sleep until the transmit completed
+ * @return 1 if success, -1 if arbitration lost
  */
-void PwmDriver::sendEodVpw()
+int PwmDriver::waitTx()
 {
-    sendPulseVpw(0xFFFFFFFF);  // long pulse
-    stop();
+    for (;;) {
+        __disable_irq();
+        if (txStatus != TX_BUSY) {
+            __enable_irq();
+            break;
+        }
+        __WFI();
+        __enable_irq();
+    }
+    return (txStatus == TX_DONE) ? 1 : -1;
+}
+
+/**
+ * Transmit has been completed, bus left passive
+ * @param[in] status The completion status
+ */
+static void TxComplete(TxStatus status)
+{
+    PwmDriver::instance()->stop();
+    txStatus = status;
+}
+
+/**
+ * Load the match reload register for the next VPW pulse, called on every pulse end
+ */
+static void TxNextVpw()
+{
+    if (++txIdx >= txCount) { // The last active pulse completed, EOD
+        TxComplete(TX_DONE);
+        return;
+    }
+    int next = txIdx + 1;
+    LPC_SCT0->MATCHREL3 = (next < txCount) ? txPulses[next] : 0xFFFFFFFF;
 }
 
 /**
@@ -281,85 +413,124 @@ uint32_t PwmDriver::wait4BusPulsePwm()
 }
 
 /**
- * Send the J1850 PWM pulse
- * @param[in] intrval1 The active part width
- * @param[in] intrval1 The passive part width
+ * Start PWM transmit. Every bit is the pair of active and passive widths (minus one tick),
+ * the output is toggled by events 5 and 6. ISR loads the next bit on event 6, and stops
+ * the transmit on event 5 of the last bit, leaving the bus passive for EOD.
+ * The falling edge (event 2) is captured in passive state, if the bus is held active
+ * by the other node longer than our bit, the arbitration is lost.
+ * @param[in] pulses The active/passive width pairs, should stay valid till the end of transmit
+ * @param[in] count The number of bits
  */
-void PwmDriver::sendPulsePwm(uint32_t interval1, uint32_t interval2)
+void PwmDriver::startTxPwm(const uint16_t* pulses, int count)
 {
-    sendHalfBit1(interval1);
-    sendHalfBit2(interval2);
+    txPulses = pulses;
+    txCount = count;
+    txIdx = 0;
+    txStatus = TX_BUSY;
+    txVpw = false;
+    
+    LPC_SCT0->CTRL |= (1 << 2);  // halt it
+    LPC_SCT0->EV0_STATE = 0x00;  // disable event 0
+    LPC_SCT0->EV1_STATE = 0x00;  // disable event 1
+    LPC_SCT0->EV2_STATE = 0x08;  // event 2 happens in state 3, arbitration check
+    LPC_SCT0->EV5_STATE = 0x10;  // event 5 happens in state 4
+    LPC_SCT0->EV6_STATE = 0x08;  // event 6 happens in state 3
+    LPC_SCT0->LIMIT = 0x60;      // only events 5,6 reset the counter
+    LPC_SCT0->COUNT = 0;         // reset counter
+    LPC_SCT0->STATE = 4;         // start in state 4
+    LPC_SCT0->MATCH5 = pulses[0];
+    LPC_SCT0->MATCHREL5 = (count > 1) ? pulses[2] : pulses[0];
+    LPC_SCT0->MATCH6 = pulses[1];
+    LPC_SCT0->MATCHREL6 = pulses[1];
+    LPC_SCT0->EVFLAG = 0x64;     // clear old flags
+    LPC_SCT0->EVEN = (count > 1) ? 0x44 : 0x20; // events 2,6, or event 5 for the last bit
+    txReleased = false;
+    LPC_SCT0->OUTPUT = 0x03;     // start with high level
+    LPC_SCT0->CTRL &= ~(1 << 2); // unhalt it
 }
 
 /**
- * Send the active part of J1850 PWM pulse
- * @param[in] interval The active part width
+ * Load the match reload registers for the next PWM bit, called on every bit end
  */
-void PwmDriver::sendHalfBit1(uint32_t interval)
+static void TxNextPwm()
 {
-    interval--;
-    if (LPC_SCT0->CTRL & (1 << 2)) {
-        LPC_SCT0->EV0_STATE = 0x00;  // disable event 0
-        LPC_SCT0->EV1_STATE = 0x00;  // disable event 0
-        LPC_SCT0->EV2_STATE = 0x00;  // disable event 0
-        LPC_SCT0->EV5_STATE = 0x10;  // event 5 happens in state 4
-        LPC_SCT0->EV6_STATE = 0x08;  // event 6 happens in state 3
-        LPC_SCT0->COUNT = 0;         // reset counter
-        LPC_SCT0->STATE = 4;         // start in state 4
-        LPC_SCT0->MATCH5 = interval;
-        LPC_SCT0->MATCHREL5 = interval; 
-        LPC_SCT0->OUTPUT = 0x03;     // start with high level
-        LPC_SCT0->CTRL &= ~(1 << 2); // unhalt it
+    int idx = ++txIdx;
+    LPC_SCT0->MATCHREL6 = txPulses[idx * 2 + 1];
+    if (idx + 1 < txCount) {
+        LPC_SCT0->MATCHREL5 = txPulses[idx * 2 + 2];
     }
-    else {
-        LPC_SCT0->MATCHREL5 = interval;
-        volatile uint32_t state = LPC_SCT0->STATE;
-        while (LPC_SCT0->STATE == state) 
-            ;
+    else { // The last bit, stop at its passive part
+        LPC_SCT0->EVFLAG = 0x20;
+        LPC_SCT0->EVEN = 0x20;
     }
 }
 
-/**
- * Send the passive part of J1850 PWM pulse
- * @param[in] interval The passive part width
- */
-void PwmDriver::sendHalfBit2(uint32_t interval)
-{
-    interval--;
-    LPC_SCT0->MATCHREL6 = interval;
-    volatile uint32_t state = LPC_SCT0->STATE;
-    while (LPC_SCT0->STATE == state) 
-        ;
-}
-
-/**
- * Send EOD
- */
-void PwmDriver::sendEodPwm()
-{
-    stop();
-}
-
 extern "C" void SCT0_IRQHandler(void)
 {
-    // event 0, timeout
+    ProfileScope profile(PROF_ISR_SCT);
     uint32_t evflag = LPC_SCT0->EVFLAG;
+    
+    // Transmit in progress
+    if (txStatus == TX_BUSY) {
+        LPC_SCT0->EVFLAG = evflag & 0x7E;
+        if (txVpw) {
+            if (evflag & 0x02) // event 1, the other node is active
+                TxComplete(TX_LOST);
+            else if (evflag & 0x18) // events 3,4, pulse completed
+                TxNextVpw();
+            return;
+        }
+        if (evflag & 0x04) { // event 2, the bus released after our active pulse
+            if (LPC_SCT0->CAP2 > PWM_RELEASE_MAX) { 
+                TxComplete(TX_LOST); // The other node kept the bus active
+                return;
+            }
+            txReleased = true;
+        }
+        if ((evflag & 0x20) && txIdx + 1 >= txCount) { // event 5 of the last bit
+            TxComplete(TX_DONE);
+        }
+        else if (evflag & 0x40) { // event 6, bit completed
+            if (!txReleased) {
+                TxComplete(TX_LOST); // The bus is still active
+                return;
+            }
+            txReleased = false;
+            TxNextPwm();
+        }
+        return;
+    }
+    
+    // event 0, timeout
     if (evflag & 0x01) {
         timerFlag |= 0x01;
         LPC_SCT0->EVFLAG |= 0x01;
+        if (pulseRxOn && !pulseIdle) {
+            uint32_t level = (LPC_SCT0->INPUT & 0x01) ? PwmDriver::PULSE_ACTIVE : 0;
+            PushPulse(PwmDriver::PULSE_TIMEOUT | level);
+            pulseIdle = true;
+        }
     }
-    // event 1, rising edge
+    // event 1, rising edge, the passive pulse completed
     if (evflag & 0x02) {
         timerVal = LPC_SCT0->CAP1;
         timerFlag |= 0x02;
         LPC_SCT0->EVFLAG |= 0x02;
+        if (pulseRxOn) {
+            PushPulse(PulseWidth(timerVal));
+            pulseIdle = false;
+        }
     }
-    // event 2, falling edge
+    // event 2, falling edge, the active pulse completed
     if (evflag & 0x04) {
         timerVal = LPC_SCT0->CAP2;
         timerVal2 = timerVal;
         timerFlag |= 0x04;
         LPC_SCT0->EVFLAG |= 0x04;
+        if (pulseRxOn) {
+            PushPulse(PulseWidth(timerVal) | PwmDriver::PULSE_ACTIVE);
+            pulseIdle = false;
+        }
     }
 }
 
@@ -385,6 +556,20 @@ void PwmDriver::setBit(int val)
         LPC_SCT0->OUTPUT = val ? 0x03 : 0x00;
 }
 
+/**
+ * Set the SCT clock for VPW 4x mode. The clock is 4 MHz instead of 1 MHz,
+ * so all the pulse widths and timeouts in ticks are scaled down 4 times.
+ * @param[in] val true for 41.6 kbit/s, false for 10.4 kbit/s
+ */
+void PwmDriver::setHighSpeedVpw(bool val)
+{
+    const uint32_t PrescalerMask = 0xFF << 5;
+    uint32_t clock = val ? 4000000 : 1000000;
+    
+    LPC_SCT0->CTRL |= (1 << 2);  // halt it
+    LPC_SCT0->CTRL = (LPC_SCT0->CTRL & ~PrescalerMask) | ((SystemCoreClock/clock-1) << 5);
+}
+
 /**
  * Open driver for operation, either J1850 PWM or VPW
  * @param[in] mode true for vpw, false for PWM
@@ -392,6 +577,7 @@ void PwmDriver::setBit(int val)
 void PwmDriver::open(bool vpwMode)
 {
     vpwMode_ = vpwMode;
+    setHighSpeedVpw(false);
     if (vpwMode) {
         GPIOPinWrite(VregPort, VregPin, 1);
         LPC_INMUX->SCT0_INMUX[0] = 0x00; // SCT0_IN0 at P0_2
@@ -0,0 +1,41 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+//
+// RAM usage instrumentation, built in only with RAM_STATS defined:
+//   stack - the free area above the heap is painted at startup
+//   heap  - operator new/delete keep the usage and per caller counters
+//
+
+#ifndef __RAM_STATS_H__
+#define __RAM_STATS_H__
+
+#include <cstdint>
+
+using namespace std;
+
+const uint32_t STACK_PAINT_PATTERN = 0xA5A5A5A5;
+const int      HEAP_SITES_LEN      = 12; // The last one takes all the rest
+
+struct HeapSite {
+    uint32_t caller; // Return address of operator new
+    uint32_t count;  // Live blocks
+    uint32_t total;  // All the allocations
+    uint32_t bytes;  // Live bytes
+};
+
+struct HeapStats {
+    uint32_t current; // Live bytes
+    uint32_t peak;    // High watermark of current
+    uint32_t allocs;
+    uint32_t frees;
+    HeapSite sites[HEAP_SITES_LEN];
+};
+
+extern HeapStats AdptHeapStats;
+
+#endif //__RAM_STATS_H__
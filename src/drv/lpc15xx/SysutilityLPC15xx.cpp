@@ -5,14 +5,30 @@
  *
  */
 
+#include <cstdio>
 #include <lstring.h>
 #include <algorithms.h>
 #include <adaptertypes.h>
+#include <LPC15xx.h>
 #include <romapi_15xx.h>
+#include <RamStats.h>
+#include <Profiler.h>
+#include <Timer.h>
+#include <CmdUart.h>
+#include <CanDriver.h>
+#include <EcuUart.h>
+#include <PwmDriver.h>
+#include <AdcDriver.h>
+#include <led.h>
 
 using namespace std;
 using namespace util;
 
+extern "C" void* _sbrk(int incr);
+#ifdef RAM_STATS
+extern "C" void _vStackTop(void);
+#endif
+
 /**
  * IAP API call to get CPU UID
  * @parameter[in] uid UID 3 x uint32_t array to filled in
@@ -32,12 +48,10 @@ static void IAPReadUID(uint32_t uid[3])
 /**
  * Format the UID as string
  * @paramer[in] uid UID 3 x uint32_t array
- * @return UID as a string
+ * @paramer[out] str UID as a string
  */
-static string UIDToString(uint32_t uid[3])
+static void UIDToString(uint32_t uid[3], string& str)
 {
-    string str(30);
-
     for (int j = 0; j < 3; j++) {
         NumericType value(uid[j]);
 
@@ -48,7 +62,6 @@ static string UIDToString(uint32_t uid[3])
         str += '-';
     }
     str.resize(str.length() - 1);
-    return str;
 }
 
 /**
@@ -58,8 +71,50 @@ void AdptReadSerialNum()
 {
     uint32_t uid[3];
 
+    ReplyString str;
     IAPReadUID(uid);
-    AdptSendReply(UIDToString(uid));
+    UIDToString(uid, str);
+    AdptSendReply(str);
+}
+
+/**
+ * IAP API call to read the on-chip EEPROM
+ * @parameter[in] addr EEPROM address
+ * @parameter[out] data The buffer to read to
+ * @parameter[in] len The number of bytes
+ * @return true if OK, false otherwise
+ */
+bool AdptReadStorage(uint32_t addr, void* data, uint32_t len)
+{
+    unsigned int command[5], result[4];
+
+    command[0] = IAP_EEPROM_READ;
+    command[1] = addr;
+    command[2] = reinterpret_cast<uint32_t>(data);
+    command[3] = len;
+    command[4] = SystemCoreClock / 1000; // in kHz
+    ((IAP_ENTRY_T) IAP_ENTRY_LOCATION)(command , result);
+    return result[0] == IAP_CMD_SUCCESS;
+}
+
+/**
+ * IAP API call to write the on-chip EEPROM
+ * @parameter[in] addr EEPROM address
+ * @parameter[in] data The bytes to write
+ * @parameter[in] len The number of bytes
+ * @return true if OK, false otherwise
+ */
+bool AdptWriteStorage(uint32_t addr, const void* data, uint32_t len)
+{
+    unsigned int command[5], result[4];
+
+    command[0] = IAP_EEPROM_WRITE;
+    command[1] = addr;
+    command[2] = reinterpret_cast<uint32_t>(data);
+    command[3] = len;
+    command[4] = SystemCoreClock / 1000; // in kHz
+    ((IAP_ENTRY_T) IAP_ENTRY_LOCATION)(command , result);
+    return result[0] == IAP_CMD_SUCCESS;
 }
 
 /**
@@ -71,3 +126,82 @@ void AdptPowerModeConfigure()
 
 	LPC_PWRD_API->power_mode_configure(SLEEP, 0x0);
 }
+
+/**
+ * Display the RAM usage, the heap break is always available,
+ * the allocation counters and stack watermark only with RAM_STATS build
+ */
+void AdptMemStatDisplay()
+{
+    char out[64];
+    uint32_t brk = reinterpret_cast<uint32_t>(_sbrk(0));
+
+#ifdef RAM_STATS
+    const HeapStats& heap = AdptHeapStats;
+    sprintf(out, "HEAP:%u PEAK:%u NEW:%u DEL:%u", (unsigned)heap.current, (unsigned)heap.peak,
+            (unsigned)heap.allocs, (unsigned)heap.frees);
+    AdptSendReply(out);
+    
+    // The lowest overwritten word is the stack high watermark
+    const uint32_t* p = reinterpret_cast<const uint32_t*>((brk + 3) & ~3);
+    const uint32_t* top = reinterpret_cast<const uint32_t*>(&_vStackTop);
+    while (p < top && *p == STACK_PAINT_PATTERN)
+        p++;
+    uint32_t stackUsed = reinterpret_cast<uint32_t>(top) - reinterpret_cast<uint32_t>(p);
+    uint32_t stackFree = reinterpret_cast<uint32_t>(p) - brk;
+    sprintf(out, "STACK:%u FREE:%u BRK:%08X", (unsigned)stackUsed, (unsigned)stackFree, (unsigned)brk);
+    AdptSendReply(out);
+    
+    for (int i = 0; i < HEAP_SITES_LEN; i++) {
+        const HeapSite& site = heap.sites[i];
+        if (!site.total)
+            continue;
+        sprintf(out, "%08X LIVE:%u ALL:%u BYTES:%u", (unsigned)site.caller, (unsigned)site.count,
+                (unsigned)site.total, (unsigned)site.bytes);
+        AdptSendReply(out);
+    }
+#else
+    sprintf(out, "BRK:%08X", (unsigned)brk);
+    AdptSendReply(out);
+#endif
+}
+
+/**
+ * Enable the clocks and peripherals, initialize the drivers
+ */
+void AdptHardwareInit()
+{
+    SystemCoreClockUpdate();
+    Profiler::configure();
+
+    // Enable MRT timer
+    LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 0);
+    LPC_SYSCON->PRESETCTRL1 &= ~(1 << 0);
+    
+    // Enable RIT timer
+    LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 1);
+    LPC_SYSCON->PRESETCTRL1 &= ~(1 << 1);
+    TimeStamp::configure();
+    
+    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 11); // MUX
+    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 12); // SVM
+    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 13); // IOCON
+    
+    // LPC I/O pins
+    LPC_SYSCON->SYSAHBCLKCTRL0 |= (1 << 14); // PIO0
+    
+    CmdUart::configure();
+    EcuUart::configure();
+    CanDriver::configure();
+    AdptLED::configure();
+    PwmDriver::configure();
+    AdcDriver::configure();
+}
+
+/**
+ * Sleep until the next interrupt
+ */
+void AdptSleep()
+{
+    __WFI();
+}
@@ -19,6 +19,7 @@ public:
     const static int TIMER0 = 0;
     const static int TIMER1 = 1;
     const static int TIMER2 = 2;
+    const static uint32_t MAX_INTERVAL = 233; // ms, 24-bit MRT interval at 72MHz
     static Timer* instance(int timerNum);
     void start(uint32_t interval);
     bool isExpired() const;
@@ -38,6 +39,13 @@ private:
     LongTimer();
 };
 
+// Free running RIT counter, the time base for event timestamps
+class TimeStamp {
+public:
+    static void configure();
+    static uint32_t now();
+};
+
 // For use with Rx/Tx LEDs
 typedef void (*PeriodicCallbackT)();
 class PeriodicTimer {
@@ -47,4 +55,12 @@ public:
     void stop();
 };
 
+// Interrupt driven one-shot timer with microsecond resolution
+class OneShotTimer {
+public:
+    OneShotTimer(PeriodicCallbackT callback);
+    void start(uint32_t interval);
+    void stop();
+};
+
 #endif //__TIMER_H__
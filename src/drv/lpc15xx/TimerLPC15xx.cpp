@@ -7,6 +7,7 @@
 
 #include <LPC15xx.h>
 #include "Timer.h"
+#include "Profiler.h"
 
 const uint32_t tickDiv = (SystemCoreClock / 1000);
 
@@ -24,11 +25,12 @@ struct LPC_MRT_CH_T {
 Timer::Timer(int timerNum)
 {
     timer_ = reinterpret_cast<LPC_MRT_CH_T*>(LPC_MRT_BASE) + timerNum;
-    timer_->CTRL = 0x02; // one-shot mode
+    timer_->CTRL = 0x03; // one-shot mode, interrupt to wake up CPU on expiration
+    NVIC_EnableIRQ(MRT_IRQn);
 }
 
 /**
- * Start/restart the timer, interval <= 349 ms
+ * Start/restart the timer, interval <= MAX_INTERVAL
  * @param[in] interval Timer interval in milliseconds
  */
 void Timer::start(uint32_t interval) 
@@ -69,18 +71,56 @@ Timer* Timer::instance(int timerNum)
     }
 }
 
+static volatile bool longTimerExpired = true;
+
 extern "C" void RIT_IRQHandler(void)
 {
-    LPC_RIT->CTRL &= 0x07;
+    ProfileScope profile(PROF_ISR_RIT);
+    LPC_RIT->CTRL |= 0x01; // Clear interrupt flag
+    longTimerExpired = true;
 }
 
 /**
- * Construct the LongTimer object
+ * Read the RIT counter, the high and low parts consistently
+ * @return The 48-bit counter value
  */
-LongTimer::LongTimer()
+static uint64_t ReadRitCounter()
+{
+    uint32_t hi, lo;
+    do {
+        hi = LPC_RIT->COUNTER_H;
+        lo = LPC_RIT->COUNTER;
+    } while (hi != LPC_RIT->COUNTER_H);
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+/**
+ * Start RIT as free running 48-bit counter. It is never cleared,
+ * LongTimer is using compare value only.
+ */
+void TimeStamp::configure()
 {
     LPC_RIT->CTRL = 0;
     LPC_RIT->MASK = LPC_RIT->MASK_H = 0;
+    LPC_RIT->COUNTER = LPC_RIT->COUNTER_H = 0;
+    LPC_RIT->COMPVAL = LPC_RIT->COMPVAL_H = 0xFFFFFFFF;
+    LPC_RIT->CTRL = 0x09; // Enable it, clear interrupt flag
+}
+
+/**
+ * The current time, wraps around in ~71 minutes
+ * @return The time in microseconds
+ */
+uint32_t TimeStamp::now()
+{
+    return ReadRitCounter() / (SystemCoreClock / 1000000);
+}
+
+/**
+ * Construct the LongTimer object
+ */
+LongTimer::LongTimer()
+{
     NVIC_EnableIRQ(RIT_IRQn);
 }
 
@@ -90,12 +130,10 @@ LongTimer::LongTimer()
  */
 void LongTimer::start(uint32_t interval)
 {
-    uint64_t compval = static_cast<uint64_t>(tickDiv) * interval;
-    LPC_RIT->CTRL = 0;
-    LPC_RIT->COUNTER = LPC_RIT->COUNTER_H = 0;
-    LPC_RIT->COMPVAL = compval & 0xFFFFFFFF;
+    uint64_t compval = ReadRitCounter() + static_cast<uint64_t>(tickDiv) * interval;
+    longTimerExpired = false;
     LPC_RIT->COMPVAL_H = compval >> 32;
-    LPC_RIT->CTRL = 0x09;
+    LPC_RIT->COMPVAL = compval & 0xFFFFFFFF;
 }
 
 /**
@@ -104,7 +142,7 @@ void LongTimer::start(uint32_t interval)
  */
 bool LongTimer::isExpired() const
 {
-    return !(LPC_RIT->CTRL & 0x08);
+    return longTimerExpired;
 }
 
 /**
@@ -118,14 +156,23 @@ LongTimer* LongTimer::instance()
 }
 
 static PeriodicCallbackT irqCallback;
+static PeriodicCallbackT oneShotCallback;
 
 extern "C" void MRT_IRQHandler(void)
 {
+    ProfileScope profile(PROF_ISR_MRT);
     uint32_t irqFlag = LPC_MRT->IRQ_FLAG;
-    //LPC_MRT->IRQ_FLAG = irqFlag;
 
+    // One-shot timers, the interrupt is only waking up CPU
+    if (irqFlag & 0x03) {
+        LPC_MRT->IRQ_FLAG = irqFlag & 0x03;
+    }
+    if ((irqFlag & 0x04) && oneShotCallback) {
+        LPC_MRT->IRQ_FLAG = 0x04;
+        (*oneShotCallback)();
+    }
     if ((irqFlag & 0x08) && irqCallback) {
-        LPC_MRT->IRQ_FLAG |= 0x08;
+        LPC_MRT->IRQ_FLAG = 0x08;
         (*irqCallback)();
     }
 }
@@ -160,3 +207,70 @@ void PeriodicTimer::stop()
 {
     LPC_MRT->CTRL3 = 0x0;
 }
+
+/**
+ * Construct the OneShotTimer instance, uses MRT channel 2
+ * @param[in] callback Timer callback handler, called from the interrupt
+ */
+OneShotTimer::OneShotTimer(PeriodicCallbackT callback)
+{
+    oneShotCallback = callback;
+    LPC_MRT->CTRL2 = 0x0;
+    NVIC_EnableIRQ(MRT_IRQn);
+}
+
+/**
+ * Start/restart the timer
+ * @param[in] interval Timer interval in microseconds
+ */
+void OneShotTimer::start(uint32_t interval)
+{
+    uint32_t val = (SystemCoreClock / 1000000) * interval;
+    LPC_MRT->CTRL2 = 0x3;  // one-shot mode with interrupt
+    LPC_MRT->STAT2 |= 0x1; // Clear interrupt flag
+    LPC_MRT->INTVAL2 = (val ? val : 1) | 0x80000000;
+}
+
+/**
+ *  Stop the timer
+ */
+void OneShotTimer::stop()
+{
+    LPC_MRT->INTVAL2 = 0x80000000; // Writing 0 with force load stops it
+    LPC_MRT->STAT2 |= 0x1;
+}
+
+/**
+ * Delay for number of milliseconds using SysTick timer
+ * @param[in] value The number of millisecond to delay
+ */
+void Delay1ms(uint32_t value)
+{
+    if (value == 0) return;
+    
+    // Use the SysTick to generate the timeout in msecs
+    SysTick->LOAD = value * (SystemCoreClock / 1000);
+    SysTick->VAL  = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
+    while (!(SysTick->CTRL & 0x10000)) {
+        ;
+    }
+}
+
+/**
+ * Delay for number of microseconds using SysTick timer
+ * @param[in] value The number of microseconds to delay
+ */
+void Delay1us(uint32_t value)
+{
+    const uint32_t AdjustValue = 50;
+    // Use the SysTick to generate the timeout in us
+    SysTick->LOAD = value * (SystemCoreClock / 1000000) - AdjustValue;
+    SysTick->VAL  = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
+    while (!(SysTick->CTRL & 0x10000)) {
+        ;
+    }
+}
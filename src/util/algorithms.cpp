@@ -40,7 +40,7 @@ void to_upper(string& str)
  * @param[in] str String to validate
  * @return 1 if valid, 0 otherwise
  */
-bool is_xdigits(const string& str)
+bool is_xdigits(string_view str)
 {
     int len = str.length();
     if (len == 0 || len % 2) {
@@ -72,17 +72,26 @@ void remove_space(string& str)
 }
 
 /**
- * Standard library stoul implementation
+ * Standard library stoul implementation, the string is not required to be null terminated
  * @param[in] str String to perform action to
- * @param[out] pos The result length
+ * @param[out] pos The number of characters processed
  * @param[in] base Base
  * @return The result value
  */
-uint32_t stoul(const string& str, uint32_t* pos, int base)
+uint32_t stoul(string_view str, uint32_t* pos, int base)
 {
+    uint32_t val = 0;
+    uint32_t i = 0;
+    for (; i < str.length(); i++) {
+        char ch = toupper(str[i]);
+        int digit = isdigit(ch) ? (ch - '0') : (isalpha(ch) ? (ch - 'A' + 10) : base);
+        if (digit >= base)
+            break;
+        val = val * base + digit;
+    }
     if (pos)
-        *pos = str.length();
-    return strtoul(str.c_str(), 0, base);;
+        *pos = i;
+    return val;
 }
 
 /**
@@ -15,8 +15,8 @@ namespace util {
     void to_lower(string& str);
     void to_upper(string& str);
     void remove_space(string& str);
-    uint32_t stoul(const string& str, uint32_t* pos = 0, int base = 10);
-    bool is_xdigits(const string& str);
+    uint32_t stoul(string_view str, uint32_t* pos = 0, int base = 10);
+    bool is_xdigits(string_view str);
     char to_ascii(uint8_t byte);
     
 }
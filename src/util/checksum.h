@@ -0,0 +1,20 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __CHECKSUM_H__ 
+#define __CHECKSUM_H__
+
+#include <cstdint>
+
+namespace util {
+    
+    uint8_t crc8_j1850(const uint8_t* data, int len);
+    uint8_t iso_checksum(const uint8_t* data, int len);
+    
+}
+
+#endif //__CHECKSUM_H__
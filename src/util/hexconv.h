@@ -0,0 +1,20 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __HEXCONV_H__ 
+#define __HEXCONV_H__
+
+#include <cstdint>
+
+namespace util {
+    
+    uint32_t hex_encode(const uint8_t* bytes, uint32_t length, char* out, char separator = 0);
+    uint32_t hex_decode(const char* str, uint32_t length, uint8_t* bytes);
+    
+}
+
+#endif //__HEXCONV_H__
@@ -7,72 +7,59 @@
 
 #include <cstring>
 #include <cstdlib>
-#include <stdexcept>
-#include <cctype>
-#include <algorithm>
 #include "lstring.h"
 
-#ifdef LSTRING_VALIDATE
-    #define VALIDATE(size) validate(size)
-#else
-    #define VALIDATE(size)
-#endif
-
 using namespace std;
-    
-namespace util {
 
-void string::init(uint32_t size)
-{
-    allocatedLength_ = size > STRING_SIZE ? size : STRING_SIZE;
-    allocatedLength_++;
-    data_ = new char[allocatedLength_]; // Including null terminator
-}
-
-string::string(uint32_t size)
-{
-    init(size);
-    data_[0] = 0;
-    length_ = 0;
-}
+namespace util {
 
-//
-// Validate the string memory overrun, throws exception
-//
-#ifdef LSTRING_VALIDATE
-void string::validate(uint32_t size)
+uint32_t string_view::find(char ch, uint32_t pos) const
 {
-    if (size >= allocatedLength_) {
-        abort();
+    for (uint32_t i = pos; i < length_; i++) {
+        if (data_[i] == ch)
+            return i;
     }
+    return npos;
 }
-#endif
 
-string::string(const char* s)
+uint32_t string_view::find(string_view str, uint32_t pos) const
 {
-    length_ = strlen(s);
-    init(length_);
-    strcpy(data_, s);
+    if (str.length_ > length_)
+        return npos;
+    for (uint32_t i = pos; i <= length_ - str.length_; i++) {
+        if (memcmp(data_ + i, str.data_, str.length_) == 0)
+            return i;
+    }
+    return npos;
 }
 
-string::string(const string& str)
+string_view string_view::substr(uint32_t pos, uint32_t count) const
 {
-    length_ = str.length_;
-    init(length_);
-    strcpy(data_, str.data_);
+    uint32_t p = (pos >= length_) ? length_ : pos;
+    uint32_t l = (count < length_ - p) ? count : (length_ - p);
+    return string_view(data_ + p, l);
 }
 
-string::string(uint32_t count, char ch)
+string::string(char* data, uint32_t capacity)
+  : data_(data),
+    length_(0),
+    capacity_(capacity)
 {
-    length_ = count;
-    init(length_);
-    memset(data_, ch, length_);
-    data_[length_] = 0;
+    data_[0] = 0;
 }
 
-string::~string()
+//
+// The length limited by capacity, the overrun is truncated
+// or aborted if validation is on
+//
+uint32_t string::fit(uint32_t count) const
 {
-    delete[] data_; 
+    if (count <= capacity_)
+        return count;
+#ifdef LSTRING_VALIDATE
+    abort();
+#endif
+    return capacity_;
 }
 
 void string::resize(uint32_t count)
@@ -81,38 +68,31 @@ void string::resize(uint32_t count)
         length_ = count;
         data_[length_] = 0;
     }
-    else {
-        ; // nothing
-    }
 }
 
 void string::resize(uint32_t count, char ch)
 {
+    count = fit(count);
     if (count < length_) {
         length_ = count;
         data_[length_] = 0;
     }
     else if (count > length_) {
-        VALIDATE(count);
         memset(data_ + length_, ch, count - length_);
         length_ = count;
         data_[length_] = 0;
     }
 }
 
-string& string::append(const char* s)
+string& string::append(string_view str)
 {
-    int len = strlen(s);
-    VALIDATE(length_ + len); 
-    strcpy(data_ + length_, s);
-    length_ += len;
-    return *this;
+    return append(str.data(), str.length());
 }
 
 string& string::append(const char* s, uint32_t count)
 {
-    VALIDATE(length_ + count);
-    memcpy(data_ + length_, s, count);
+    count = fit(length_ + count) - length_;
+    memmove(data_ + length_, s, count);
     length_ += count;
     data_[length_] = 0;
     return *this;
@@ -120,144 +100,76 @@ string& string::append(const char* s, uint32_t count)
 
 string& string::append(uint32_t count, char ch)
 {
-	VALIDATE(length_ + count);
-    for (uint32_t i = 0; i < count; i++) {
-        (*this) += ch;
-    }
+    resize(length_ + count, ch);
     return *this;
 }
 
 string& string::assign(uint32_t count, char ch)
 {
-    length_ = count;
-    VALIDATE(length_ + count);
-    memset(data_, ch, count);
-    data_[count] = 0;
+    length_ = 0;
+    resize(count, ch);
     return *this;
 }
 
-string& string::operator+=(const string& str)
-{
-    return append(str.data_, str.length_);
-}
-
-string& string::operator+=(const char* s)
-{
-    return append(s);
-}
-
 string& string::operator+=(char ch)
 {
-    VALIDATE(length_ + 1);
-    data_[length_] = ch;
-    data_[++length_] = 0;
+    if (fit(length_ + 1) > length_) {
+        data_[length_] = ch;
+        data_[++length_] = 0;
+    }
     return *this;
 }
 
-uint32_t string::find(const string& str, uint32_t pos) const
+uint32_t string::find(string_view str, uint32_t pos) const
 {
-    const char* p = strstr(data_ + pos, str.data_);
-    return p ? (p - data_) : npos;
+    return string_view(*this).find(str, pos);
 }
 
 uint32_t string::find(char ch, uint32_t pos) const
 {
-    const char* p = strchr(data_ + pos, ch);
-    return p ? (p - data_) : npos;
+    return string_view(*this).find(ch, pos);
 }
 
-string string::substr(uint32_t pos, uint32_t count) const
+string_view string::substr(uint32_t pos, uint32_t count) const
 {
-    uint32_t p = (pos >= length_) ? 0 : pos; // should be an exception
-    uint32_t l = (length_ < count) ? (length_ - p) : count;
-    string s(l + 1);
-    s.append(data_ + p, l);
-    return s;
+    return string_view(*this).substr(pos, count);
 }
 
 string& string::operator=(const string& str)
 {
-    VALIDATE(str.length_);
-    memcpy(data_, str.data_, str.length_ + 1); // including null terminator
-    length_ = str.length_;
-    return *this;
+    return operator=(string_view(str));
 }
 
-string& string::operator=(const char* s)
+string& string::operator=(string_view str)
 {
-    length_ = strlen(s);
-    VALIDATE(length_);
-    strcpy(data_, s);
+    // The view could be a part of this string, memmove takes care of the overlap
+    uint32_t count = fit(str.length());
+    memmove(data_, str.data(), count);
+    length_ = count;
+    data_[length_] = 0;
     return *this;
 }
-void string::clear() 
+
+void string::clear()
 {
-	length_ = 0;
-	data_[0] = 0;
+    length_ = 0;
+    data_[0] = 0;
 }
 
 uint32_t string::copy(char* dest, uint32_t count, uint32_t pos) const
 {
-	memcpy(dest, data_ + pos, count);
+    memcpy(dest, data_ + pos, count);
     return count;
 }
 
-bool operator==(const string& lhs, const char* rhs)
-{
-    return (strcmp(lhs.c_str(), rhs) == 0);
-}
-
-bool operator!=(const string& lhs, const char* rhs)
-{
-    return (strcmp(lhs.c_str(), rhs) != 0);
-}
-
-bool operator==(const string& lhs, const string& rhs)
-{
-    return (strcmp(lhs.c_str(), rhs.c_str()) == 0);
-}
-
-string operator+(const string& lhs, const string& rhs)
-{
-    string s(lhs);
-    s += rhs;
-    return s;
-}
-
-string operator+(const char* lhs, const string& rhs)
-{
-    int len = strlen(lhs) + rhs.length();
-    string s(len + 1);
-    s += lhs;
-    s += rhs;
-    return s;
-}
-
-string operator+(char ch, const string& rhs)
-{
-    int len = rhs.length() + 1;
-    string s(len + 1);
-    s += ch;
-    s += rhs;
-    return s;
-}
-
-string operator+(const string& lhs, const char* rhs)
+bool operator==(string_view lhs, string_view rhs)
 {
-    int len = lhs.length() + strlen(rhs);
-    string s(len + 1);
-    s += lhs;
-    s += rhs;
-    return s;
+    return lhs.length() == rhs.length() && memcmp(lhs.data(), rhs.data(), lhs.length()) == 0;
 }
 
-string operator+(const string& lhs, char ch)
+bool operator!=(string_view lhs, string_view rhs)
 {
-    int len = lhs.length() + 1;
-    string s(len + 1);
-    s += lhs;
-    s += ch;
-    return s;
+    return !(lhs == rhs);
 }
 
 } // end util namespace
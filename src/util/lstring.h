@@ -6,13 +6,17 @@
  */
 
 //
-// Lightweight string class
+// Lightweight string classes, no heap allocation:
+//   string_view - non-owning read-only reference, used for arguments
+//   string      - fixed capacity string, the storage is provided by fstring<N>
+//   fstring<N>  - string with inline storage of N characters
 //
 
-#ifndef __LSTRING_H__ 
+#ifndef __LSTRING_H__
 #define __LSTRING_H__
 
 #include <cstdint>
+#include <cstring>
 
 using namespace std;
 
@@ -20,54 +24,85 @@ using namespace std;
 
 namespace util {
 
-class string {
+class string;
+
+class string_view {
 public:
-    const static uint32_t STRING_SIZE = 50;
     const static uint32_t npos = 0xFFFFFFFF;
-    string(uint32_t size = STRING_SIZE);
-    string(const char* s);
-    string(const string& other);
-    string(uint32_t count, char ch);
-    ~string();
+    string_view() : data_(""), length_(0) {}
+    string_view(const char* s) : data_(s), length_(strlen(s)) {}
+    string_view(const char* s, uint32_t count) : data_(s), length_(count) {}
+    string_view(const string& str);
+    const char* data() const { return data_; }
+    uint32_t length() const { return length_; }
+    bool empty() const { return (length_ == 0); }
+    char operator[](uint32_t pos) const { return data_[pos]; }
+    uint32_t find(char ch, uint32_t pos = 0) const;
+    uint32_t find(string_view str, uint32_t pos = 0) const;
+    string_view substr(uint32_t pos, uint32_t count = npos) const;
+private:
+    const char* data_;
+    uint32_t    length_;
+};
+
+class string {
+public:
+    const static uint32_t npos = string_view::npos;
     void resize(uint32_t count);
     void resize(uint32_t count, char ch);
-    string& append(const char* s);
+    string& append(string_view str);
     string& append(const char* s, uint32_t count);
     string& append(uint32_t count, char ch);
     string& assign(uint32_t count, char ch);
     void clear();
+    uint32_t capacity() const { return capacity_; }
     uint32_t copy(char* dest, uint32_t count, uint32_t pos = 0) const;
     const char* c_str() const { return data_; }
     bool empty() const { return (length_ == 0); }
-    uint32_t find(const string& str, uint32_t pos = 0) const;
+    uint32_t find(string_view str, uint32_t pos = 0) const;
     uint32_t find(char ch, uint32_t pos = 0) const;
     uint32_t length() const { return length_; }
-    string substr(uint32_t pos, uint32_t count = npos) const;
-    string& operator+=(const string& other);
-    string& operator+=(const char* s);
+    string_view substr(uint32_t pos, uint32_t count = npos) const;
+    string& operator+=(string_view str) { return append(str); }
+    string& operator+=(const char* s) { return append(string_view(s)); }
     string& operator+=(char ch);
     char operator[](uint32_t pos) const { return data_[pos]; }
     char& operator[](uint32_t pos) { return data_[pos]; }
     string& operator=(const string& str);
-    string& operator=(const char* s);
+    string& operator=(string_view str);
+    string& operator=(const char* s) { return operator=(string_view(s)); }
+protected:
+    string(char* data, uint32_t capacity);
 private:
-    void init(uint32_t size);
-    char* data_;
+    string(const string& other); // Storage is owned by derived class
+    uint32_t fit(uint32_t count) const;
+    char*    data_;
     uint16_t length_;
-    uint16_t allocatedLength_;
-#ifdef LSTRING_VALIDATE
-    void validate(uint32_t size);
-#endif
+    uint16_t capacity_;
+};
+
+template <uint32_t N>
+class fstring : public string {
+public:
+    fstring() : string(storage_, N) {}
+    fstring(string_view str) : string(storage_, N) { append(str); }
+    fstring(const char* s) : string(storage_, N) { append(string_view(s)); }
+    fstring(const fstring& other) : string(storage_, N) { append(other); }
+    fstring(uint32_t count, char ch) : string(storage_, N) { append(count, ch); }
+    fstring& operator=(const fstring& other) { string::operator=(other); return *this; }
+    fstring& operator=(string_view str) { string::operator=(str); return *this; }
+    fstring& operator=(const char* s) { string::operator=(s); return *this; }
+private:
+    char storage_[N + 1]; // Including null terminator
 };
 
-bool operator==(const string& lhs, const char* rhs);
-bool operator!=(const string& lhs, const char* rhs);
-bool operator==(const string& lhs, const string& rhs);
-string operator+(const string& lhs, const string& rhs);
-string operator+(const char* lhs, const string& rhs);
-string operator+(char ch, const string& rhs);
-string operator+(const string& lhs, const char* rhs);
-string operator+(const string& lhs, char ch);
+inline string_view::string_view(const string& str) : data_(str.c_str()), length_(str.length()) {}
+
+bool operator==(string_view lhs, string_view rhs);
+bool operator!=(string_view lhs, string_view rhs);
+inline bool operator==(const string& lhs, const char* rhs) { return string_view(lhs) == string_view(rhs); }
+inline bool operator!=(const string& lhs, const char* rhs) { return string_view(lhs) != string_view(rhs); }
+inline bool operator==(const string& lhs, const string& rhs) { return string_view(lhs) == string_view(rhs); }
 
 }
 